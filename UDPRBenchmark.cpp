@@ -0,0 +1,869 @@
+// Loopback benchmark of StreamSender and StreamReceiver. Every transfer goes through an in-process link that drops,
+// delays, jitters, reorders and rate limits datagrams in both directions alike. Packet sizes, timeouts, stream sizes
+// and transfer modes are swept, every combination is run a number of times and printed as one JSON object per line:
+// goodput, p50/p99 completion time and CPU seconds per GB, next to the settings it ran with.
+//
+// Built on its own next to the headers, there is nothing else to it:
+//	g++ -std=c++17 -O2 -pthread UDPRBenchmark.cpp -o UDPRBenchmark
+//	cl /std:c++17 /O2 /EHsc UDPRBenchmark.cpp ws2_32.lib
+//
+// For example, 1% loss on a 10 ms path of 100 Mbit/s:
+//	UDPRBenchmark --packet=1400,8972 --size=4M --runs=10 --loss=0.01 --delay-ms=5 --rate-mbps=100 --mode=push --fec
+//
+// Or segmented sends read coalesced, straight from the sender. A run only counts if what arrived has the source's CRC:
+//	UDPRBenchmark --packet=1400 --mode=push --gso --gro --direct
+//
+// It exits with 2 if any run failed, so a run timeout makes it a check that transfers stay bounded. For example,
+// pushing through loss and jitter, where every run has to be done within 5 seconds:
+//	UDPRBenchmark --packet=1400 --size=4M --runs=20 --mode=push --loss=0.02 --delay-ms=5 --jitter-ms=2 --run-timeout-s=5
+//
+// The same with a congestion controller shows what reordering costs it:
+//	UDPRBenchmark --packet=1400 --size=4M --runs=20 --mode=push --loss=0.02 --delay-ms=5 --jitter-ms=2 --congestion=cubic
+
+/// STD
+#include <atomic>
+#include <thread>
+#include <chrono>
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <cmath>
+#include <string>
+#include <vector>
+#include <queue>
+#include <random>
+#include <algorithm>
+#include <ios>
+
+#ifdef _WIN32
+#include <Windows.h>
+#else
+#include <sys/resource.h>
+#include <sys/select.h>
+#include <time.h>
+#endif
+
+/// CUSTOM
+#include "UDPRStreamSender.h"
+#include "UDPRStreamReceiver.h"
+#include "UDPRCrc.h"
+#include "UDPRTrace.h"
+
+using namespace UDPR;
+using Clock = std::chrono::steady_clock;
+
+namespace
+{
+	/// Settings.
+
+	// What the link does to every datagram, in each direction.
+	struct LinkSettings
+	{
+		double loss = 0.0;
+		double delayMs = 0.0;
+		double jitterMs = 0.0;
+
+		// Reordered datagrams are held back for another delay and jitter, at least a millisecond.
+		double reorder = 0.0;
+
+		// 0 for no cap. Datagrams that would wait longer than queueMs for the link are dropped.
+		double rateMbps = 0.0;
+		double queueMs = 100.0;
+	};
+
+	struct Settings
+	{
+		std::vector<uint64_t> packetSizes = { 508, 1400, 8972 };
+		std::vector<uint64_t> timeoutsMs = { 100, 500 };
+		std::vector<uint64_t> streamSizes = { 1 << 20, 16 << 20 };
+		std::vector<TransferMode> modes = { TransferMode::pull, TransferMode::push };
+
+		int runs = 5;
+		uint16_t windowSz = 256;
+		int runTimeoutS = 60;
+		uint16_t port = 47000;
+		uint32_t seed = 1;
+
+		CongestionControl congestion = SenderOptions().congestion;
+
+		bool bFec = false;
+		bool bCompression = false;
+		bool bChecksums = false;
+		bool bPathMtuDiscovery = false;
+		bool bMapped = false;
+		bool bTextData = false;
+		bool bSegmentation = false;
+		bool bCoalescing = false;
+
+		// The receiver talks to the sender without the link in between, which segments whatever it forwards.
+		bool bDirect = false;
+
+		// Where the event trace goes, nothing is traced without one.
+		std::string tracePath;
+
+		LinkSettings link;
+	};
+
+	const char* CongestionName(CongestionControl congestion)
+	{
+		switch (congestion)
+		{
+		case CongestionControl::cubic:
+			return "cubic";
+		case CongestionControl::delay:
+			return "delay";
+		default:
+			return "none";
+		}
+	}
+
+	/// CPU time.
+
+	double GetProcessCpuSeconds()
+	{
+	#ifdef _WIN32
+		FILETIME creation, exit, kernel, user;
+		GetProcessTimes(GetCurrentProcess(), &creation, &exit, &kernel, &user);
+
+		auto seconds = [](const FILETIME& time) { return ((static_cast<uint64_t>(time.dwHighDateTime) << 32) | time.dwLowDateTime) * 1e-7; };
+		return seconds(kernel) + seconds(user);
+	#else
+		rusage usage;
+		getrusage(RUSAGE_SELF, &usage);
+
+		return usage.ru_utime.tv_sec + usage.ru_stime.tv_sec + (usage.ru_utime.tv_usec + usage.ru_stime.tv_usec) * 1e-6;
+	#endif
+	}
+
+	double GetThreadCpuSeconds()
+	{
+	#ifdef _WIN32
+		FILETIME creation, exit, kernel, user;
+		GetThreadTimes(GetCurrentThread(), &creation, &exit, &kernel, &user);
+
+		auto seconds = [](const FILETIME& time) { return ((static_cast<uint64_t>(time.dwHighDateTime) << 32) | time.dwLowDateTime) * 1e-7; };
+		return seconds(kernel) + seconds(user);
+	#else
+		timespec time;
+		clock_gettime(CLOCK_THREAD_CPUTIME_ID, &time);
+
+		return time.tv_sec + time.tv_nsec * 1e-9;
+	#endif
+	}
+
+	/// Streams.
+
+	// The sender's stream, read like a std::basic_ifstream.
+	class SourceStream
+	{
+	public:
+		explicit SourceStream(const std::vector<BYTE>& _data) : data(_data) {  }
+
+		SourceStream& read(BYTE* dst, std::streamsize count)
+		{
+			lastCount = 0;
+			if (bFail)
+			{
+				return *this;
+			}
+
+			const uint64_t available = data.size() - pos;
+			if (static_cast<uint64_t>(count) > available)
+			{
+				count = static_cast<std::streamsize>(available);
+				bEof = bFail = true;
+			}
+
+			std::memcpy(dst, data.data() + pos, static_cast<size_t>(count));
+			pos += static_cast<uint64_t>(count);
+			lastCount = count;
+
+			return *this;
+		}
+
+		SourceStream& seekg(uint64_t _pos)
+		{
+			if (_pos > data.size())
+			{
+				bFail = true;
+				return *this;
+			}
+
+			pos = _pos;
+			return *this;
+		}
+
+		SourceStream& seekg(std::streamoff offset, std::ios::seekdir dir)
+		{
+			return seekg(static_cast<uint64_t>(((dir == std::ios::end) ? static_cast<std::streamoff>(data.size()) :
+												(dir == std::ios::cur) ? static_cast<std::streamoff>(pos) : 0) + offset));
+		}
+
+		FORCEINLINE std::streamoff tellg() const { return bFail ? -1 : static_cast<std::streamoff>(pos); }
+		FORCEINLINE std::streamsize gcount() const { return lastCount; }
+		FORCEINLINE bool eof() const { return bEof; }
+		FORCEINLINE bool fail() const { return bFail; }
+		FORCEINLINE void clear() { bEof = bFail = false; }
+
+	protected:
+		const std::vector<BYTE>& data;
+		uint64_t pos = 0;
+		std::streamsize lastCount = 0;
+		bool bEof = false;
+		bool bFail = false;
+	};
+
+	// The same stream handed over whole, which the sender sends from without copying.
+	class MappedSourceStream : public SourceStream
+	{
+	public:
+		using SourceStream::SourceStream;
+
+		FORCEINLINE const BYTE* GetData() const { return data.data(); }
+		FORCEINLINE uint64_t GetSize() const { return data.size(); }
+	};
+
+	// What a receiver wrote, the receiver owns the stream so it outlives it.
+	struct SinkResult
+	{
+		uint64_t written = 0;
+		uint32_t crc = 0;
+		Clock::time_point lastWriteAt;
+	};
+
+	// The receiver's stream, only checksums what is written.
+	class SinkStream
+	{
+	public:
+		explicit SinkStream(SinkResult* _result) : result(_result) {  }
+
+		SinkStream& write(const BYTE* data, std::streamsize count)
+		{
+			result->crc = Crc32c::Compute(data, static_cast<size_t>(count), result->crc);
+			result->written += static_cast<uint64_t>(count);
+			result->lastWriteAt = Clock::now();
+
+			return *this;
+		}
+
+	private:
+		SinkResult* result;
+	};
+
+	/// The impaired link.
+
+	// Sits between a receiver and a sender on loopback. The receiver is pointed at the link's address, which forwards
+	// to the sender's port and back to whoever it last heard from.
+	class ImpairedLink
+	{
+	public:
+		ImpairedLink(const LinkSettings& _settings, uint32_t seed) : settings(_settings), rng(seed) {  }
+
+		~ImpairedLink()
+		{
+			Stop();
+
+			CloseSocket(front);
+			CloseSocket(back);
+		}
+
+		bool Open(uint16_t senderPort)
+		{
+			front = socket(AF_INET, SOCK_DGRAM, IPPROTO_UDP);
+			back = socket(AF_INET, SOCK_DGRAM, IPPROTO_UDP);
+			if ((front == INVALID_SOCKET) || (back == INVALID_SOCKET))
+			{
+				return false;
+			}
+
+			SOCKADDR_IN addr {  };
+			addr.sin_family = AF_INET;
+			addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+			addr.sin_port = 0;
+
+			socklen_t addrLen = sizeof(addr);
+			if ((bind(front, reinterpret_cast<sockaddr*>(&addr), sizeof(addr)) != 0) ||
+				(getsockname(front, reinterpret_cast<sockaddr*>(&frontAddr), &addrLen) != 0))
+			{
+				return false;
+			}
+
+			senderAddr = addr;
+			senderAddr.sin_port = htons(senderPort);
+
+			// Everything in flight has to fit, the link drops on its own terms only.
+			for (SOCKET sock : { front, back })
+			{
+				GrowSocketBuffer(sock, SO_RCVBUF, LINK_socketBufferSz);
+				GrowSocketBuffer(sock, SO_SNDBUF, LINK_socketBufferSz);
+
+				if (!SetNonBlocking(sock))
+				{
+					return false;
+				}
+			}
+
+			process = std::thread(&ImpairedLink::Forward, this);
+			return true;
+		}
+
+		void Stop()
+		{
+			if (process.joinable())
+			{
+				bShouldStop = true;
+				process.join();
+			}
+		}
+
+		FORCEINLINE const SOCKADDR_IN& GetAddress() const { return frontAddr; }
+
+		// Only once stopped.
+		FORCEINLINE double GetCpuSeconds() const { return cpuSeconds; }
+		FORCEINLINE uint64_t GetForwarded() const { return forwarded; }
+		FORCEINLINE uint64_t GetDropped() const { return dropped; }
+
+	private:
+		static constexpr int LINK_socketBufferSz = 16 * 1024 * 1024;
+		static constexpr int LINK_maxDatagramSz = 65536;
+
+		struct Direction
+		{
+			Clock::time_point linkFreeAt;
+		};
+
+		struct InFlight
+		{
+			Clock::time_point dueAt;
+			uint64_t seq;
+			bool bToSender;
+			std::vector<char> data;
+
+			bool operator>(const InFlight& other) const
+			{
+				return (dueAt != other.dueAt) ? (dueAt > other.dueAt) : (seq > other.seq);
+			}
+		};
+
+		void Forward()
+		{
+			const double cpuAtStart = GetThreadCpuSeconds();
+			std::vector<char> buffer(LINK_maxDatagramSz);
+
+			while (!bShouldStop)
+			{
+				Deliver(Clock::now());
+
+				// Waking up for the next datagram due, or to check whether to stop.
+				Clock::duration wait = std::chrono::milliseconds(5);
+				if (!inFlight.empty())
+				{
+					wait = (std::min)(wait, (std::max)(inFlight.top().dueAt - Clock::now(), Clock::duration::zero()));
+				}
+
+				const auto waitUs = std::chrono::duration_cast<std::chrono::microseconds>(wait).count();
+				timeval timeout = { static_cast<long>(waitUs / 1000000), static_cast<long>(waitUs % 1000000) };
+
+				fd_set readable;
+				FD_ZERO(&readable);
+				FD_SET(front, &readable);
+				FD_SET(back, &readable);
+
+				if (select(static_cast<int>((std::max)(front, back) + 1), &readable, nullptr, nullptr, &timeout) <= 0)
+				{
+					continue;
+				}
+
+				Receive(front, true, buffer);
+				Receive(back, false, buffer);
+			}
+
+			cpuSeconds = GetThreadCpuSeconds() - cpuAtStart;
+		}
+
+		// Takes in everything waiting on the socket.
+		void Receive(SOCKET sock, bool bToSender, std::vector<char>& buffer)
+		{
+			while (true)
+			{
+				SOCKADDR_IN from;
+				socklen_t fromLen = sizeof(from);
+
+				const int len = recvfrom(sock, buffer.data(), static_cast<int>(buffer.size()), 0, reinterpret_cast<sockaddr*>(&from), &fromLen);
+				if (len < 0)
+				{
+					return;
+				}
+
+				if (bToSender)
+				{
+					receiverAddr = from;
+					bReceiverKnown = true;
+				}
+
+				Schedule(bToSender, buffer.data(), len);
+			}
+		}
+
+		void Schedule(bool bToSender, const char* data, int len)
+		{
+			std::uniform_real_distribution<double> uniform(0.0, 1.0);
+			if (uniform(rng) < settings.loss)
+			{
+				++dropped;
+				return;
+			}
+
+			const Clock::time_point now = Clock::now();
+			Clock::time_point sentAt = now;
+
+			// Queueing behind whatever is still being put on the link.
+			if (settings.rateMbps > 0.0)
+			{
+				Direction& direction = directions[bToSender ? 1 : 0];
+
+				const Clock::time_point startAt = (std::max)(now, direction.linkFreeAt);
+				if (startAt - now > ToClock(settings.queueMs))
+				{
+					++dropped;
+					return;
+				}
+
+				direction.linkFreeAt = startAt + ToClock(len * 8.0 / (settings.rateMbps * 1000.0));
+				sentAt = direction.linkFreeAt;
+			}
+
+			double delayMs = settings.delayMs + uniform(rng) * settings.jitterMs;
+			if (uniform(rng) < settings.reorder)
+			{
+				delayMs += (std::max)(settings.delayMs + settings.jitterMs, 1.0);
+			}
+
+			inFlight.push({ sentAt + ToClock(delayMs), seq++, bToSender, std::vector<char>(data, data + len) });
+		}
+
+		void Deliver(Clock::time_point now)
+		{
+			while (!inFlight.empty() && (inFlight.top().dueAt <= now))
+			{
+				const InFlight& datagram = inFlight.top();
+				if (datagram.bToSender)
+				{
+					sendto(back, datagram.data.data(), static_cast<int>(datagram.data.size()), 0,
+						   reinterpret_cast<const sockaddr*>(&senderAddr), sizeof(senderAddr));
+				}
+				else if (bReceiverKnown)
+				{
+					sendto(front, datagram.data.data(), static_cast<int>(datagram.data.size()), 0,
+						   reinterpret_cast<const sockaddr*>(&receiverAddr), sizeof(receiverAddr));
+				}
+
+				++forwarded;
+				inFlight.pop();
+			}
+		}
+
+		static FORCEINLINE Clock::duration ToClock(double ms)
+		{
+			return std::chrono::duration_cast<Clock::duration>(std::chrono::duration<double, std::milli>(ms));
+		}
+
+	private:
+		const LinkSettings settings;
+		std::mt19937 rng;
+
+		SOCKET front = INVALID_SOCKET;
+		SOCKET back = INVALID_SOCKET;
+		SOCKADDR_IN frontAddr {  };
+		SOCKADDR_IN senderAddr {  };
+		SOCKADDR_IN receiverAddr {  };
+		bool bReceiverKnown = false;
+
+		// To the receiver, and to the sender.
+		Direction directions[2];
+		std::priority_queue<InFlight, std::vector<InFlight>, std::greater<InFlight>> inFlight;
+		uint64_t seq = 0;
+
+		uint64_t forwarded = 0;
+		uint64_t dropped = 0;
+		double cpuSeconds = 0.0;
+
+		std::atomic_bool bShouldStop = false;
+		std::thread process;
+	};
+
+	/// Runs.
+
+	struct Case
+	{
+		uint16_t packetSz;
+		uint64_t timeoutMs;
+		uint64_t streamSz;
+		TransferMode mode;
+	};
+
+	struct RunResult
+	{
+		bool bOk = false;
+		double seconds = 0.0;
+		double cpuSeconds = 0.0;
+		uint64_t forwarded = 0;
+		uint64_t dropped = 0;
+	};
+
+	template<class TSource>
+	RunResult Run(const Settings& settings, const Case& c, const std::vector<BYTE>& source, uint32_t sourceCrc, uint16_t port, uint32_t seed)
+	{
+		RunResult result;
+
+		const timeval timeout = { static_cast<long>(c.timeoutMs / 1000), static_cast<long>((c.timeoutMs % 1000) * 1000) };
+
+		SenderOptions senderOptions;
+		senderOptions.congestion = settings.congestion;
+		senderOptions.bPathMtuDiscovery = settings.bPathMtuDiscovery;
+		senderOptions.bFec = settings.bFec;
+		senderOptions.bCompression = settings.bCompression;
+		senderOptions.bChecksums = settings.bChecksums;
+		senderOptions.bSegmentation = settings.bSegmentation;
+
+		StreamSender<TSource> sender(new TSource(source), port, c.packetSz, timeout, senderOptions);
+		if (sender.ErrorOccured())
+		{
+			std::fprintf(stderr, "sender: %s\n", sender.GetErrorString().c_str());
+			return result;
+		}
+
+		ImpairedLink link(settings.link, seed);
+		if (!settings.bDirect && !link.Open(port))
+		{
+			std::fprintf(stderr, "link: failed to open its sockets\n");
+			return result;
+		}
+
+		SOCKADDR_IN senderAddr {  };
+		senderAddr.sin_family = AF_INET;
+		senderAddr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+		senderAddr.sin_port = htons(port);
+
+		ReceiverOptions receiverOptions;
+		receiverOptions.bFec = settings.bFec;
+		receiverOptions.bCompression = settings.bCompression;
+		receiverOptions.bChecksums = settings.bChecksums;
+		receiverOptions.bCoalescing = settings.bCoalescing;
+
+		SinkResult sink;
+		bool bComplete = false;
+		Clock::time_point finishedAt;
+
+		const double cpuAtStart = GetProcessCpuSeconds();
+		const Clock::time_point startedAt = Clock::now();
+		{
+			StreamReceiver<SinkStream> receiver(new SinkStream(&sink), settings.bDirect ? senderAddr : link.GetAddress(), timeout,
+												settings.windowSz, c.mode, receiverOptions);
+			while (receiver.IsRunning() && (Clock::now() - startedAt < std::chrono::seconds(settings.runTimeoutS)))
+			{
+				std::this_thread::sleep_for(std::chrono::microseconds(200));
+			}
+
+			finishedAt = Clock::now();
+			result.cpuSeconds = GetProcessCpuSeconds() - cpuAtStart;
+
+			bComplete = receiver.IsComplete();
+			if (receiver.ErrorOccured())
+			{
+				std::fprintf(stderr, "receiver: %s\n", receiver.GetErrorString().c_str());
+			}
+		}
+
+		link.Stop();
+		sender.Stop();
+
+		// The last byte written is when the stream arrived, unless a digest still had to be checked.
+		if ((sink.written > 0) && !settings.bChecksums)
+		{
+			finishedAt = sink.lastWriteAt;
+		}
+
+		result.bOk = bComplete && (sink.written == source.size()) && (sink.crc == sourceCrc);
+		result.seconds = std::chrono::duration<double>(finishedAt - startedAt).count();
+		result.cpuSeconds = (std::max)(result.cpuSeconds - link.GetCpuSeconds(), 0.0);
+		result.forwarded = link.GetForwarded();
+		result.dropped = link.GetDropped();
+
+		return result;
+	}
+
+	// Nearest rank.
+	double Percentile(std::vector<double> values, double p)
+	{
+		if (values.empty())
+		{
+			return 0.0;
+		}
+
+		std::sort(values.begin(), values.end());
+		const size_t rank = static_cast<size_t>(std::ceil(p * values.size()));
+		return values[(std::max)(rank, static_cast<size_t>(1)) - 1];
+	}
+
+	std::vector<BYTE> MakeSource(uint64_t size, bool bText, uint32_t seed)
+	{
+		std::vector<BYTE> data(static_cast<size_t>(size));
+		std::mt19937 rng(seed);
+
+		if (!bText)
+		{
+			for (BYTE& b : data)
+			{
+				b = static_cast<BYTE>(rng());
+			}
+
+			return data;
+		}
+
+		// Log lines, repetitive with some variation, which is what compression is meant for.
+		static const char* const words[] = { "INFO", "WARN", "request", "served", "from", "cache", "in", "ms", "session", "closed" };
+		size_t pos = 0;
+		while (pos < data.size())
+		{
+			char line[128];
+			const int len = std::snprintf(line, sizeof(line), "%010u %s %s %s %u %s\n", static_cast<unsigned>(pos), words[rng() % 2],
+										  words[2 + rng() % 8], words[2 + rng() % 8], static_cast<unsigned>(rng() % 1000), words[2 + rng() % 8]);
+
+			const size_t copied = (std::min)(static_cast<size_t>(len), data.size() - pos);
+			std::memcpy(data.data() + pos, line, copied);
+			pos += copied;
+		}
+
+		return data;
+	}
+
+	/// Command line.
+
+	uint64_t ParseSize(const std::string& text)
+	{
+		char* end = nullptr;
+		uint64_t value = std::strtoull(text.c_str(), &end, 10);
+
+		switch ((end != nullptr) ? *end : '\0')
+		{
+		case 'K': case 'k': return value << 10;
+		case 'M': case 'm': return value << 20;
+		case 'G': case 'g': return value << 30;
+		default: return value;
+		}
+	}
+
+	std::vector<uint64_t> ParseList(const std::string& text)
+	{
+		std::vector<uint64_t> values;
+		for (size_t start = 0; start <= text.size(); )
+		{
+			size_t end = text.find(',', start);
+			end = (end == std::string::npos) ? text.size() : end;
+
+			if (end > start)
+			{
+				values.push_back(ParseSize(text.substr(start, end - start)));
+			}
+
+			start = end + 1;
+		}
+
+		return values;
+	}
+
+	void PrintUsage()
+	{
+		std::printf(
+			"UDPRBenchmark [options], lists are comma separated, sizes take K, M and G.\n"
+			"  --packet=LIST        packet sizes (508,1400,8972)\n"
+			"  --timeout-ms=LIST    timeouts (100,500)\n"
+			"  --size=LIST          stream sizes (1M,16M)\n"
+			"  --mode=pull|push|both\n"
+			"  --runs=N             runs per combination (5)\n"
+			"  --window=N           receiver window (256)\n"
+			"  --run-timeout-s=N    a run taking longer fails, any failure exits with 2 (60)\n"
+			"  --port=N             first sender port, every run takes the next (47000)\n"
+			"  --seed=N\n"
+			"  --loss=P --delay-ms=D --jitter-ms=J --reorder=P --rate-mbps=R --queue-ms=Q\n"
+			"                       what the link does to every datagram, in each direction\n"
+			"  --congestion=none|cubic|delay\n"
+			"                       the sender's congestion control (none)\n"
+			"  --fec --compress --checksums --pmtu\n"
+			"                       the sender's and receiver's options of the same names, --pmtu probes the path\n"
+			"                       instead of using the packet size given\n"
+			"  --mapped             send from a mapped stream, without copying\n"
+			"  --text               send compressible text instead of random bytes\n"
+			"  --gso --gro          segment the sender's sends and coalesce the receiver's reads where the kernel can\n"
+			"  --direct             leave the link out, the receiver talks to the sender straight away\n"
+			"  --trace=PATH         trace events and dump them to PATH once a run fails, or at the end\n");
+	}
+
+	bool ParseArguments(int argc, char** argv, Settings& settings)
+	{
+		for (int i = 1; i < argc; ++i)
+		{
+			const std::string arg = argv[i];
+			const size_t eq = arg.find('=');
+			const std::string name = arg.substr(0, eq);
+			const std::string value = (eq == std::string::npos) ? std::string() : arg.substr(eq + 1);
+
+			if (name == "--packet") settings.packetSizes = ParseList(value);
+			else if (name == "--timeout-ms") settings.timeoutsMs = ParseList(value);
+			else if (name == "--size") settings.streamSizes = ParseList(value);
+			else if (name == "--runs") settings.runs = std::atoi(value.c_str());
+			else if (name == "--window") settings.windowSz = static_cast<uint16_t>(std::atoi(value.c_str()));
+			else if (name == "--run-timeout-s") settings.runTimeoutS = std::atoi(value.c_str());
+			else if (name == "--port") settings.port = static_cast<uint16_t>(std::atoi(value.c_str()));
+			else if (name == "--seed") settings.seed = static_cast<uint32_t>(std::strtoul(value.c_str(), nullptr, 10));
+			else if (name == "--loss") settings.link.loss = std::atof(value.c_str());
+			else if (name == "--delay-ms") settings.link.delayMs = std::atof(value.c_str());
+			else if (name == "--jitter-ms") settings.link.jitterMs = std::atof(value.c_str());
+			else if (name == "--reorder") settings.link.reorder = std::atof(value.c_str());
+			else if (name == "--rate-mbps") settings.link.rateMbps = std::atof(value.c_str());
+			else if (name == "--queue-ms") settings.link.queueMs = std::atof(value.c_str());
+			else if (name == "--congestion")
+			{
+				if (value == "none") settings.congestion = CongestionControl::none;
+				else if (value == "cubic") settings.congestion = CongestionControl::cubic;
+				else if (value == "delay") settings.congestion = CongestionControl::delay;
+				else return false;
+			}
+			else if (name == "--fec") settings.bFec = true;
+			else if (name == "--compress") settings.bCompression = true;
+			else if (name == "--checksums") settings.bChecksums = true;
+			else if (name == "--pmtu") settings.bPathMtuDiscovery = true;
+			else if (name == "--mapped") settings.bMapped = true;
+			else if (name == "--text") settings.bTextData = true;
+			else if (name == "--gso") settings.bSegmentation = true;
+			else if (name == "--gro") settings.bCoalescing = true;
+			else if (name == "--direct") settings.bDirect = true;
+			else if (name == "--trace") settings.tracePath = value;
+			else if (name == "--mode")
+			{
+				if (value == "pull") settings.modes = { TransferMode::pull };
+				else if (value == "push") settings.modes = { TransferMode::push };
+				else if (value == "both") settings.modes = { TransferMode::pull, TransferMode::push };
+				else return false;
+			}
+			else
+			{
+				return false;
+			}
+		}
+
+		return (settings.runs > 0) && (settings.windowSz > 0) && !settings.packetSizes.empty() &&
+			   !settings.timeoutsMs.empty() && !settings.streamSizes.empty();
+	}
+}
+
+int main(int argc, char** argv)
+{
+	Settings settings;
+	if (!ParseArguments(argc, argv, settings))
+	{
+		PrintUsage();
+		return 1;
+	}
+
+	if (NetStartup() != 0)
+	{
+		std::fprintf(stderr, "Failed the network startup.\n");
+		return 1;
+	}
+
+	const LinkSettings& link = settings.link;
+	uint16_t port = settings.port;
+	uint32_t seed = settings.seed;
+
+	// The first failure is dumped as it happened, later runs would overwrite it.
+	bool bTraceDumped = settings.tracePath.empty();
+	Tracer::Enable(!bTraceDumped);
+
+	bool bFailed = false;
+
+	for (uint64_t streamSz : settings.streamSizes)
+	{
+		const std::vector<BYTE> source = MakeSource(streamSz, settings.bTextData, settings.seed);
+		const uint32_t sourceCrc = Crc32c::Compute(source.data(), source.size());
+
+		for (uint64_t packetSz : settings.packetSizes)
+		{
+			for (uint64_t timeoutMs : settings.timeoutsMs)
+			{
+				for (TransferMode mode : settings.modes)
+				{
+					const Case c = { static_cast<uint16_t>(packetSz), timeoutMs, streamSz, mode };
+
+					std::vector<double> seconds;
+					double cpuSeconds = 0.0;
+					uint64_t forwarded = 0, dropped = 0;
+					int failures = 0;
+
+					for (int run = 0; run < settings.runs; ++run)
+					{
+						// A port of its own for every run, nothing left over from the last one reaches it.
+						port = (port >= 65000) ? settings.port : static_cast<uint16_t>(port + 1);
+
+						RunResult result = settings.bMapped ? Run<MappedSourceStream>(settings, c, source, sourceCrc, port, seed++) :
+															  Run<SourceStream>(settings, c, source, sourceCrc, port, seed++);
+
+						forwarded += result.forwarded;
+						dropped += result.dropped;
+
+						if (!result.bOk)
+						{
+							if (!bTraceDumped)
+							{
+								bTraceDumped = true;
+								Tracer::Enable(false);
+								Tracer::Dump(settings.tracePath);
+							}
+
+							++failures;
+							continue;
+						}
+
+						seconds.push_back(result.seconds);
+						cpuSeconds += result.cpuSeconds;
+					}
+
+					bFailed = bFailed || (failures > 0);
+
+					const double p50 = Percentile(seconds, 0.5);
+					const double p99 = Percentile(seconds, 0.99);
+					const double goodputMbps = (p50 > 0.0) ? (streamSz * 8.0 / p50 / 1e6) : 0.0;
+					const double cpuPerGb = seconds.empty() ? 0.0 : (cpuSeconds / (static_cast<double>(streamSz) * seconds.size() / 1e9));
+
+					std::printf("{\"packet\":%u,\"timeout_ms\":%llu,\"size\":%llu,\"mode\":\"%s\",\"runs\":%d,\"failures\":%d,"
+								"\"goodput_mbps\":%.2f,\"p50_ms\":%.3f,\"p99_ms\":%.3f,\"cpu_s_per_gb\":%.3f,"
+								"\"forwarded\":%llu,\"dropped\":%llu,"
+								"\"loss\":%g,\"delay_ms\":%g,\"jitter_ms\":%g,\"reorder\":%g,\"rate_mbps\":%g,\"queue_ms\":%g,"
+								"\"window\":%u,\"fec\":%s,\"compress\":%s,\"checksums\":%s,\"pmtu\":%s,\"mapped\":%s,\"text\":%s,"
+								"\"gso\":%s,\"gro\":%s,\"direct\":%s,\"congestion\":\"%s\"}\n",
+								static_cast<unsigned>(c.packetSz), static_cast<unsigned long long>(timeoutMs), static_cast<unsigned long long>(streamSz),
+								(mode == TransferMode::push) ? "push" : "pull", settings.runs, failures,
+								goodputMbps, p50 * 1e3, p99 * 1e3, cpuPerGb,
+								static_cast<unsigned long long>(forwarded), static_cast<unsigned long long>(dropped),
+								link.loss, link.delayMs, link.jitterMs, link.reorder, link.rateMbps, link.queueMs,
+								static_cast<unsigned>(settings.windowSz), settings.bFec ? "true" : "false", settings.bCompression ? "true" : "false",
+								settings.bChecksums ? "true" : "false", settings.bPathMtuDiscovery ? "true" : "false",
+								settings.bMapped ? "true" : "false", settings.bTextData ? "true" : "false",
+								settings.bSegmentation ? "true" : "false", settings.bCoalescing ? "true" : "false", settings.bDirect ? "true" : "false",
+								CongestionName(settings.congestion));
+					std::fflush(stdout);
+				}
+			}
+		}
+	}
+
+	if (!bTraceDumped)
+	{
+		Tracer::Dump(settings.tracePath);
+	}
+
+	NetCleanup();
+	return bFailed ? 2 : 0;
+}
@@ -0,0 +1,129 @@
+#pragma once
+
+/// STD
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+#include <string>
+#include <filesystem>
+#include <system_error>
+
+/// CUSTOM
+#include "UDPRDebugHeaders.h"
+#include "UDPRMisc.h"
+
+namespace UDPR
+{
+	/// 64-bit FNV-1a, what content fingerprints and checkpoint checksums are made of.
+	static constexpr uint64_t FNV_offsetBasis = 14695981039346656037ULL;
+	static constexpr uint64_t FNV_prime = 1099511628211ULL;
+
+	// Folds len bytes into hash, chain calls to hash several pieces as one.
+	static uint64_t Fnv1a(const void* data, size_t len, uint64_t hash = FNV_offsetBasis)
+	{
+		const BYTE* bytes = static_cast<const BYTE*>(data);
+		for (size_t i = 0; i < len; ++i)
+		{
+			hash ^= bytes[i];
+			hash *= FNV_prime;
+		}
+
+		return hash;
+	}
+
+	// How far a StreamReceiver got, saved next to what it writes so a receiver started over can resume there. The
+	// fingerprint is the sender's, a sender whose stream no longer has the same one can't be resumed from.
+	struct Checkpoint
+	{
+		/// Leads every checkpoint file, the version goes up whenever the layout changes.
+		static constexpr char CKPT_magic[7] = { 'U', 'D', 'P', 'R', 'C', 'K', 'P' };
+		static constexpr uint8_t CKPT_version = 1;
+
+		/// Magic, version, position, fingerprint, then the checksum of all of them.
+		static constexpr size_t CKPT_size = sizeof(CKPT_magic) + sizeof(uint8_t) + sizeof(uint64_t) + sizeof(uint64_t) + sizeof(uint64_t);
+
+		// Everything before pos has been written.
+		uint64_t pos = 0;
+		uint64_t fingerprint = 0;
+
+		// False if there is no checkpoint at path, or a torn or foreign one.
+		static bool Load(const std::string& path, Checkpoint& checkpoint)
+		{
+			BYTE data[CKPT_size];
+
+			FILE* file = std::fopen(path.c_str(), "rb");
+			if (file == nullptr)
+			{
+				return false;
+			}
+
+			bool bRead = (std::fread(data, 1, sizeof(data), file) == sizeof(data));
+			std::fclose(file);
+
+			if (!bRead || (std::memcmp(data, CKPT_magic, sizeof(CKPT_magic)) != 0) || (data[sizeof(CKPT_magic)] != CKPT_version))
+			{
+				return false;
+			}
+
+			size_t offset = sizeof(CKPT_magic) + sizeof(uint8_t);
+			uint64_t checksum;
+			std::memcpy(reinterpret_cast<void*>(&checkpoint.pos), reinterpret_cast<const void*>(data + offset), sizeof(uint64_t));
+			offset += sizeof(uint64_t);
+			std::memcpy(reinterpret_cast<void*>(&checkpoint.fingerprint), reinterpret_cast<const void*>(data + offset), sizeof(uint64_t));
+			offset += sizeof(uint64_t);
+			std::memcpy(reinterpret_cast<void*>(&checksum), reinterpret_cast<const void*>(data + offset), sizeof(uint64_t));
+
+			return checksum == Fnv1a(data, offset);
+		}
+
+		// Writes a file next to path first and renames it over path, so a crash leaves either checkpoint whole.
+		bool Save(const std::string& path) const
+		{
+			BYTE data[CKPT_size];
+
+			size_t offset = 0;
+			std::memcpy(reinterpret_cast<void*>(data), reinterpret_cast<const void*>(CKPT_magic), sizeof(CKPT_magic));
+			offset += sizeof(CKPT_magic);
+			data[offset] = CKPT_version;
+			offset += sizeof(uint8_t);
+			std::memcpy(reinterpret_cast<void*>(data + offset), reinterpret_cast<const void*>(&pos), sizeof(uint64_t));
+			offset += sizeof(uint64_t);
+			std::memcpy(reinterpret_cast<void*>(data + offset), reinterpret_cast<const void*>(&fingerprint), sizeof(uint64_t));
+			offset += sizeof(uint64_t);
+
+			uint64_t checksum = Fnv1a(data, offset);
+			std::memcpy(reinterpret_cast<void*>(data + offset), reinterpret_cast<const void*>(&checksum), sizeof(uint64_t));
+
+			const std::string tmpPath = path + ".tmp";
+
+			FILE* file = std::fopen(tmpPath.c_str(), "wb");
+			if (file == nullptr)
+			{
+				return false;
+			}
+
+			bool bWritten = (std::fwrite(data, 1, sizeof(data), file) == sizeof(data));
+			bWritten = (std::fclose(file) == 0) && bWritten;
+
+			std::error_code err;
+			if (bWritten)
+			{
+				std::filesystem::rename(tmpPath, path, err);
+			}
+
+			if (!bWritten || err)
+			{
+				std::filesystem::remove(tmpPath, err);
+				return false;
+			}
+
+			return true;
+		}
+
+		static void Remove(const std::string& path)
+		{
+			std::error_code err;
+			std::filesystem::remove(path, err);
+		}
+	};
+}
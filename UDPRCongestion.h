@@ -0,0 +1,380 @@
+#pragma once
+
+/// STD
+#include <cstdint>
+#include <chrono>
+#include <cmath>
+#include <algorithm>
+
+/// CUSTOM
+#include "UDPRDebugHeaders.h"
+#include "UDPRMisc.h"
+
+namespace UDPR
+{
+	// Round trip estimation after RFC 6298. The retransmission timeout starts out at whatever timeout the user gave,
+	// follows the smoothed round trip and its variance once samples come in, and doubles on every expiry until the
+	// next sample or a reset. Samples of anything that has been retransmitted must not be taken (Karn's algorithm).
+	class RttEstimator
+	{
+	public:
+		using Clock = std::chrono::steady_clock;
+
+		/// Bounds of the retransmission timeout, the floor is far below TCP's since the protocol is meant for LANs as well.
+		static constexpr Clock::duration RTO_min = std::chrono::milliseconds(10);
+		static constexpr Clock::duration RTO_max = std::chrono::seconds(10);
+
+		/// Clock granularity the variance term never drops below.
+		static constexpr Clock::duration RTO_granularity = std::chrono::milliseconds(1);
+
+	public:
+		explicit RttEstimator(Clock::duration initialRto = std::chrono::seconds(1)) :
+			rto(Clamp(initialRto)),
+			baseRto(rto)
+		{
+		}
+
+		void AddSample(Clock::duration rtt)
+		{
+			if (rtt <= Clock::duration::zero())
+			{
+				return;
+			}
+
+			if (srtt == Clock::duration::zero())
+			{
+				srtt = rtt;
+				rttvar = rtt / 2;
+			}
+			else
+			{
+				Clock::duration delta = (srtt > rtt) ? (srtt - rtt) : (rtt - srtt);
+				rttvar = (rttvar * 3 + delta) / 4;
+				srtt = (srtt * 7 + rtt) / 8;
+			}
+
+			rto = Clamp(srtt + (std::max)(RTO_granularity, rttvar * 4));
+			baseRto = rto;
+		}
+
+		// The timeout expired, waiting twice as long for the next one.
+		void Backoff()
+		{
+			rto = Clamp(rto * 2);
+		}
+
+		// Something got through that can't be timed, the timeout goes back to what the samples say.
+		void ResetBackoff()
+		{
+			rto = baseRto;
+		}
+
+		FORCEINLINE Clock::duration GetRto() const { return rto; }
+
+		FORCEINLINE Clock::duration GetSmoothedRtt() const { return srtt; }
+
+		FORCEINLINE Clock::duration GetRttVariance() const { return rttvar; }
+
+		FORCEINLINE bool HasSample() const { return srtt != Clock::duration::zero(); }
+
+	private:
+		static Clock::duration Clamp(Clock::duration value)
+		{
+			return (std::min)((std::max)(value, RTO_min), RTO_max);
+		}
+
+	private:
+		Clock::duration srtt = Clock::duration::zero();
+		Clock::duration rttvar = Clock::duration::zero();
+		Clock::duration rto;
+
+		// The timeout before any backoff.
+		Clock::duration baseRto;
+	};
+
+	/// Built-in congestion controllers a StreamSender can be told to use.
+	enum class CongestionControl : uint8_t
+	{
+		none	= 0, // Only the receiver's window limits the sender.
+		cubic	= 1, // Loss-based, grows along a cubic curve around the last window that saw a loss.
+		delay	= 2  // Delay-based, backs off as soon as the round trip grows past the path's minimum.
+	};
+
+	// Decides how many packets may be in flight and how fast they go out. Fed by the sender with what the
+	// receiver's reports say, a controller only counts packets and never touches the network itself.
+	class CongestionController
+	{
+	public:
+		using Clock = std::chrono::steady_clock;
+
+		/// Packets in flight before anything has been acknowledged, and the least the window ever shrinks to.
+		static constexpr double CC_initialWindow = 10.0;
+		static constexpr double CC_minWindow = 2.0;
+
+	public:
+		virtual ~CongestionController() = default;
+
+		// acked packets reached the receiver, rtt is zero if none of them can be timed.
+		void OnAcked(uint32_t acked, Clock::duration rtt, Clock::time_point now)
+		{
+			if (rtt > Clock::duration::zero())
+			{
+				UpdateRtt(rtt);
+			}
+
+			if (acked > 0)
+			{
+				Grow(acked, rtt, now);
+			}
+		}
+
+		// Packets went missing, at most one reaction per round trip.
+		void OnLost(Clock::time_point now)
+		{
+			if (now < recoveryUntil)
+			{
+				return;
+			}
+
+			recoveryUntil = now + ((srtt > Clock::duration::zero()) ? srtt : Clock::duration::zero());
+			Shrink(now);
+		}
+
+		FORCEINLINE uint32_t GetWindow() const
+		{
+			return static_cast<uint32_t>((std::max)(window, CC_minWindow));
+		}
+
+		// Bytes per second the pacer should let out, 0 until a round trip has been measured.
+		double GetPacingRate(uint16_t packetSz) const
+		{
+			if (srtt <= Clock::duration::zero())
+			{
+				return 0.0;
+			}
+
+			// Pacing a little faster than the window drains keeps the pipe full, slow start needs more headroom.
+			double gain = IsSlowStart() ? 2.0 : 1.25;
+			return gain * GetWindow() * packetSz / std::chrono::duration<double>(srtt).count();
+		}
+
+		FORCEINLINE Clock::duration GetSmoothedRtt() const { return srtt; }
+
+		FORCEINLINE Clock::duration GetMinRtt() const { return minRtt; }
+
+		FORCEINLINE bool IsSlowStart() const { return window < ssthresh; }
+
+	protected:
+		virtual void Grow(uint32_t acked, Clock::duration rtt, Clock::time_point now) = 0;
+		virtual void Shrink(Clock::time_point now) = 0;
+
+	private:
+		void UpdateRtt(Clock::duration rtt)
+		{
+			minRtt = (minRtt <= Clock::duration::zero()) ? rtt : (std::min)(minRtt, rtt);
+			srtt = (srtt <= Clock::duration::zero()) ? rtt : (srtt * 7 + rtt) / 8;
+		}
+
+	protected:
+		double window = CC_initialWindow;
+		double ssthresh = 1e9;
+
+		Clock::duration srtt = Clock::duration::zero();
+		Clock::duration minRtt = Clock::duration::zero();
+
+	private:
+		Clock::time_point recoveryUntil;
+	};
+
+	// Loss-based, along the lines of CUBIC (RFC 8312): after a loss the window is cut to 70% and grows back
+	// quickly up to where the loss happened, carefully around it and quickly again past it.
+	class CubicController : public CongestionController
+	{
+	public:
+		static constexpr double CUBIC_beta = 0.7;
+		static constexpr double CUBIC_c = 0.4;
+
+	protected:
+		void Grow(uint32_t acked, Clock::duration rtt, Clock::time_point now) override
+		{
+			if (IsSlowStart())
+			{
+				window += acked;
+				return;
+			}
+
+			if (epochStart == Clock::time_point())
+			{
+				epochStart = now;
+				wMax = (std::max)(wMax, window);
+				k = std::cbrt(wMax * (1.0 - CUBIC_beta) / CUBIC_c);
+				wEst = window;
+			}
+
+			// Where the curve will be one round trip from now.
+			double t = std::chrono::duration<double>(now - epochStart + ((srtt > Clock::duration::zero()) ? srtt : rtt)).count();
+			double target = CUBIC_c * (t - k) * (t - k) * (t - k) + wMax;
+
+			// Never slower than plain AIMD would be.
+			wEst += 3.0 * (1.0 - CUBIC_beta) / (1.0 + CUBIC_beta) * acked / window;
+			target = (std::max)(target, wEst);
+
+			if (target > window)
+			{
+				window += (target - window) * acked / window;
+			}
+			else
+			{
+				window += 0.01 * acked / window;
+			}
+		}
+
+		void Shrink(Clock::time_point) override
+		{
+			wMax = window;
+			window = (std::max)(window * CUBIC_beta, CC_minWindow);
+			ssthresh = window;
+			epochStart = Clock::time_point();
+		}
+
+	private:
+		Clock::time_point epochStart;
+		double wMax = 0.0;
+		double wEst = 0.0;
+		double k = 0.0;
+	};
+
+	// Delay-based, along the lines of TCP Vegas: the gap between the measured and the minimum round trip tells
+	// how many packets sit in queues along the path, and the window is steered to keep only a few there.
+	class DelayController : public CongestionController
+	{
+	public:
+		/// Packets queued along the path the window aims to stay between.
+		static constexpr double DELAY_alpha = 2.0;
+		static constexpr double DELAY_beta = 4.0;
+
+	protected:
+		void Grow(uint32_t acked, Clock::duration rtt, Clock::time_point) override
+		{
+			if ((rtt <= Clock::duration::zero()) || (minRtt <= Clock::duration::zero()))
+			{
+				return;
+			}
+
+			double queued = window * (1.0 - std::chrono::duration<double>(minRtt).count() / std::chrono::duration<double>(rtt).count());
+
+			if (IsSlowStart())
+			{
+				if (queued > DELAY_alpha)
+				{
+					ssthresh = window;
+				}
+				else
+				{
+					window += acked;
+				}
+
+				return;
+			}
+
+			// One packet per round trip either way.
+			if (queued < DELAY_alpha)
+			{
+				window += static_cast<double>(acked) / window;
+			}
+			else if (queued > DELAY_beta)
+			{
+				window = (std::max)(window - static_cast<double>(acked) / window, CC_minWindow);
+			}
+		}
+
+		void Shrink(Clock::time_point) override
+		{
+			window = (std::max)(window / 2.0, CC_minWindow);
+			ssthresh = window;
+		}
+	};
+
+	// Spaces datagrams out at the controller's rate, a token bucket which allows a short burst.
+	class Pacer
+	{
+	public:
+		using Clock = std::chrono::steady_clock;
+
+		/// The burst allowed is whichever is larger, this many packets or a millisecond worth of them.
+		static constexpr int PACE_burstPackets = 10;
+
+	public:
+		// A rate of 0 turns pacing off.
+		void SetRate(double _rate, uint16_t packetSz)
+		{
+			rate = _rate;
+			burst = (std::max)(static_cast<double>(PACE_burstPackets) * packetSz, rate / 1000.0);
+		}
+
+		// Takes the tokens for bytes if they are there.
+		bool TryConsume(int bytes, Clock::time_point now)
+		{
+			if (rate <= 0.0)
+			{
+				return true;
+			}
+
+			Refill(now);
+
+			if (tokens < bytes)
+			{
+				return false;
+			}
+
+			tokens -= bytes;
+			return true;
+		}
+
+		// Takes the tokens for bytes that go out regardless, running into debt if there aren't enough.
+		void Charge(int bytes, Clock::time_point now)
+		{
+			if (rate <= 0.0)
+			{
+				return;
+			}
+
+			Refill(now);
+			tokens -= bytes;
+		}
+
+		// When TryConsume will succeed for bytes.
+		Clock::time_point GetReadyAt(int bytes) const
+		{
+			if ((rate <= 0.0) || (tokens >= bytes))
+			{
+				return lastRefill;
+			}
+
+			return lastRefill + std::chrono::duration_cast<Clock::duration>(std::chrono::duration<double>((bytes - tokens) / rate));
+		}
+
+		FORCEINLINE double GetRate() const { return rate; }
+
+	private:
+		void Refill(Clock::time_point now)
+		{
+			if (lastRefill == Clock::time_point())
+			{
+				tokens = burst;
+			}
+			else if (now > lastRefill)
+			{
+				tokens = (std::min)(tokens + rate * std::chrono::duration<double>(now - lastRefill).count(), burst);
+			}
+
+			lastRefill = now;
+		}
+
+	private:
+		double rate = 0.0;
+		double burst = 0.0;
+		double tokens = 0.0;
+		Clock::time_point lastRefill;
+	};
+}
@@ -0,0 +1,73 @@
+#pragma once
+
+namespace UDPR
+{
+	template<class TTransfer>
+	class FinishedAwaitable;
+}
+
+#if defined(__cpp_impl_coroutine) && (__cpp_impl_coroutine >= 201902L) && __has_include(<coroutine>)
+#define UDPR_COROUTINES 1
+
+/// STD
+#include <coroutine>
+#include <thread>
+
+/// CUSTOM
+#include "UDPRDebugHeaders.h"
+#include "UDPRMisc.h"
+#include "UDPRReactor.h"
+
+namespace UDPR
+{
+	// What co_await on a StreamSender's Serve or a StreamReceiver's Fetch waits on, the transfer finishing. Nothing is
+	// blocked meanwhile: a reactor waits on the socket for every transfer it drives, and the coroutine is resumed on
+	// one of its workers once the transfer is over, so a few workers carry as many transfers as there are coroutines.
+	// Resuming on a worker rather than where the transfer finished lets the coroutine destroy it right away. Transfers
+	// with a thread of their own have no worker to resume on, a thread is started for it instead.
+	//
+	// Comes out true if the transfer succeeded: the stream arrived in full for a receiver, nothing failed for a sender.
+	// A single awaiter at a time.
+	template<class TTransfer>
+	class FinishedAwaitable
+	{
+	public:
+		explicit FinishedAwaitable(TTransfer& _transfer) : transfer(_transfer) {  }
+
+		bool await_ready() const
+		{
+			return !transfer.IsRunning();
+		}
+
+		bool await_suspend(std::coroutine_handle<> handle)
+		{
+			Reactor* reactor = transfer.reactor;
+
+			// Finished meanwhile, the coroutine just goes on.
+			return transfer.CallOnceFinished([reactor, handle]()
+			{
+				if ((reactor == nullptr) || !reactor->Post([handle]() { handle.resume(); }))
+				{
+					std::thread([handle]() { handle.resume(); }).detach();
+				}
+			});
+		}
+
+		bool await_resume() const
+		{
+			if constexpr (requires { transfer.IsComplete(); })
+			{
+				return transfer.IsComplete() && !transfer.ErrorOccured();
+			}
+			else
+			{
+				return !transfer.ErrorOccured();
+			}
+		}
+
+	private:
+		TTransfer& transfer;
+	};
+}
+
+#endif
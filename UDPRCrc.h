@@ -0,0 +1,191 @@
+#pragma once
+
+/// STD
+#include <cstdint>
+#include <cstring>
+
+#if defined(__x86_64__) || defined(_M_X64)
+#define UDPR_CRC_SSE42
+#ifdef _MSC_VER
+#include <intrin.h>
+#else
+#include <nmmintrin.h>
+#endif
+#elif defined(__aarch64__) && defined(__ARM_FEATURE_CRC32)
+#define UDPR_CRC_ARM
+#include <arm_acle.h>
+#endif
+
+/// CUSTOM
+#include "UDPRDebugHeaders.h"
+#include "UDPRMisc.h"
+
+namespace UDPR
+{
+	// CRC-32C (Castagnoli), the checksum of iSCSI and SCTP. Computed with the CRC32 instructions of SSE 4.2 where the CPU
+	// has them, checked at runtime, or those of ARMv8 where the compiler targets them, and 8 bytes at a time from
+	// tables everywhere else. Results chain, passing the CRC of a to Compute for b gives the CRC of a followed by b.
+	class Crc32c
+	{
+	public:
+		/// The reflected polynomial.
+		static constexpr uint32_t CRC_polynomial = 0x82F63B78;
+
+	public:
+		static uint32_t Compute(const void* data, size_t len, uint32_t crc = 0)
+		{
+			const BYTE* bytes = static_cast<const BYTE*>(data);
+
+#if defined(UDPR_CRC_SSE42)
+			static const bool bHardware = HasSse42();
+			if (bHardware)
+			{
+				return ~ComputeSse42(bytes, len, ~crc);
+			}
+#elif defined(UDPR_CRC_ARM)
+			return ~ComputeArm(bytes, len, ~crc);
+#endif
+
+			return ~ComputeTables(bytes, len, ~crc);
+		}
+
+		// Whether Compute runs on CRC instructions rather than tables.
+		static bool IsAccelerated()
+		{
+#if defined(UDPR_CRC_SSE42)
+			static const bool bHardware = HasSse42();
+			return bHardware;
+#elif defined(UDPR_CRC_ARM)
+			return true;
+#else
+			return false;
+#endif
+		}
+
+	private:
+#if defined(UDPR_CRC_SSE42)
+		static bool HasSse42()
+		{
+#ifdef _MSC_VER
+			int info[4];
+			__cpuid(info, 1);
+			return (info[2] & (1 << 20)) != 0;
+#else
+			__builtin_cpu_init();
+			return __builtin_cpu_supports("sse4.2");
+#endif
+		}
+
+#ifndef _MSC_VER
+		__attribute__((target("sse4.2")))
+#endif
+		static uint32_t ComputeSse42(const BYTE* bytes, size_t len, uint32_t crc)
+		{
+			uint64_t crc64 = crc;
+			for (; len >= sizeof(uint64_t); bytes += sizeof(uint64_t), len -= sizeof(uint64_t))
+			{
+				uint64_t word;
+				std::memcpy(&word, bytes, sizeof(word));
+				crc64 = _mm_crc32_u64(crc64, word);
+			}
+
+			crc = static_cast<uint32_t>(crc64);
+			for (; len > 0; ++bytes, --len)
+			{
+				crc = _mm_crc32_u8(crc, *bytes);
+			}
+
+			return crc;
+		}
+#elif defined(UDPR_CRC_ARM)
+		static uint32_t ComputeArm(const BYTE* bytes, size_t len, uint32_t crc)
+		{
+			for (; len >= sizeof(uint64_t); bytes += sizeof(uint64_t), len -= sizeof(uint64_t))
+			{
+				uint64_t word;
+				std::memcpy(&word, bytes, sizeof(word));
+				crc = __crc32cd(crc, word);
+			}
+
+			for (; len > 0; ++bytes, --len)
+			{
+				crc = __crc32cb(crc, *bytes);
+			}
+
+			return crc;
+		}
+#endif
+
+		// Slicing by 8, table k advances a byte's CRC past k more zero bytes.
+		static uint32_t ComputeTables(const BYTE* bytes, size_t len, uint32_t crc)
+		{
+			const Tables& tables = GetTables();
+
+			for (; len >= sizeof(uint64_t); bytes += sizeof(uint64_t), len -= sizeof(uint64_t))
+			{
+				uint32_t low, high;
+				std::memcpy(&low, bytes, sizeof(low));
+				std::memcpy(&high, bytes + sizeof(low), sizeof(high));
+
+				// The tables are for little-endian words.
+				low = FromLittleEndian(low) ^ crc;
+				high = FromLittleEndian(high);
+
+				crc = tables.t[7][low & 0xFF] ^ tables.t[6][(low >> 8) & 0xFF] ^ tables.t[5][(low >> 16) & 0xFF] ^ tables.t[4][low >> 24] ^
+					  tables.t[3][high & 0xFF] ^ tables.t[2][(high >> 8) & 0xFF] ^ tables.t[1][(high >> 16) & 0xFF] ^ tables.t[0][high >> 24];
+			}
+
+			for (; len > 0; ++bytes, --len)
+			{
+				crc = tables.t[0][(crc ^ *bytes) & 0xFF] ^ (crc >> 8);
+			}
+
+			return crc;
+		}
+
+		static FORCEINLINE uint32_t FromLittleEndian(uint32_t value)
+		{
+#if defined(__BYTE_ORDER__) && (__BYTE_ORDER__ == __ORDER_BIG_ENDIAN__)
+			return __builtin_bswap32(value);
+#else
+			return value;
+#endif
+		}
+
+		struct Tables
+		{
+			uint32_t t[8][256];
+		};
+
+		static const Tables& GetTables()
+		{
+			static const Tables tables = []()
+			{
+				Tables t {  };
+
+				for (uint32_t i = 0; i < 256; ++i)
+				{
+					uint32_t crc = i;
+					for (int bit = 0; bit < 8; ++bit)
+					{
+						crc = (crc & 1) ? ((crc >> 1) ^ CRC_polynomial) : (crc >> 1);
+					}
+
+					t.t[0][i] = crc;
+				}
+
+				for (int k = 1; k < 8; ++k)
+				{
+					for (uint32_t i = 0; i < 256; ++i)
+					{
+						t.t[k][i] = t.t[0][t.t[k - 1][i] & 0xFF] ^ (t.t[k - 1][i] >> 8);
+					}
+				}
+
+				return t;
+			}();
+
+			return tables;
+		}
+	};
+}
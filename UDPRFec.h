@@ -0,0 +1,219 @@
+#pragma once
+
+/// STD
+#include <cstdint>
+#include <cstring>
+#include <vector>
+#include <utility>
+
+/// CUSTOM
+#include "UDPRDebugHeaders.h"
+#include "UDPRMisc.h"
+
+namespace UDPR
+{
+	// Erasure code for groups of up to FEC_maxGroupSz packets with up to FEC_maxRepair repair packets each. Repair j
+	// is the sum over GF(2^8) of every packet i times a coefficient taken from a Cauchy matrix whose columns are
+	// scaled so that its first row is all ones. Repair 0 is then plain XOR parity, and any e repairs rebuild any e
+	// missing packets. Packets shorter than the symbol size count as padded with zeros.
+	class FecCodec
+	{
+	public:
+		/// Packets a group may have, and repairs a group may get. Rows and columns of the matrix must not overlap.
+		static constexpr int FEC_maxGroupSz = 64;
+		static constexpr int FEC_maxRepair = 16;
+
+	public:
+		// The coefficient packet index has in repair index.
+		static BYTE Coefficient(int repair, int index)
+		{
+			if (repair == 0)
+			{
+				return 1;
+			}
+
+			// Rows at 128 and up, columns below, so x - y is never zero. Subtraction is XOR in GF(2^8).
+			const BYTE y = static_cast<BYTE>(index);
+			return Divide(static_cast<BYTE>(128 ^ y), static_cast<BYTE>((128 + repair) ^ y));
+		}
+
+		// dst += coefficient * src, len bytes.
+		static void MultiplyAdd(BYTE* dst, const BYTE* src, size_t len, BYTE coefficient)
+		{
+			if (coefficient == 0)
+			{
+				return;
+			}
+
+			if (coefficient == 1)
+			{
+				for (size_t i = 0; i < len; ++i)
+				{
+					dst[i] ^= src[i];
+				}
+
+				return;
+			}
+
+			const Tables& tables = GetTables();
+			const int logCoefficient = tables.log[coefficient];
+			for (size_t i = 0; i < len; ++i)
+			{
+				if (src[i] != 0)
+				{
+					dst[i] ^= tables.exp[tables.log[src[i]] + logCoefficient];
+				}
+			}
+		}
+
+		// Rebuilds the missing packets of a group in place. symbols[i] points at packet i, padded to symbolSz, and
+		// the ones in missing are overwritten. repairs holds at least as many repairs as there are missing packets,
+		// repairIndices tells which one each is. Returns false if the repairs don't determine the missing packets.
+		static bool Recover(BYTE* const* symbols, int count, const std::vector<int>& missing,
+							const BYTE* const* repairs, const std::vector<int>& repairIndices, size_t symbolSz)
+		{
+			const int e = static_cast<int>(missing.size());
+			if ((e == 0) || (static_cast<int>(repairIndices.size()) < e))
+			{
+				return e == 0;
+			}
+
+			// What the missing packets add up to in every repair, once everything that arrived is taken out.
+			std::vector<std::vector<BYTE>> sums(e, std::vector<BYTE>(symbolSz));
+			std::vector<bool> bMissing(count, false);
+			for (int index : missing)
+			{
+				bMissing[index] = true;
+			}
+
+			for (int k = 0; k < e; ++k)
+			{
+				std::memcpy(sums[k].data(), repairs[k], symbolSz);
+				for (int i = 0; i < count; ++i)
+				{
+					if (!bMissing[i])
+					{
+						MultiplyAdd(sums[k].data(), symbols[i], symbolSz, Coefficient(repairIndices[k], i));
+					}
+				}
+			}
+
+			// Inverting the coefficients of the missing packets, Gauss-Jordan on [A | I].
+			std::vector<std::vector<BYTE>> a(e, std::vector<BYTE>(2 * e, 0));
+			for (int k = 0; k < e; ++k)
+			{
+				for (int l = 0; l < e; ++l)
+				{
+					a[k][l] = Coefficient(repairIndices[k], missing[l]);
+				}
+
+				a[k][e + k] = 1;
+			}
+
+			for (int col = 0; col < e; ++col)
+			{
+				int pivot = col;
+				while ((pivot < e) && (a[pivot][col] == 0))
+				{
+					++pivot;
+				}
+
+				if (pivot == e)
+				{
+					return false;
+				}
+
+				std::swap(a[pivot], a[col]);
+
+				const BYTE inverse = Divide(1, a[col][col]);
+				for (int l = 0; l < 2 * e; ++l)
+				{
+					a[col][l] = Multiply(a[col][l], inverse);
+				}
+
+				for (int k = 0; k < e; ++k)
+				{
+					if ((k != col) && (a[k][col] != 0))
+					{
+						const BYTE factor = a[k][col];
+						for (int l = 0; l < 2 * e; ++l)
+						{
+							a[k][l] ^= Multiply(factor, a[col][l]);
+						}
+					}
+				}
+			}
+
+			for (int l = 0; l < e; ++l)
+			{
+				BYTE* dst = symbols[missing[l]];
+				std::memset(dst, 0, symbolSz);
+
+				for (int k = 0; k < e; ++k)
+				{
+					MultiplyAdd(dst, sums[k].data(), symbolSz, a[l][e + k]);
+				}
+			}
+
+			return true;
+		}
+
+	private:
+		struct Tables
+		{
+			// Doubled, so the sum of two logarithms never has to be reduced.
+			BYTE exp[512];
+			int log[256];
+		};
+
+		static const Tables& GetTables()
+		{
+			static const Tables tables = []()
+			{
+				Tables t {  };
+
+				// The field is built on x^8 + x^4 + x^3 + x^2 + 1, with x as the generator.
+				int value = 1;
+				for (int i = 0; i < 255; ++i)
+				{
+					t.exp[i] = t.exp[i + 255] = static_cast<BYTE>(value);
+					t.log[value] = i;
+
+					value <<= 1;
+					if (value & 0x100)
+					{
+						value ^= 0x11D;
+					}
+				}
+
+				t.exp[510] = t.exp[511] = t.exp[0];
+				return t;
+			}();
+
+			return tables;
+		}
+
+		static BYTE Multiply(BYTE a, BYTE b)
+		{
+			if ((a == 0) || (b == 0))
+			{
+				return 0;
+			}
+
+			const Tables& tables = GetTables();
+			return tables.exp[tables.log[a] + tables.log[b]];
+		}
+
+		// b must not be zero.
+		static BYTE Divide(BYTE a, BYTE b)
+		{
+			if (a == 0)
+			{
+				return 0;
+			}
+
+			const Tables& tables = GetTables();
+			return tables.exp[tables.log[a] + 255 - tables.log[b]];
+		}
+	};
+}
@@ -0,0 +1,251 @@
+#pragma once
+
+/// STD
+#include <cstdint>
+#include <cstring>
+
+/// CUSTOM
+#include "UDPRDebugHeaders.h"
+#include "UDPRMisc.h"
+
+namespace UDPR
+{
+	// Fast LZ77 block codec in the spirit of LZ4, for blocks of up to 64 KiB. A block is a run of sequences, each a
+	// token byte (literal count in the high nibble, match length minus LZ_minMatch in the low one, 15 meaning more
+	// follows in bytes of 255 and a final smaller one), the literals, then a 2-byte little-endian offset back into
+	// what was decoded so far. The last sequence has literals only and ends the block.
+	class LzCodec
+	{
+	public:
+		/// Shortest match worth a sequence, and the most bytes a block may have so every offset fits 2 bytes.
+		static constexpr int LZ_minMatch = 4;
+		static constexpr size_t LZ_maxBlockSz = 65535;
+
+	private:
+		static constexpr int LZ_hashBits = 12;
+
+		/// Misses in a row before the search starts skipping ahead, incompressible data is given up on quickly.
+		static constexpr int LZ_skipTrigger = 6;
+
+	public:
+		// Compresses srcLen bytes into dst, returns the compressed size or 0 if it wouldn't fit dstCap.
+		static size_t Compress(const BYTE* src, size_t srcLen, BYTE* dst, size_t dstCap)
+		{
+			if ((srcLen == 0) || (srcLen > LZ_maxBlockSz))
+			{
+				return 0;
+			}
+
+			uint16_t table[1 << LZ_hashBits];
+			std::memset(table, 0, sizeof(table));
+
+			BYTE* op = dst;
+			BYTE* const opEnd = dst + dstCap;
+
+			size_t anchor = 0;
+			size_t ip = 1;
+			int misses = 0;
+
+			while (ip + LZ_minMatch <= srcLen)
+			{
+				const uint32_t sequence = Read32(src + ip);
+				const uint32_t hash = Hash(sequence);
+				const size_t candidate = table[hash];
+				table[hash] = static_cast<uint16_t>(ip);
+
+				if ((candidate >= ip) || (Read32(src + candidate) != sequence))
+				{
+					ip += 1 + (misses++ >> LZ_skipTrigger);
+					continue;
+				}
+
+				misses = 0;
+
+				// Extending the match both ways, backwards only into literals not yet written.
+				size_t matchStart = ip, ref = candidate;
+				while ((matchStart > anchor) && (ref > 0) && (src[matchStart - 1] == src[ref - 1]))
+				{
+					--matchStart;
+					--ref;
+				}
+
+				size_t matchEnd = ip + LZ_minMatch;
+				while ((matchEnd < srcLen) && (src[matchEnd] == src[ref + (matchEnd - matchStart)]))
+				{
+					++matchEnd;
+				}
+
+				op = WriteSequence(op, opEnd, src + anchor, matchStart - anchor, matchEnd - matchStart, matchStart - ref);
+				if (op == nullptr)
+				{
+					return 0;
+				}
+
+				// Remembering a position inside the match too, repeats right after it are common.
+				if ((matchEnd - 2 > matchStart) && (matchEnd + 2 <= srcLen))
+				{
+					table[Hash(Read32(src + matchEnd - 2))] = static_cast<uint16_t>(matchEnd - 2);
+				}
+
+				anchor = ip = matchEnd;
+			}
+
+			op = WriteSequence(op, opEnd, src + anchor, srcLen - anchor, 0, 0);
+			return (op == nullptr) ? 0 : static_cast<size_t>(op - dst);
+		}
+
+		// Decompresses srcLen bytes into dst, returns the decompressed size or -1 if the block is corrupt or larger
+		// than dstCap.
+		static int Decompress(const BYTE* src, size_t srcLen, BYTE* dst, size_t dstCap)
+		{
+			const BYTE* ip = src;
+			const BYTE* const ipEnd = src + srcLen;
+			BYTE* op = dst;
+			BYTE* const opEnd = dst + dstCap;
+
+			while (ip < ipEnd)
+			{
+				const BYTE token = *ip++;
+
+				size_t literals = token >> 4;
+				if ((literals == 15) && !ReadLength(ip, ipEnd, literals))
+				{
+					return -1;
+				}
+
+				if ((static_cast<size_t>(ipEnd - ip) < literals) || (static_cast<size_t>(opEnd - op) < literals))
+				{
+					return -1;
+				}
+
+				std::memcpy(op, ip, literals);
+				ip += literals;
+				op += literals;
+
+				// The last sequence has no match.
+				if (ip == ipEnd)
+				{
+					break;
+				}
+
+				if (ipEnd - ip < 2)
+				{
+					return -1;
+				}
+
+				const size_t offset = static_cast<size_t>(ip[0]) | (static_cast<size_t>(ip[1]) << 8);
+				ip += 2;
+
+				size_t matchLen = token & 15;
+				if ((matchLen == 15) && !ReadLength(ip, ipEnd, matchLen))
+				{
+					return -1;
+				}
+
+				matchLen += LZ_minMatch;
+
+				if ((offset == 0) || (offset > static_cast<size_t>(op - dst)) || (static_cast<size_t>(opEnd - op) < matchLen))
+				{
+					return -1;
+				}
+
+				// Matches may overlap what they produce, which repeats the last offset bytes.
+				const BYTE* ref = op - offset;
+				for (size_t i = 0; i < matchLen; ++i)
+				{
+					op[i] = ref[i];
+				}
+
+				op += matchLen;
+			}
+
+			return static_cast<int>(op - dst);
+		}
+
+	private:
+		static FORCEINLINE uint32_t Read32(const BYTE* p)
+		{
+			uint32_t value;
+			std::memcpy(&value, p, sizeof(value));
+			return value;
+		}
+
+		static FORCEINLINE uint32_t Hash(uint32_t sequence)
+		{
+			return (sequence * 2654435761U) >> (32 - LZ_hashBits);
+		}
+
+		// Writes one sequence, a match length of 0 writes the last one. Returns nullptr if it doesn't fit.
+		static BYTE* WriteSequence(BYTE* op, BYTE* const opEnd, const BYTE* literals, size_t literalCount, size_t matchLen, size_t offset)
+		{
+			const size_t matchCode = (matchLen > 0) ? (matchLen - LZ_minMatch) : 0;
+
+			// Token, both lengths at their longest, literals and offset.
+			const size_t worstCase = 1 + (literalCount / 255 + 1) + literalCount + 2 + (matchCode / 255 + 1);
+			if (static_cast<size_t>(opEnd - op) < worstCase)
+			{
+				// The last sequence needs neither an offset nor a match length.
+				if ((matchLen > 0) || (static_cast<size_t>(opEnd - op) < 1 + (literalCount / 255 + 1) + literalCount))
+				{
+					return nullptr;
+				}
+			}
+
+			BYTE* token = op++;
+			*token = static_cast<BYTE>(((literalCount >= 15) ? 15 : literalCount) << 4);
+			if (literalCount >= 15)
+			{
+				op = WriteLength(op, literalCount - 15);
+			}
+
+			std::memcpy(op, literals, literalCount);
+			op += literalCount;
+
+			if (matchLen == 0)
+			{
+				return op;
+			}
+
+			*op++ = static_cast<BYTE>(offset & 0xFF);
+			*op++ = static_cast<BYTE>(offset >> 8);
+
+			*token |= static_cast<BYTE>((matchCode >= 15) ? 15 : matchCode);
+			if (matchCode >= 15)
+			{
+				op = WriteLength(op, matchCode - 15);
+			}
+
+			return op;
+		}
+
+		static BYTE* WriteLength(BYTE* op, size_t length)
+		{
+			while (length >= 255)
+			{
+				*op++ = 255;
+				length -= 255;
+			}
+
+			*op++ = static_cast<BYTE>(length);
+			return op;
+		}
+
+		static bool ReadLength(const BYTE*& ip, const BYTE* const ipEnd, size_t& length)
+		{
+			BYTE more;
+			do
+			{
+				if (ip == ipEnd)
+				{
+					return false;
+				}
+
+				more = *ip++;
+				length += more;
+			}
+			while (more == 255);
+
+			return true;
+		}
+	};
+}
@@ -0,0 +1,253 @@
+#pragma once
+
+/// STD
+#include <cstdint>
+#include <cstring>
+#include <ios>
+#include <string>
+#include <type_traits>
+#include <utility>
+#include <algorithm>
+
+/// CUSTOM
+#include "UDPRDebugHeaders.h"
+#include "UDPRMisc.h"
+
+#ifdef _WIN32
+/// WINDOWS
+#include <Windows.h>
+#else
+/// POSIX
+#include <sys/mman.h>
+#include <sys/stat.h>
+#endif
+
+namespace UDPR
+{
+	// A read-only file mapped into memory, usable as the TStream of a StreamSender. The sender notices the
+	// mapping and sends payloads straight out of it, so they are never copied and seeks cost nothing. The
+	// stream functions only exist for everything else, they behave like the ones of a std::basic_ifstream.
+	class MappedFile
+	{
+	public:
+		explicit MappedFile(const std::string& path)
+		{
+			Open(path);
+		}
+
+		~MappedFile()
+		{
+			Close();
+		}
+
+		MappedFile(const MappedFile&) = delete;
+		MappedFile& operator=(const MappedFile&) = delete;
+
+	private:
+		void Open(const std::string& path)
+		{
+		#ifdef _WIN32
+			file = CreateFileA(path.c_str(), GENERIC_READ, FILE_SHARE_READ, nullptr, OPEN_EXISTING,
+							   FILE_ATTRIBUTE_NORMAL | FILE_FLAG_SEQUENTIAL_SCAN, nullptr);
+			if (file == INVALID_HANDLE_VALUE)
+			{
+				bFail = true;
+				return;
+			}
+
+			LARGE_INTEGER fileSz;
+			if (!GetFileSizeEx(file, &fileSz))
+			{
+				bFail = true;
+				return;
+			}
+
+			size = static_cast<uint64_t>(fileSz.QuadPart);
+
+			// Empty files can't be mapped, there is nothing to map anyway.
+			if (size == 0)
+			{
+				bOpen = true;
+				return;
+			}
+
+			if ((mapping = CreateFileMappingA(file, nullptr, PAGE_READONLY, 0, 0, nullptr)) == nullptr)
+			{
+				bFail = true;
+				return;
+			}
+
+			if ((data = static_cast<const BYTE*>(MapViewOfFile(mapping, FILE_MAP_READ, 0, 0, 0))) == nullptr)
+			{
+				bFail = true;
+				return;
+			}
+
+			bOpen = true;
+		#else
+			if ((file = open(path.c_str(), O_RDONLY)) == -1)
+			{
+				bFail = true;
+				return;
+			}
+
+			struct stat fileStat;
+			if (fstat(file, &fileStat) == -1)
+			{
+				bFail = true;
+				return;
+			}
+
+			size = static_cast<uint64_t>(fileStat.st_size);
+
+			// Empty files can't be mapped, there is nothing to map anyway.
+			if (size == 0)
+			{
+				bOpen = true;
+				return;
+			}
+
+			void* view = mmap(nullptr, static_cast<size_t>(size), PROT_READ, MAP_SHARED, file, 0);
+			if (view == MAP_FAILED)
+			{
+				bFail = true;
+				return;
+			}
+
+			data = static_cast<const BYTE*>(view);
+
+			// Transfers mostly walk the file front to back, letting the kernel read ahead aggressively.
+			madvise(view, static_cast<size_t>(size), MADV_SEQUENTIAL);
+
+			bOpen = true;
+		#endif
+		}
+
+		void Close()
+		{
+		#ifdef _WIN32
+			if (data != nullptr)
+			{
+				UnmapViewOfFile(data);
+			}
+
+			if (mapping != nullptr)
+			{
+				CloseHandle(mapping);
+			}
+
+			if (file != INVALID_HANDLE_VALUE)
+			{
+				CloseHandle(file);
+			}
+		#else
+			if (data != nullptr)
+			{
+				munmap(const_cast<BYTE*>(data), static_cast<size_t>(size));
+			}
+
+			if (file != -1)
+			{
+				close(file);
+			}
+		#endif
+
+			data = nullptr;
+			bOpen = false;
+		}
+
+	public:
+		/// Stream functions.
+
+		MappedFile& read(BYTE* dst, std::streamsize count)
+		{
+			lastCount = 0;
+			if (bFail || bEof)
+			{
+				bFail = true;
+				return *this;
+			}
+
+			uint64_t available = size - pos;
+			if (static_cast<uint64_t>(count) > available)
+			{
+				count = static_cast<std::streamsize>(available);
+				bEof = bFail = true;
+			}
+
+			if (count > 0)
+			{
+				std::memcpy(reinterpret_cast<void*>(dst), reinterpret_cast<const void*>(data + pos), static_cast<size_t>(count));
+			}
+
+			pos += static_cast<uint64_t>(count);
+			lastCount = count;
+
+			return *this;
+		}
+
+		MappedFile& seekg(uint64_t _pos)
+		{
+			if (bFail || (_pos > size))
+			{
+				bFail = true;
+				return *this;
+			}
+
+			pos = _pos;
+			bEof = false;
+
+			return *this;
+		}
+
+		FORCEINLINE uint64_t tellg() const { return bFail ? static_cast<uint64_t>(-1) : pos; }
+
+		FORCEINLINE std::streamsize gcount() const { return lastCount; }
+
+		FORCEINLINE bool eof() const { return bEof; }
+
+		FORCEINLINE bool fail() const { return bFail; }
+
+		FORCEINLINE bool good() const { return !bEof && !bFail; }
+
+		FORCEINLINE void clear() { bEof = bFail = !IsOpen(); }
+
+		FORCEINLINE bool is_open() const { return IsOpen(); }
+
+	public:
+		/// Misc (e.g. getters, setters, status functions etc.).
+
+		FORCEINLINE bool IsOpen() const { return bOpen; }
+
+		// The whole file, nullptr if it is empty or couldn't be opened.
+		FORCEINLINE const BYTE* GetData() const { return data; }
+
+		FORCEINLINE uint64_t GetSize() const { return size; }
+
+	private:
+	#ifdef _WIN32
+		HANDLE file = INVALID_HANDLE_VALUE;
+		HANDLE mapping = nullptr;
+	#else
+		int file = -1;
+	#endif
+
+		const BYTE* data = nullptr;
+		uint64_t size = 0;
+		bool bOpen = false;
+
+		// Stream state.
+		uint64_t pos = 0;
+		std::streamsize lastCount = 0;
+		bool bEof = false;
+		bool bFail = false;
+	};
+
+	/// Streams a StreamSender can send from without copying, anything exposing its whole content through GetData and GetSize.
+	template<class TStream, class = void>
+	struct IsMappedStream : std::false_type {};
+
+	template<class TStream>
+	struct IsMappedStream<TStream, std::void_t<decltype(std::declval<const TStream&>().GetData()),
+											   decltype(std::declval<const TStream&>().GetSize())>> : std::true_type {};
+}
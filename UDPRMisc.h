@@ -2,36 +2,313 @@
 
 /// STD
 #include <atomic>
+#include <cstdint>
+#include <cstring>
+#include <chrono>
 
+#ifdef _WIN32
 /// WINDOWS
 #include <WinSock2.h>
+#include <WS2tcpip.h>
+#else
+/// POSIX
+#include <sys/types.h>
+#include <sys/socket.h>
+#include <sys/uio.h>
+#include <netinet/in.h>
+#include <arpa/inet.h>
+#include <poll.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <cerrno>
+
+#ifdef __linux__
+#include <sys/eventfd.h>
+#include <netinet/udp.h>
+
+// Older headers lack the GSO option, the kernel may still have it.
+#ifndef UDP_SEGMENT
+#define UDP_SEGMENT 103
+#endif
+
+#ifndef UDP_GRO
+#define UDP_GRO 104
+#endif
+#endif
+
+#ifndef FORCEINLINE
+#define FORCEINLINE inline __attribute__((always_inline))
+#endif
+
+#ifndef ZeroMemory
+#define ZeroMemory(dst, len) std::memset((dst), 0, (len))
+#endif
+#endif
 
 namespace UDPR
 {
-	static bool RetryRecv(int errCode)
+#ifndef _WIN32
+	/// The WinSock names the rest of the library is written against.
+	typedef int SOCKET;
+	typedef unsigned char BYTE;
+	typedef sockaddr_in SOCKADDR_IN;
+
+	static const SOCKET INVALID_SOCKET = -1;
+	static const int SOCKET_ERROR = -1;
+#endif
+
+	/// Transfer modes, proposed by the receiver and echoed by the sender in the handshake.
+	enum class TransferMode : uint8_t
+	{
+		pull = 0, // Every packet is requested by the receiver.
+		push = 1  // The sender streams on its own and the receiver reports the gaps.
+	};
+
+	/// Most datagrams a single batched call will submit or drain.
+	static const int BATCH_maxDatagrams = 64;
+
+	/// Largest buffer handed to the kernel for segmentation (UDP_SEGMENT), and the most segments it may be cut into.
+	static const int GSO_maxBytes = 65507;
+	static const int GSO_maxSegments = 64;
+
+	/// Buffers a coalesced receive (UDP_GRO) drains at once, each may hold up to GSO_maxSegments datagrams.
+	static const int GRO_maxBuffers = 8;
+	static const int GRO_bufferSz = 65535;
+
+	/// A datagram of a batch, len is the capacity going into ReceiveDataBatch and the length coming out of it.
+	/// When sending, body is gathered right after data so payloads can go out without being copied first.
+	struct Datagram
+	{
+		char* data;
+		int len;
+		SOCKADDR_IN addr;
+
+		const char* body = nullptr;
+		int bodyLen = 0;
+	};
+
+	// Returns 0 on success and the error code otherwise.
+	inline int NetStartup()
+	{
+	#ifdef _WIN32
+		WSADATA wsaData;
+		ZeroMemory(&wsaData, sizeof(wsaData));
+
+		return WSAStartup(MAKEWORD(2, 2), &wsaData);
+	#else
+		return 0;
+	#endif
+	}
+
+	inline void NetCleanup()
+	{
+	#ifdef _WIN32
+		while (WSACleanup() != 0)
+		{
+			int err = WSAGetLastError();
+			if ((err == WSANOTINITIALISED) || (err == WSAENETDOWN))
+			{
+				break;
+			}
+		}
+	#endif
+	}
+
+	FORCEINLINE static int LastError()
+	{
+	#ifdef _WIN32
+		return WSAGetLastError();
+	#else
+		return errno;
+	#endif
+	}
+
+	FORCEINLINE static void CloseSocket(SOCKET sock)
+	{
+	#ifdef _WIN32
+		closesocket(sock);
+	#else
+		close(sock);
+	#endif
+	}
+
+	// Both the IP and the port have to match, receivers behind the same NAT only differ in the latter.
+	FORCEINLINE static bool SameAddress(const SOCKADDR_IN& a, const SOCKADDR_IN& b)
+	{
+		return (a.sin_addr.s_addr == b.sin_addr.s_addr) && (a.sin_port == b.sin_port);
+	}
+
+	FORCEINLINE static uint64_t AddressKey(const SOCKADDR_IN& addr)
+	{
+		return (static_cast<uint64_t>(addr.sin_addr.s_addr) << 16) | addr.sin_port;
+	}
+
+	FORCEINLINE static std::chrono::steady_clock::duration ToDuration(const timeval& time)
+	{
+		return std::chrono::seconds(time.tv_sec) + std::chrono::microseconds(time.tv_usec);
+	}
+
+	// How long to wait for the deadline, never longer than limit so the caller gets to check on its flags.
+	inline timeval TimeUntil(std::chrono::steady_clock::time_point deadline, const timeval& limit)
+	{
+		auto wait = std::chrono::duration_cast<std::chrono::microseconds>(ToDuration(limit));
+		auto now = std::chrono::steady_clock::now();
+
+		if (deadline <= now)
+		{
+			wait = std::chrono::microseconds(0);
+		}
+		else if (deadline - now < wait)
+		{
+			wait = std::chrono::ceil<std::chrono::microseconds>(deadline - now);
+		}
+
+		return { static_cast<decltype(timeval::tv_sec)>(wait.count() / 1000000),
+				 static_cast<decltype(timeval::tv_usec)>(wait.count() % 1000000) };
+	}
+
+	inline bool SetNonBlocking(SOCKET sock)
+	{
+	#ifdef _WIN32
+		u_long nonBlocking = 1;
+		return ioctlsocket(sock, FIONBIO, &nonBlocking) != SOCKET_ERROR;
+	#else
+		int flags = fcntl(sock, F_GETFL, 0);
+		return (flags != SOCKET_ERROR) && (fcntl(sock, F_SETFL, flags | O_NONBLOCK) != SOCKET_ERROR);
+	#endif
+	}
+
+	/// Lets another thread interrupt a wait, its handle goes into the same wait set as the sockets.
+	class Waker
+	{
+	public:
+		Waker() :
+			handle(INVALID_SOCKET),
+			selfAddr {  }
+		{
+		}
+
+		~Waker()
+		{
+			Close();
+		}
+
+		Waker(const Waker&) = delete;
+		Waker& operator=(const Waker&) = delete;
+
+		// Returns false on failure, the socket library has to be started by then.
+		bool Open()
+		{
+		#ifdef __linux__
+			handle = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+			return handle != INVALID_SOCKET;
+		#else
+			// A loopback socket that talks to itself.
+			if ((handle = socket(AF_INET, SOCK_DGRAM, IPPROTO_UDP)) == INVALID_SOCKET)
+			{
+				return false;
+			}
+
+			selfAddr.sin_family		 = AF_INET;
+			selfAddr.sin_port		 = 0;
+			selfAddr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+
+		#ifdef _WIN32
+			int addrLen = sizeof(selfAddr);
+		#else
+			socklen_t addrLen = sizeof(selfAddr);
+		#endif
+
+			if ((bind(handle, reinterpret_cast<const sockaddr*>(&selfAddr), sizeof(selfAddr)) == SOCKET_ERROR) ||
+				(getsockname(handle, reinterpret_cast<sockaddr*>(&selfAddr), &addrLen) == SOCKET_ERROR) ||
+				!SetNonBlocking(handle))
+			{
+				Close();
+				return false;
+			}
+
+			return true;
+		#endif
+		}
+
+		void Close()
+		{
+			if (handle != INVALID_SOCKET)
+			{
+				CloseSocket(handle);
+				handle = INVALID_SOCKET;
+			}
+		}
+
+		void Wake()
+		{
+		#ifdef __linux__
+			eventfd_write(handle, 1);
+		#else
+			char signal = 0;
+			sendto(handle, &signal, sizeof(signal), 0, reinterpret_cast<const sockaddr*>(&selfAddr), sizeof(selfAddr));
+		#endif
+		}
+
+		// Resets the handle to not readable.
+		void Drain()
+		{
+		#ifdef __linux__
+			eventfd_t value;
+			eventfd_read(handle, &value);
+		#else
+			char signal[64];
+			while (recv(handle, signal, sizeof(signal), 0) > 0);
+		#endif
+		}
+
+		FORCEINLINE SOCKET GetHandle() const { return handle; }
+
+	private:
+		SOCKET handle;
+		SOCKADDR_IN selfAddr;
+	};
+
+	inline bool RetryRecv(int errCode)
 	{
 		switch (errCode)
 		{
+	#ifdef _WIN32
 		case WSAENETRESET:
 		case WSAENETDOWN:
+	#else
+		case ENETRESET:
+		case ENETDOWN:
+		case EINTR:
+	#endif
 			return true;
 		default:
 			return false;
 		}
-		
+
 		return false;
 	}
 
-	static bool RetrySendTo(int errCode)
+	inline bool RetrySendTo(int errCode)
 	{
 		switch (errCode)
 		{
+	#ifdef _WIN32
 		case WSAENETDOWN:
 		case WSAENETRESET:
 		case WSAENOBUFS:
 		case WSAEHOSTUNREACH:
 		case WSAENETUNREACH:
 		case WSAETIMEDOUT:
+	#else
+		case ENETDOWN:
+		case ENETRESET:
+		case ENOBUFS:
+		case EHOSTUNREACH:
+		case ENETUNREACH:
+		case ETIMEDOUT:
+		case EINTR:
+	#endif
 			return true;
 		default:
 			return false;
@@ -40,9 +317,20 @@ namespace UDPR
 		return false;
 	}
 
+	// The send buffer of a non-blocking socket is full, which is waited out (see WaitForRoom) rather than retried at once.
+	inline bool SendWouldBlock(int errCode)
+	{
+	#ifdef _WIN32
+		return errCode == WSAEWOULDBLOCK;
+	#else
+		return (errCode == EAGAIN) || (errCode == EWOULDBLOCK);
+	#endif
+	}
+
 	template<class T>
 	static bool DataAvailable(SOCKET sock, const timeval& timeout, T* owner)
 	{
+	#ifdef _WIN32
 		fd_set fd;
 		ZeroMemory(&fd, sizeof(fd));
 
@@ -50,16 +338,71 @@ namespace UDPR
 		fd.fd_array[0] = sock;
 
 		int res = select(NULL, &fd, nullptr, nullptr, &timeout);
+	#else
+		// poll has no FD_SETSIZE limit, rounding the timeout up so short waits don't turn into spins.
+		pollfd fd { sock, POLLIN, 0 };
+		int waitMs = static_cast<int>(timeout.tv_sec * 1000 + (timeout.tv_usec + 999) / 1000);
+
+		int res;
+		while (((res = poll(&fd, 1, waitMs)) == SOCKET_ERROR) && (errno == EINTR));
+	#endif
 
 		if (res == SOCKET_ERROR)
 		{
-			owner->InitEx("Failed the select.", WSAGetLastError());
+			owner->InitEx("Failed the select.", LastError());
 			return false;
 		}
 
 		return res != 0;
 	}
 
+	// Waits on the waker along with the socket, returning early without data once it is woken. A waker that isn't
+	// open leaves only the socket to wait on.
+	template<class T>
+	static bool DataAvailable(SOCKET sock, Waker& waker, const timeval& timeout, T* owner)
+	{
+		if (waker.GetHandle() == INVALID_SOCKET)
+		{
+			return DataAvailable(sock, timeout, owner);
+		}
+
+	#ifdef _WIN32
+		fd_set fd;
+		ZeroMemory(&fd, sizeof(fd));
+
+		fd.fd_count    = 2;
+		fd.fd_array[0] = sock;
+		fd.fd_array[1] = waker.GetHandle();
+
+		int res = select(NULL, &fd, nullptr, nullptr, &timeout);
+
+		bool bReadable = (res != SOCKET_ERROR) && FD_ISSET(sock, &fd);
+		bool bWoken = (res != SOCKET_ERROR) && FD_ISSET(waker.GetHandle(), &fd);
+	#else
+		pollfd fds[2] = { { sock, POLLIN, 0 }, { waker.GetHandle(), POLLIN, 0 } };
+		int waitMs = static_cast<int>(timeout.tv_sec * 1000 + (timeout.tv_usec + 999) / 1000);
+
+		int res;
+		while (((res = poll(fds, 2, waitMs)) == SOCKET_ERROR) && (errno == EINTR));
+
+		bool bReadable = (res > 0) && (fds[0].revents != 0);
+		bool bWoken = (res > 0) && (fds[1].revents != 0);
+	#endif
+
+		if (res == SOCKET_ERROR)
+		{
+			owner->InitEx("Failed the select.", LastError());
+			return false;
+		}
+
+		if (bWoken)
+		{
+			waker.Drain();
+		}
+
+		return bReadable;
+	}
+
 	template<class T>
 	static bool WaitForData(SOCKET sock, const timeval& timeout, T* owner,
 							const std::atomic_bool& bShouldStop, const std::atomic_bool& bExInit)
@@ -75,6 +418,46 @@ namespace UDPR
 		return true;
 	}
 
+	// Waits until the socket's send buffer has room again, a slice at a time so stopping isn't held up. Returns false
+	// once stopping, or if the wait failed.
+	template<class T>
+	static bool WaitForRoom(SOCKET sock, T* owner, const std::atomic_bool& bShouldStop)
+	{
+		static constexpr int SEND_waitSliceMs = 10;
+
+		while (!bShouldStop)
+		{
+		#ifdef _WIN32
+			fd_set fd;
+			ZeroMemory(&fd, sizeof(fd));
+
+			fd.fd_count    = 1;
+			fd.fd_array[0] = sock;
+
+			const timeval slice = { 0, SEND_waitSliceMs * 1000 };
+			int res = select(NULL, nullptr, &fd, nullptr, &slice);
+		#else
+			pollfd fd { sock, POLLOUT, 0 };
+
+			int res;
+			while (((res = poll(&fd, 1, SEND_waitSliceMs)) == SOCKET_ERROR) && (errno == EINTR));
+		#endif
+
+			if (res == SOCKET_ERROR)
+			{
+				owner->InitEx("Failed the select.", LastError());
+				return false;
+			}
+
+			if (res != 0)
+			{
+				return true;
+			}
+		}
+
+		return false;
+	}
+
 	template<class T>
 	static bool ReceiveData(SOCKET sock, const timeval& timeout, T* owner,
 							const std::atomic_bool& bShouldStop, const std::atomic_bool& bExInit,
@@ -89,9 +472,17 @@ namespace UDPR
 		if (bShouldStop) { return false; }
 
 		int res;
-		if ((res = recvfrom(sock, data, len, flags, from, fromlen)) == SOCKET_ERROR)
+	#ifdef _WIN32
+		res = recvfrom(sock, data, len, flags, from, fromlen);
+	#else
+		socklen_t auxLen = static_cast<socklen_t>(*fromlen);
+		res = static_cast<int>(recvfrom(sock, data, len, flags, from, &auxLen));
+		(*fromlen) = static_cast<int>(auxLen);
+	#endif
+
+		if (res == SOCKET_ERROR)
 		{
-			int err = WSAGetLastError();
+			int err = LastError();
 			if (RetryRecv(err))
 			{
 				goto BEGIN;
@@ -113,7 +504,7 @@ namespace UDPR
 
 	template<class T>
 	static bool SendData(SOCKET sock, T* owner,
-						 const std::atomic_bool& bShouldStop, const char* data, int len, 
+						 const std::atomic_bool& bShouldStop, const char* data, int len,
 						 int flags, const sockaddr* to, int tolen)
 	{
 	BEGIN:
@@ -121,8 +512,14 @@ namespace UDPR
 
 		if (sendto(sock, data, len, flags, to, tolen) == SOCKET_ERROR)
 		{
-			int err = WSAGetLastError();
-			if (RetrySendTo(err))
+			int err = LastError();
+			if (SendWouldBlock(err))
+			{
+				if (!WaitForRoom(sock, owner, bShouldStop)) { return false; }
+
+				goto BEGIN;
+			}
+			else if (RetrySendTo(err))
 			{
 				goto BEGIN;
 			}
@@ -135,4 +532,473 @@ namespace UDPR
 
 		return true;
 	}
+
+	// Sends a single datagram made of its data followed by its body.
+	template<class T>
+	static bool SendDataGather(SOCKET sock, T* owner,
+							   const std::atomic_bool& bShouldStop, const Datagram& datagram, int flags)
+	{
+	BEGIN:
+		if (bShouldStop) { return false; }
+
+		int res;
+	#ifdef _WIN32
+		WSABUF bufs[2];
+		bufs[0].buf = datagram.data;
+		bufs[0].len = static_cast<ULONG>(datagram.len);
+		bufs[1].buf = const_cast<char*>(datagram.body);
+		bufs[1].len = static_cast<ULONG>(datagram.bodyLen);
+
+		DWORD sentBytes;
+		res = WSASendTo(sock, bufs, 2, &sentBytes, static_cast<DWORD>(flags),
+						reinterpret_cast<const sockaddr*>(&datagram.addr), sizeof(datagram.addr), nullptr, nullptr);
+	#else
+		iovec iovs[2];
+		iovs[0].iov_base = datagram.data;
+		iovs[0].iov_len  = static_cast<size_t>(datagram.len);
+		iovs[1].iov_base = const_cast<char*>(datagram.body);
+		iovs[1].iov_len  = static_cast<size_t>(datagram.bodyLen);
+
+		msghdr msg;
+		ZeroMemory(&msg, sizeof(msg));
+		msg.msg_name	= const_cast<SOCKADDR_IN*>(&datagram.addr);
+		msg.msg_namelen = sizeof(datagram.addr);
+		msg.msg_iov		= iovs;
+		msg.msg_iovlen	= 2;
+
+		res = static_cast<int>(sendmsg(sock, &msg, flags));
+	#endif
+
+		if (res == SOCKET_ERROR)
+		{
+			int err = LastError();
+			if (SendWouldBlock(err))
+			{
+				if (!WaitForRoom(sock, owner, bShouldStop)) { return false; }
+
+				goto BEGIN;
+			}
+			else if (RetrySendTo(err))
+			{
+				goto BEGIN;
+			}
+			else
+			{
+				owner->InitEx("Failed the sendmsg.", err);
+				return false;
+			}
+		}
+
+		return true;
+	}
+
+	// Checks whether the kernel can segment sends of this socket, the option is only set per send afterwards.
+	inline bool EnableSegmentation(SOCKET sock, uint16_t segmentSz)
+	{
+	#ifdef __linux__
+		int value = segmentSz;
+		if (setsockopt(sock, SOL_UDP, UDP_SEGMENT, &value, sizeof(value)) == SOCKET_ERROR)
+		{
+			return false;
+		}
+
+		value = 0;
+		setsockopt(sock, SOL_UDP, UDP_SEGMENT, &value, sizeof(value));
+
+		return true;
+	#else
+		(void) sock;
+		(void) segmentSz;
+
+		return false;
+	#endif
+	}
+
+	// Asks the kernel to coalesce datagrams of the same size into a single read, false where it can't.
+	inline bool EnableCoalescing(SOCKET sock)
+	{
+	#ifdef __linux__
+		int value = 1;
+		return setsockopt(sock, SOL_UDP, UDP_GRO, &value, sizeof(value)) != SOCKET_ERROR;
+	#else
+		(void) sock;
+
+		return false;
+	#endif
+	}
+
+	// Raises a socket buffer (SO_RCVBUF or SO_SNDBUF) to at least bytes, as far as the system allows.
+	inline void GrowSocketBuffer(SOCKET sock, int option, int bytes)
+	{
+		int current = 0;
+	#ifdef _WIN32
+		int currentLen = sizeof(current);
+		getsockopt(sock, SOL_SOCKET, option, reinterpret_cast<char*>(&current), &currentLen);
+	#else
+		socklen_t currentLen = sizeof(current);
+		getsockopt(sock, SOL_SOCKET, option, &current, &currentLen);
+	#endif
+
+		if (current < bytes)
+		{
+			setsockopt(sock, SOL_SOCKET, option, reinterpret_cast<const char*>(&bytes), sizeof(bytes));
+		}
+	}
+
+	// Sets the don't fragment bit on everything the socket sends, ignoring what the system thinks the path MTU is.
+	inline bool SetDontFragment(SOCKET sock)
+	{
+	#if defined(_WIN32)
+		DWORD value = TRUE;
+		return setsockopt(sock, IPPROTO_IP, IP_DONTFRAGMENT, reinterpret_cast<const char*>(&value), sizeof(value)) != SOCKET_ERROR;
+	#elif defined(__linux__)
+		int value = IP_PMTUDISC_PROBE;
+		return setsockopt(sock, IPPROTO_IP, IP_MTU_DISCOVER, &value, sizeof(value)) != SOCKET_ERROR;
+	#elif defined(IP_DONTFRAG)
+		int value = 1;
+		return setsockopt(sock, IPPROTO_IP, IP_DONTFRAG, &value, sizeof(value)) != SOCKET_ERROR;
+	#else
+		(void) sock;
+
+		return false;
+	#endif
+	}
+
+	// Sends every datagram, up to BATCH_maxDatagrams of them per system call where the platform allows it. If
+	// bSegmentation is set, runs of datagrams to the same address which are as long as the first of the run (but
+	// for the last) go out as a single buffer the kernel segments. If it refuses, bSegmentation is cleared and they
+	// go out one by one.
+	template<class T>
+	static bool SendDataBatch(SOCKET sock, T* owner,
+							  const std::atomic_bool& bShouldStop, const Datagram* datagrams, int count, int flags,
+							  bool* bSegmentation = nullptr)
+	{
+	#ifdef __linux__
+		mmsghdr msgs[BATCH_maxDatagrams];
+		iovec iovs[2 * BATCH_maxDatagrams];
+		int runs[BATCH_maxDatagrams];
+
+		union
+		{
+			char buf[CMSG_SPACE(sizeof(uint16_t))];
+			cmsghdr align;
+		} controls[BATCH_maxDatagrams];
+
+		int sent = 0;
+		while (sent < count)
+		{
+		BEGIN:
+			if (bShouldStop) { return false; }
+
+			const bool bSegment = (bSegmentation != nullptr) && (*bSegmentation);
+
+			int chunk = (count - sent < BATCH_maxDatagrams) ? (count - sent) : BATCH_maxDatagrams;
+			int msgCount = 0;
+			int iovCount = 0;
+			for (int i = 0; i < chunk;)
+			{
+				const Datagram& first = datagrams[sent + i];
+
+				ZeroMemory(&msgs[msgCount], sizeof(msgs[msgCount]));
+				msgs[msgCount].msg_hdr.msg_name	   = const_cast<SOCKADDR_IN*>(&first.addr);
+				msgs[msgCount].msg_hdr.msg_namelen = sizeof(first.addr);
+				msgs[msgCount].msg_hdr.msg_iov	   = &iovs[iovCount];
+
+				const uint16_t segment = static_cast<uint16_t>(first.len + first.bodyLen);
+
+				// Growing the run while the previous datagram was a full segment.
+				int run = 0;
+				int runBytes = 0;
+				do
+				{
+					const Datagram& datagram = datagrams[sent + i + run];
+
+					iovs[iovCount].iov_base = datagram.data;
+					iovs[iovCount].iov_len  = static_cast<size_t>(datagram.len);
+					++iovCount;
+
+					if (datagram.bodyLen > 0)
+					{
+						iovs[iovCount].iov_base = const_cast<char*>(datagram.body);
+						iovs[iovCount].iov_len  = static_cast<size_t>(datagram.bodyLen);
+						++iovCount;
+					}
+
+					runBytes += datagram.len + datagram.bodyLen;
+					++run;
+				} while (bSegment && (i + run < chunk) && (run < GSO_maxSegments) &&
+						 (datagrams[sent + i + run - 1].len + datagrams[sent + i + run - 1].bodyLen == segment) &&
+						 SameAddress(datagrams[sent + i + run].addr, first.addr) &&
+						 (runBytes + datagrams[sent + i + run].len + datagrams[sent + i + run].bodyLen <= GSO_maxBytes) &&
+						 (datagrams[sent + i + run].len + datagrams[sent + i + run].bodyLen <= segment));
+
+				msgs[msgCount].msg_hdr.msg_iovlen = static_cast<size_t>(&iovs[iovCount] - msgs[msgCount].msg_hdr.msg_iov);
+
+				if (run > 1)
+				{
+					msgs[msgCount].msg_hdr.msg_control	  = controls[msgCount].buf;
+					msgs[msgCount].msg_hdr.msg_controllen = sizeof(controls[msgCount].buf);
+
+					cmsghdr* cmsg = CMSG_FIRSTHDR(&msgs[msgCount].msg_hdr);
+					cmsg->cmsg_level = SOL_UDP;
+					cmsg->cmsg_type	 = UDP_SEGMENT;
+					cmsg->cmsg_len	 = CMSG_LEN(sizeof(uint16_t));
+					std::memcpy(reinterpret_cast<void*>(CMSG_DATA(cmsg)), reinterpret_cast<const void*>(&segment), sizeof(uint16_t));
+				}
+
+				runs[msgCount] = run;
+				++msgCount;
+				i += run;
+			}
+
+			// A partial batch is not an error, the rest goes out with the next call.
+			int res = sendmmsg(sock, msgs, static_cast<unsigned int>(msgCount), flags);
+			if (res == SOCKET_ERROR)
+			{
+				int err = LastError();
+				if (SendWouldBlock(err))
+				{
+					if (!WaitForRoom(sock, owner, bShouldStop)) { return false; }
+
+					goto BEGIN;
+				}
+				else if (RetrySendTo(err))
+				{
+					goto BEGIN;
+				}
+				// Devices without checksum offload can't segment, everything goes out unsegmented from now on.
+				else if (bSegment && ((err == EIO) || (err == EINVAL) || (err == ENOPROTOOPT)))
+				{
+					(*bSegmentation) = false;
+					goto BEGIN;
+				}
+				else
+				{
+					owner->InitEx("Failed the sendmmsg.", err);
+					return false;
+				}
+			}
+
+			for (int i = 0; i < res; ++i)
+			{
+				sent += runs[i];
+			}
+		}
+
+		return true;
+	#else
+		(void) bSegmentation;
+
+		for (int i = 0; i < count; ++i)
+		{
+			bool bSent = (datagrams[i].bodyLen > 0) ?
+				SendDataGather(sock, owner, bShouldStop, datagrams[i], flags) :
+				SendData(sock, owner, bShouldStop, datagrams[i].data, datagrams[i].len, flags,
+						 reinterpret_cast<const sockaddr*>(&datagrams[i].addr), sizeof(datagrams[i].addr));
+
+			if (!bSent)
+			{
+				return false;
+			}
+		}
+
+		return true;
+	#endif
+	}
+
+	// Waits for data like ReceiveData, then drains up to count datagrams without blocking for the rest.
+	template<class T>
+	static bool ReceiveDataBatch(SOCKET sock, const timeval& timeout, T* owner,
+								 const std::atomic_bool& bShouldStop, const std::atomic_bool& bExInit,
+								 Datagram* datagrams, int count, int flags, int* received)
+	{
+		(*received) = 0;
+
+		if (!WaitForData(sock, timeout, owner, bShouldStop, bExInit))
+		{
+			return false;
+		}
+
+	#ifdef __linux__
+		mmsghdr msgs[BATCH_maxDatagrams];
+		iovec iovs[BATCH_maxDatagrams];
+
+		int chunk = (count < BATCH_maxDatagrams) ? count : BATCH_maxDatagrams;
+		for (int i = 0; i < chunk; ++i)
+		{
+			iovs[i].iov_base = datagrams[i].data;
+			iovs[i].iov_len  = static_cast<size_t>(datagrams[i].len);
+
+			ZeroMemory(&msgs[i], sizeof(msgs[i]));
+			msgs[i].msg_hdr.msg_name	= &datagrams[i].addr;
+			msgs[i].msg_hdr.msg_namelen = sizeof(datagrams[i].addr);
+			msgs[i].msg_hdr.msg_iov		= &iovs[i];
+			msgs[i].msg_hdr.msg_iovlen	= 1;
+		}
+
+	BEGIN:
+		if (bShouldStop) { return false; }
+
+		int res = recvmmsg(sock, msgs, static_cast<unsigned int>(chunk), flags | MSG_DONTWAIT, nullptr);
+		if (res == SOCKET_ERROR)
+		{
+			int err = LastError();
+			if ((err == EAGAIN) || (err == EWOULDBLOCK))
+			{
+				return true;
+			}
+			else if (RetryRecv(err))
+			{
+				goto BEGIN;
+			}
+			else
+			{
+				owner->InitEx("Failed the recvmmsg.", err);
+				return false;
+			}
+		}
+
+		for (int i = 0; i < res; ++i)
+		{
+			datagrams[i].len = static_cast<int>(msgs[i].msg_len);
+		}
+
+		(*received) = res;
+		return true;
+	#else
+		const timeval noWait = { 0, 0 };
+		for (int i = 0; i < count; ++i)
+		{
+			// Only the first datagram is waited for.
+			if ((i > 0) && !DataAvailable(sock, noWait, owner))
+			{
+				break;
+			}
+
+			int fromlen = sizeof(datagrams[i].addr);
+			if (!ReceiveData(sock, timeout, owner, bShouldStop, bExInit, datagrams[i].data, datagrams[i].len, flags,
+							 reinterpret_cast<sockaddr*>(&datagrams[i].addr), &fromlen, &datagrams[i].len))
+			{
+				return (*received) > 0;
+			}
+
+			++(*received);
+		}
+
+		return true;
+	#endif
+	}
+
+	// Like ReceiveDataBatch, but drains up to bufferCount reads of bufferSz bytes each, which the kernel may have
+	// coalesced from several datagrams (see EnableCoalescing). Every datagram comes out as a Datagram of its own
+	// pointing into buffers, datagrams has to have room for bufferCount * GSO_maxSegments of them.
+	template<class T>
+	static bool ReceiveDataCoalesced(SOCKET sock, const timeval& timeout, T* owner,
+									 const std::atomic_bool& bShouldStop, const std::atomic_bool& bExInit,
+									 char* buffers, int bufferSz, int bufferCount, Datagram* datagrams, int flags, int* received,
+									 bool* bDrained)
+	{
+		(*received) = 0;
+		(*bDrained) = true;
+
+	#ifdef __linux__
+		if (!WaitForData(sock, timeout, owner, bShouldStop, bExInit))
+		{
+			return false;
+		}
+
+		mmsghdr msgs[GRO_maxBuffers];
+		iovec iovs[GRO_maxBuffers];
+		SOCKADDR_IN addrs[GRO_maxBuffers];
+
+		union
+		{
+			char buf[CMSG_SPACE(sizeof(int))];
+			cmsghdr align;
+		} controls[GRO_maxBuffers];
+
+		int chunk = (bufferCount < GRO_maxBuffers) ? bufferCount : GRO_maxBuffers;
+		for (int i = 0; i < chunk; ++i)
+		{
+			iovs[i].iov_base = buffers + i * bufferSz;
+			iovs[i].iov_len  = static_cast<size_t>(bufferSz);
+
+			ZeroMemory(&msgs[i], sizeof(msgs[i]));
+			msgs[i].msg_hdr.msg_name	   = &addrs[i];
+			msgs[i].msg_hdr.msg_namelen	   = sizeof(addrs[i]);
+			msgs[i].msg_hdr.msg_iov		   = &iovs[i];
+			msgs[i].msg_hdr.msg_iovlen	   = 1;
+			msgs[i].msg_hdr.msg_control	   = controls[i].buf;
+			msgs[i].msg_hdr.msg_controllen = sizeof(controls[i].buf);
+		}
+
+	BEGIN:
+		if (bShouldStop) { return false; }
+
+		int res = recvmmsg(sock, msgs, static_cast<unsigned int>(chunk), flags | MSG_DONTWAIT, nullptr);
+		if (res == SOCKET_ERROR)
+		{
+			int err = LastError();
+			if ((err == EAGAIN) || (err == EWOULDBLOCK))
+			{
+				return true;
+			}
+			else if (RetryRecv(err))
+			{
+				goto BEGIN;
+			}
+			else
+			{
+				owner->InitEx("Failed the recvmmsg.", err);
+				return false;
+			}
+		}
+
+		// Fewer reads than buffers means nothing else was waiting, however many datagrams they held.
+		(*bDrained) = (res < chunk);
+
+		// Cutting every read back into the datagrams it was coalesced from.
+		for (int i = 0; i < res; ++i)
+		{
+			int len = static_cast<int>(msgs[i].msg_len);
+			int segmentSz = len;
+
+			for (cmsghdr* cmsg = CMSG_FIRSTHDR(&msgs[i].msg_hdr); cmsg != nullptr; cmsg = CMSG_NXTHDR(&msgs[i].msg_hdr, cmsg))
+			{
+				if ((cmsg->cmsg_level == SOL_UDP) && (cmsg->cmsg_type == UDP_GRO))
+				{
+					std::memcpy(reinterpret_cast<void*>(&segmentSz), reinterpret_cast<const void*>(CMSG_DATA(cmsg)), sizeof(int));
+				}
+			}
+
+			segmentSz = (segmentSz > 0) ? segmentSz : len;
+
+			for (int offset = 0; (offset < len) && ((*received) < bufferCount * GSO_maxSegments); offset += segmentSz)
+			{
+				Datagram& datagram = datagrams[(*received)++];
+				datagram.data = buffers + i * bufferSz + offset;
+				datagram.len  = (len - offset < segmentSz) ? (len - offset) : segmentSz;
+				datagram.addr = addrs[i];
+			}
+		}
+
+		return true;
+	#else
+		// Nothing gets coalesced, every buffer holds a single datagram.
+		int chunk = (bufferCount < GRO_maxBuffers) ? bufferCount : GRO_maxBuffers;
+		for (int i = 0; i < chunk; ++i)
+		{
+			datagrams[i].data = buffers + i * bufferSz;
+			datagrams[i].len  = bufferSz;
+		}
+
+		if (!ReceiveDataBatch(sock, timeout, owner, bShouldStop, bExInit, datagrams, chunk, flags, received))
+		{
+			return false;
+		}
+
+		(*bDrained) = ((*received) < chunk);
+		return true;
+	#endif
+	}
 }
@@ -0,0 +1,374 @@
+#pragma once
+
+/// STD
+#include <atomic>
+#include <mutex>
+#include <new>
+#include <cstdint>
+#include <cstddef>
+#include <vector>
+#include <utility>
+#include <algorithm>
+
+/// CUSTOM
+#include "UDPRDebugHeaders.h"
+#include "UDPRMisc.h"
+
+namespace UDPR
+{
+	// What the packet pool holds, summed over every size class.
+	struct PacketPoolStats
+	{
+		// Allocated from the system, it is never given back.
+		uint64_t reservedBytes = 0;
+
+		// Handed out and not released yet, and the most that ever were.
+		uint64_t buffersInUse = 0;
+		uint64_t bytesInUse = 0;
+		uint64_t peakBytesInUse = 0;
+
+		// Acquires turned down by the limit.
+		uint64_t refused = 0;
+	};
+
+	class PacketPool;
+
+	// Reference counted handle to a packet buffer from the pool, the buffer goes back once the last handle to it is
+	// gone. Copies share the buffer, each handle is only ever used by one thread at a time.
+	class PacketBuffer
+	{
+	public:
+		PacketBuffer() = default;
+
+		PacketBuffer(const PacketBuffer& other) : buffer(other.buffer)
+		{
+			if (buffer != nullptr)
+			{
+				buffer->refs.fetch_add(1, std::memory_order_relaxed);
+			}
+		}
+
+		PacketBuffer(PacketBuffer&& other) noexcept : buffer(other.buffer)
+		{
+			other.buffer = nullptr;
+		}
+
+		PacketBuffer& operator=(const PacketBuffer& other)
+		{
+			PacketBuffer(other).Swap(*this);
+			return *this;
+		}
+
+		PacketBuffer& operator=(PacketBuffer&& other) noexcept
+		{
+			PacketBuffer(std::move(other)).Swap(*this);
+			return *this;
+		}
+
+		~PacketBuffer()
+		{
+			Reset();
+		}
+
+		inline void Reset();
+
+		FORCEINLINE BYTE* data() const { return reinterpret_cast<BYTE*>(buffer + 1); }
+		FORCEINLINE size_t capacity() const { return (buffer != nullptr) ? buffer->capacity : 0; }
+
+		FORCEINLINE explicit operator bool() const { return buffer != nullptr; }
+
+	private:
+		friend class PacketPool;
+
+		// Sits in front of the buffer's data, which starts on the next cache line.
+		struct alignas(64) Header
+		{
+			std::atomic<uint32_t> refs { 0 };
+			uint32_t sizeClass = 0;
+			uint32_t capacity = 0;
+			Header* next = nullptr;
+		};
+
+		explicit PacketBuffer(Header* _buffer) : buffer(_buffer) {  }
+
+		FORCEINLINE void Swap(PacketBuffer& other) noexcept
+		{
+			std::swap(buffer, other.buffer);
+		}
+
+		Header* buffer = nullptr;
+	};
+
+	// Fixed-size packet buffers shared by every sender and receiver in the process. Sizes are rounded up to one of
+	// POOL_classCount classes, each carved out of slabs of POOL_slabSz and starting on a cache line of its own. Every
+	// thread keeps up to POOL_cacheSz free buffers of each class and trades them with the shared free list POOL_batchSz
+	// at a time, so acquiring and releasing rarely take a lock and never allocate once the pool has grown to what is
+	// in flight. Memory taken from the system stays in the pool, a limit bounds it.
+	class PacketPool
+	{
+	public:
+		static constexpr size_t POOL_slabSz = 256 * 1024;
+		static constexpr uint32_t POOL_cacheSz = 64;
+		static constexpr uint32_t POOL_batchSz = 32;
+		static constexpr int POOL_classCount = 13;
+
+		// The largest buffer there is, as large as any UDP datagram.
+		static constexpr size_t POOL_maxSz = 65536;
+
+	public:
+		// An empty handle if size is above POOL_maxSz or the pool would grow past its limit.
+		static PacketBuffer Acquire(size_t size)
+		{
+			const int sizeClass = GetSizeClass(size);
+			if (sizeClass < 0)
+			{
+				return PacketBuffer();
+			}
+
+			ThreadCache& cache = GetThreadCache();
+			if ((cache.free[sizeClass] == nullptr) && !cache.Refill(sizeClass))
+			{
+				GetStatsCounters().refused.fetch_add(1, std::memory_order_relaxed);
+				return PacketBuffer();
+			}
+
+			PacketBuffer::Header* buffer = cache.free[sizeClass];
+			cache.free[sizeClass] = buffer->next;
+			--cache.count[sizeClass];
+
+			buffer->next = nullptr;
+			buffer->refs.store(1, std::memory_order_relaxed);
+
+			Counters& counters = GetStatsCounters();
+			counters.buffersInUse.fetch_add(1, std::memory_order_relaxed);
+			const uint64_t inUse = counters.bytesInUse.fetch_add(buffer->capacity, std::memory_order_relaxed) + buffer->capacity;
+
+			uint64_t peak = counters.peakBytesInUse.load(std::memory_order_relaxed);
+			while ((inUse > peak) && !counters.peakBytesInUse.compare_exchange_weak(peak, inUse, std::memory_order_relaxed))
+			{
+			}
+
+			return PacketBuffer(buffer);
+		}
+
+		// Bounds what the pool takes from the system, 0 lifts the bound. Memory already taken stays.
+		static void SetLimit(uint64_t bytes)
+		{
+			GetStatsCounters().limit.store(bytes, std::memory_order_relaxed);
+		}
+
+		static PacketPoolStats GetStats()
+		{
+			const Counters& counters = GetStatsCounters();
+
+			PacketPoolStats stats;
+			stats.reservedBytes = counters.reservedBytes.load(std::memory_order_relaxed);
+			stats.buffersInUse = counters.buffersInUse.load(std::memory_order_relaxed);
+			stats.bytesInUse = counters.bytesInUse.load(std::memory_order_relaxed);
+			stats.peakBytesInUse = counters.peakBytesInUse.load(std::memory_order_relaxed);
+			stats.refused = counters.refused.load(std::memory_order_relaxed);
+
+			return stats;
+		}
+
+	private:
+		friend class PacketBuffer;
+
+		using Header = PacketBuffer::Header;
+
+		struct Counters
+		{
+			std::atomic<uint64_t> reservedBytes { 0 };
+			std::atomic<uint64_t> buffersInUse { 0 };
+			std::atomic<uint64_t> bytesInUse { 0 };
+			std::atomic<uint64_t> peakBytesInUse { 0 };
+			std::atomic<uint64_t> refused { 0 };
+			std::atomic<uint64_t> limit { 0 };
+		};
+
+		// The shared free list of a size class and the slabs its buffers live in.
+		struct Shared
+		{
+			std::mutex mutex;
+			Header* free = nullptr;
+			std::vector<void*> slabs;
+
+			~Shared()
+			{
+				for (void* slab : slabs)
+				{
+					::operator delete(slab, std::align_val_t(alignof(Header)));
+				}
+			}
+		};
+
+		// Free buffers of the calling thread, handed back to the shared lists when it ends.
+		struct ThreadCache
+		{
+			Header* free[POOL_classCount] = {  };
+			uint32_t count[POOL_classCount] = {  };
+
+			~ThreadCache()
+			{
+				for (int sizeClass = 0; sizeClass < POOL_classCount; ++sizeClass)
+				{
+					Flush(sizeClass, count[sizeClass]);
+				}
+			}
+
+			// Takes a batch from the shared list, growing it by a slab if it is empty.
+			bool Refill(int sizeClass)
+			{
+				Shared& shared = GetShared()[sizeClass];
+				std::lock_guard<std::mutex> lock(shared.mutex);
+
+				if ((shared.free == nullptr) && !Grow(shared, sizeClass))
+				{
+					return false;
+				}
+
+				for (uint32_t i = 0; (i < POOL_batchSz) && (shared.free != nullptr); ++i)
+				{
+					Header* buffer = shared.free;
+					shared.free = buffer->next;
+
+					buffer->next = free[sizeClass];
+					free[sizeClass] = buffer;
+					++count[sizeClass];
+				}
+
+				return true;
+			}
+
+			// Gives up to n buffers back to the shared list.
+			void Flush(int sizeClass, uint32_t n)
+			{
+				if (n == 0)
+				{
+					return;
+				}
+
+				Shared& shared = GetShared()[sizeClass];
+				std::lock_guard<std::mutex> lock(shared.mutex);
+
+				for (uint32_t i = 0; (i < n) && (free[sizeClass] != nullptr); ++i)
+				{
+					Header* buffer = free[sizeClass];
+					free[sizeClass] = buffer->next;
+					--count[sizeClass];
+
+					buffer->next = shared.free;
+					shared.free = buffer;
+				}
+			}
+		};
+
+		static void Release(Header* buffer)
+		{
+			Counters& counters = GetStatsCounters();
+			counters.buffersInUse.fetch_sub(1, std::memory_order_relaxed);
+			counters.bytesInUse.fetch_sub(buffer->capacity, std::memory_order_relaxed);
+
+			ThreadCache& cache = GetThreadCache();
+			const int sizeClass = static_cast<int>(buffer->sizeClass);
+
+			buffer->next = cache.free[sizeClass];
+			cache.free[sizeClass] = buffer;
+
+			// Threads that only ever release, like one writing behind a receiver, pass their buffers on.
+			if (++cache.count[sizeClass] > POOL_cacheSz)
+			{
+				cache.Flush(sizeClass, POOL_batchSz);
+			}
+		}
+
+		// Adds a slab's worth of buffers to the shared list, which has to be locked.
+		static bool Grow(Shared& shared, int sizeClass)
+		{
+			const size_t capacity = GetClassSize(sizeClass);
+			const size_t stride = sizeof(Header) + capacity;
+			const size_t bufferCount = (std::max)(POOL_slabSz / stride, static_cast<size_t>(1));
+			const size_t slabSz = bufferCount * stride;
+
+			Counters& counters = GetStatsCounters();
+			const uint64_t limit = counters.limit.load(std::memory_order_relaxed);
+			if ((limit > 0) && (counters.reservedBytes.load(std::memory_order_relaxed) + slabSz > limit))
+			{
+				return false;
+			}
+
+			BYTE* slab = static_cast<BYTE*>(::operator new(slabSz, std::align_val_t(alignof(Header)), std::nothrow));
+			if (slab == nullptr)
+			{
+				return false;
+			}
+
+			shared.slabs.push_back(slab);
+			counters.reservedBytes.fetch_add(slabSz, std::memory_order_relaxed);
+
+			for (size_t i = 0; i < bufferCount; ++i)
+			{
+				Header* buffer = new (slab + i * stride) Header();
+				buffer->sizeClass = static_cast<uint32_t>(sizeClass);
+				buffer->capacity = static_cast<uint32_t>(capacity);
+				buffer->next = shared.free;
+				shared.free = buffer;
+			}
+
+			return true;
+		}
+
+		// Powers of two from 1 KiB to 64 KiB and halfway between them, so no buffer is more than a third too large.
+		// All are whole cache lines.
+		static constexpr size_t GetClassSize(int sizeClass)
+		{
+			return (static_cast<size_t>(1024) << (sizeClass / 2)) * ((sizeClass % 2 == 0) ? 2 : 3) / 2;
+		}
+
+		static int GetSizeClass(size_t size)
+		{
+			static_assert(GetClassSize(POOL_classCount - 1) == POOL_maxSz, "The largest class has to be POOL_maxSz.");
+
+			for (int sizeClass = 0; sizeClass < POOL_classCount; ++sizeClass)
+			{
+				if (size <= GetClassSize(sizeClass))
+				{
+					return sizeClass;
+				}
+			}
+
+			return -1;
+		}
+
+		static Shared* GetShared()
+		{
+			static Shared shared[POOL_classCount];
+			return shared;
+		}
+
+		static Counters& GetStatsCounters()
+		{
+			static Counters counters;
+			return counters;
+		}
+
+		static ThreadCache& GetThreadCache()
+		{
+			// The shared lists have to outlive every thread's cache, the main thread's included.
+			GetShared();
+
+			static thread_local ThreadCache cache;
+			return cache;
+		}
+	};
+
+	inline void PacketBuffer::Reset()
+	{
+		if ((buffer != nullptr) && (buffer->refs.fetch_sub(1, std::memory_order_acq_rel) == 1))
+		{
+			PacketPool::Release(buffer);
+		}
+
+		buffer = nullptr;
+	}
+}
@@ -0,0 +1,575 @@
+#pragma once
+
+/// STD
+#include <memory>
+#include <thread>
+#include <atomic>
+#include <mutex>
+#include <condition_variable>
+#include <cstdint>
+#include <vector>
+#include <deque>
+#include <map>
+#include <unordered_map>
+#include <chrono>
+#include <string>
+#include <functional>
+#include <algorithm>
+
+#ifdef __linux__
+/// LINUX
+#include <sys/epoll.h>
+#endif
+
+/// CUSTOM
+#include "UDPRDebugHeaders.h"
+#include "UDPRMisc.h"
+
+namespace UDPR
+{
+	// Drives many senders and receivers from a fixed pool of threads. A single dispatcher thread waits on
+	// every socket (epoll on Linux, poll elsewhere) and on their deadlines, and hands whatever is ready
+	// to the workers. A handler is never run by two threads at once.
+	class Reactor
+	{
+	public:
+		using Clock = std::chrono::steady_clock;
+
+		/// Anything the reactor can drive, each handler owns exactly one socket.
+		class Handler
+		{
+		public:
+			virtual ~Handler() = default;
+
+			virtual SOCKET GetSocket() const = 0;
+
+			// When OnTimer is due, Clock::time_point::max() if never.
+			virtual Clock::time_point GetDeadline() const = 0;
+
+			// Both return false once the handler is done, it is detached right after.
+			virtual bool OnReadable() = 0;
+			virtual bool OnTimer() = 0;
+
+			// Called once the handler is done, on the worker which ran it last.
+			virtual void OnDetached() = 0;
+		};
+
+	public:
+		explicit Reactor(size_t _workerCount = 2) :
+			bShouldStop(false)
+		{
+			Start(_workerCount);
+		}
+
+		~Reactor()
+		{
+			{
+				std::lock_guard<std::mutex> lock(mutex);
+				bShouldStop = true;
+			}
+
+			waker.Wake();
+			workAvailable.notify_all();
+
+			if (dispatcher.joinable())
+			{
+				dispatcher.join();
+			}
+
+			for (std::thread& worker : workers)
+			{
+				worker.join();
+			}
+
+		#ifdef __linux__
+			if (epollFd != SOCKET_ERROR)
+			{
+				close(epollFd);
+			}
+		#endif
+
+			waker.Close();
+
+			if (bNetStarted)
+			{
+				NetCleanup();
+			}
+		}
+
+		Reactor(const Reactor&) = delete;
+		Reactor& operator=(const Reactor&) = delete;
+
+		// Starts driving the handler, returns false if the reactor failed or the socket couldn't be watched.
+		bool Attach(Handler* handler)
+		{
+			if (bExInit)
+			{
+				return false;
+			}
+
+			std::unique_lock<std::mutex> lock(mutex);
+
+			auto entry = std::make_shared<Entry>();
+			entry->handler  = handler;
+			entry->id       = nextEntryID++;
+			entry->deadline = handler->GetDeadline();
+
+		#ifdef __linux__
+			// One shot, so the socket is only reported again once its handler has been run.
+			epoll_event event {  };
+			event.events   = EPOLLIN | EPOLLONESHOT;
+			event.data.u64 = entry->id;
+
+			if (epoll_ctl(epollFd, EPOLL_CTL_ADD, handler->GetSocket(), &event) == SOCKET_ERROR)
+			{
+				return false;
+			}
+		#endif
+
+			entries[entry->id] = entry;
+			ids[handler] = entry->id;
+
+			// Letting the handler send whatever it starts with.
+			Schedule(entry);
+
+			return true;
+		}
+
+		// Stops driving the handler, waits for the worker running it (if any) to let go of it.
+		void Detach(Handler* handler)
+		{
+			std::unique_lock<std::mutex> lock(mutex);
+
+			auto idIt = ids.find(handler);
+			if (idIt == ids.end())
+			{
+				return;
+			}
+
+			std::shared_ptr<Entry> entry = entries[idIt->second];
+			entry->bDetached = true;
+
+			runFinished.wait(lock, [&]() { return !entry->bRunning; });
+
+			Forget(entry, true);
+		}
+
+		// Runs the task on whichever worker is free first, between handlers, tasks posted before the reactor stops run
+		// before it does. Returns false once it is stopping, the task won't run then.
+		bool Post(std::function<void()> task)
+		{
+			{
+				std::lock_guard<std::mutex> lock(mutex);
+				if (bShouldStop)
+				{
+					return false;
+				}
+
+				tasks.push_back(std::move(task));
+			}
+
+			workAvailable.notify_one();
+			return true;
+		}
+
+		// Runs the handler as soon as a worker is free, whatever its deadline, e.g. for it to notice it was asked to stop.
+		void Wake(Handler* handler)
+		{
+			std::lock_guard<std::mutex> lock(mutex);
+
+			auto idIt = ids.find(handler);
+			if (idIt != ids.end())
+			{
+				Schedule(entries[idIt->second]);
+			}
+		}
+
+	private:
+		void Start(size_t workerCount)
+		{
+			if (int err; (err = NetStartup()) != 0)
+			{
+				return InitEx("Failed the WSAStartup.", err);
+			}
+
+			bNetStarted = true;
+
+			if (!waker.Open())
+			{
+				return InitEx("Failed to open the waker.", LastError());
+			}
+
+		#ifdef __linux__
+			if ((epollFd = epoll_create1(EPOLL_CLOEXEC)) == SOCKET_ERROR)
+			{
+				return InitEx("Failed the epoll_create1.", LastError());
+			}
+
+			// The waker is the only entry with ID 0.
+			epoll_event event {  };
+			event.events   = EPOLLIN;
+			event.data.u64 = 0;
+
+			if (epoll_ctl(epollFd, EPOLL_CTL_ADD, waker.GetHandle(), &event) == SOCKET_ERROR)
+			{
+				return InitEx("Failed the epoll_ctl.", LastError());
+			}
+		#endif
+
+			dispatcher = std::thread(&Reactor::Dispatch, this);
+
+			for (size_t i = 0; i < (std::max)(workerCount, static_cast<size_t>(1)); ++i)
+			{
+				workers.emplace_back(&Reactor::Work, this);
+			}
+		}
+
+		using Timers = std::multimap<Clock::time_point, uint64_t>;
+
+		struct Entry
+		{
+			Handler* handler = nullptr;
+			uint64_t id = 0;
+			Clock::time_point deadline = Clock::time_point::max();
+
+			// The entry's single node in timers, if it has a deadline.
+			Timers::iterator timer;
+			bool bTimer = false;
+
+			// Queued and running are never both set, rerun asks for another run once the current one ends.
+			bool bQueued = false;
+			bool bRunning = false;
+			bool bRerun = false;
+			bool bReadable = false;
+			bool bDetached = false;
+		};
+
+		// Has to be called with the mutex held.
+		void Schedule(const std::shared_ptr<Entry>& entry)
+		{
+			if (entry->bDetached || entry->bQueued)
+			{
+				return;
+			}
+
+			if (entry->bRunning)
+			{
+				entry->bRerun = true;
+				return;
+			}
+
+			entry->bQueued = true;
+			work.push_back(entry);
+			workAvailable.notify_one();
+		}
+
+		// Has to be called with the mutex held, bUnwatch is false once the handler may have closed its socket.
+		void Forget(const std::shared_ptr<Entry>& entry, bool bUnwatch)
+		{
+		#ifdef __linux__
+			if (bUnwatch)
+			{
+				epoll_ctl(epollFd, EPOLL_CTL_DEL, entry->handler->GetSocket(), nullptr);
+			}
+		#endif
+
+			SetTimer(entry, Clock::time_point::max());
+
+			ids.erase(entry->handler);
+			entries.erase(entry->id);
+		}
+
+		// Has to be called with the mutex held, replaces the entry's timer (if any) with one for the deadline.
+		void SetTimer(const std::shared_ptr<Entry>& entry, Clock::time_point deadline)
+		{
+			if (entry->bTimer && (entry->timer->first == deadline))
+			{
+				return;
+			}
+
+			if (entry->bTimer)
+			{
+				timers.erase(entry->timer);
+				entry->bTimer = false;
+			}
+
+			entry->deadline = deadline;
+			if (deadline != Clock::time_point::max())
+			{
+				entry->timer = timers.emplace(deadline, entry->id);
+				entry->bTimer = true;
+			}
+		}
+
+		void Dispatch()
+		{
+			while (!bShouldStop)
+			{
+				// Sleeping until the nearest deadline, the waker cuts it short whenever deadlines change.
+				int waitMs = -1;
+				{
+					std::lock_guard<std::mutex> lock(mutex);
+
+					if (!timers.empty())
+					{
+						auto untilDue = std::chrono::ceil<std::chrono::milliseconds>(timers.begin()->first - Clock::now());
+						waitMs = static_cast<int>((std::max)(untilDue.count(), static_cast<decltype(untilDue.count())>(0)));
+					}
+				}
+
+			#ifdef __linux__
+				epoll_event events[64];
+				int res = epoll_wait(epollFd, events, 64, waitMs);
+
+				if ((res == SOCKET_ERROR) && (errno != EINTR))
+				{
+					InitEx("Failed the epoll_wait.", LastError());
+					break;
+				}
+
+				std::lock_guard<std::mutex> lock(mutex);
+
+				for (int i = 0; i < res; ++i)
+				{
+					if (events[i].data.u64 == 0)
+					{
+						waker.Drain();
+						continue;
+					}
+
+					auto it = entries.find(events[i].data.u64);
+					if (it != entries.end())
+					{
+						it->second->bReadable = true;
+						Schedule(it->second);
+					}
+				}
+			#else
+				// Only idle handlers are watched, the rest are re-armed once their run ends.
+				std::vector<PollFd> fds;
+				std::vector<std::shared_ptr<Entry>> watched;
+				{
+					std::lock_guard<std::mutex> lock(mutex);
+
+					fds.push_back({ waker.GetHandle(), POLLIN, 0 });
+					for (auto& [id, entry] : entries)
+					{
+						if (!entry->bQueued && !entry->bRunning)
+						{
+							fds.push_back({ entry->handler->GetSocket(), POLLIN, 0 });
+							watched.push_back(entry);
+						}
+					}
+				}
+
+			#ifdef _WIN32
+				int res = WSAPoll(fds.data(), static_cast<ULONG>(fds.size()), waitMs);
+			#else
+				int res = poll(fds.data(), static_cast<nfds_t>(fds.size()), waitMs);
+			#endif
+
+				if ((res == SOCKET_ERROR) && (LastError() != EINTR))
+				{
+					InitEx("Failed the poll.", LastError());
+					break;
+				}
+
+				std::lock_guard<std::mutex> lock(mutex);
+
+				if ((res > 0) && (fds[0].revents != 0))
+				{
+					waker.Drain();
+				}
+
+				for (size_t i = 1; (res > 0) && (i < fds.size()); ++i)
+				{
+					if ((fds[i].revents != 0) && !watched[i - 1]->bDetached)
+					{
+						watched[i - 1]->bReadable = true;
+						Schedule(watched[i - 1]);
+					}
+				}
+			#endif
+
+				// Every entry has a single timer, it is gone once due and set again after the run.
+				auto now = Clock::now();
+				while (!timers.empty() && (timers.begin()->first <= now))
+				{
+					auto it = entries.find(timers.begin()->second);
+					timers.erase(timers.begin());
+
+					if (it != entries.end())
+					{
+						it->second->bTimer = false;
+						Schedule(it->second);
+					}
+				}
+			}
+
+			// Nothing is going to schedule work anymore.
+			std::lock_guard<std::mutex> lock(mutex);
+			bShouldStop = true;
+			workAvailable.notify_all();
+		}
+
+		void Work()
+		{
+			std::unique_lock<std::mutex> lock(mutex);
+
+			while (true)
+			{
+				workAvailable.wait(lock, [&]() { return bShouldStop || !work.empty() || !tasks.empty(); });
+
+				// Tasks posted before stopping still run, a coroutine waiting to be resumed would hang otherwise.
+				if (!tasks.empty())
+				{
+					std::function<void()> task = std::move(tasks.front());
+					tasks.pop_front();
+
+					lock.unlock();
+					task();
+					lock.lock();
+
+					continue;
+				}
+
+				if (bShouldStop)
+				{
+					return;
+				}
+
+				std::shared_ptr<Entry> entry = work.front();
+				work.pop_front();
+
+				entry->bQueued = false;
+				if (entry->bDetached)
+				{
+					continue;
+				}
+
+				entry->bRunning = true;
+				bool bReadable = entry->bReadable;
+				entry->bReadable = false;
+
+				lock.unlock();
+
+				Handler* handler = entry->handler;
+				bool bAlive = true;
+
+				if (bReadable)
+				{
+					bAlive = handler->OnReadable();
+				}
+
+				if (bAlive && (Clock::now() >= handler->GetDeadline()))
+				{
+					bAlive = handler->OnTimer();
+				}
+
+				Clock::time_point deadline = bAlive ? handler->GetDeadline() : Clock::time_point::max();
+
+				if (!bAlive)
+				{
+				#ifdef __linux__
+					epoll_ctl(epollFd, EPOLL_CTL_DEL, handler->GetSocket(), nullptr);
+				#endif
+
+					handler->OnDetached();
+				}
+
+				lock.lock();
+
+				entry->bRunning = false;
+
+				if (!bAlive || entry->bDetached)
+				{
+					Forget(entry, bAlive);
+					runFinished.notify_all();
+					continue;
+				}
+
+				bool bEarliest = (deadline != Clock::time_point::max()) && (timers.empty() || (deadline < timers.begin()->first));
+
+				SetTimer(entry, deadline);
+
+			#ifdef __linux__
+				epoll_event event {  };
+				event.events   = EPOLLIN | EPOLLONESHOT;
+				event.data.u64 = entry->id;
+				epoll_ctl(epollFd, EPOLL_CTL_MOD, handler->GetSocket(), &event);
+			#endif
+
+				if (entry->bRerun)
+				{
+					entry->bRerun = false;
+					Schedule(entry);
+				}
+
+				// The dispatcher has to pick up an earlier deadline, and without epoll the socket to watch as well.
+			#ifdef __linux__
+				if (bEarliest)
+			#endif
+				{
+					waker.Wake();
+				}
+			}
+		}
+
+	private:
+	#ifdef _WIN32
+		typedef WSAPOLLFD PollFd;
+	#elif !defined(__linux__)
+		typedef pollfd PollFd;
+	#endif
+
+		std::mutex mutex;
+		std::condition_variable workAvailable;
+		std::condition_variable runFinished;
+
+		// Every attached handler, by entry ID and by address.
+		std::unordered_map<uint64_t, std::shared_ptr<Entry>> entries;
+		std::unordered_map<Handler*, uint64_t> ids;
+		uint64_t nextEntryID = 1;
+
+		std::deque<std::shared_ptr<Entry>> work;
+		std::deque<std::function<void()>> tasks;
+		Timers timers;
+
+		Waker waker;
+	#ifdef __linux__
+		int epollFd = SOCKET_ERROR;
+	#endif
+		bool bNetStarted = false;
+
+		// For the threads.
+		std::atomic_bool bShouldStop;
+		std::thread dispatcher;
+		std::vector<std::thread> workers;
+
+	private:
+		// Exception handling.
+		void InitEx(const std::string& _errStr, int _errCode)
+		{
+			errStr  = _errStr;
+			errCode = _errCode;
+			bExInit = true;
+		}
+
+	private:
+		// For the exception.
+		std::atomic_bool bExInit = false;
+		std::string errStr = "";
+		int errCode = 0;
+
+	public:
+		/// Misc (e.g. getters, setters, status functions etc.).
+
+		FORCEINLINE bool ErrorOccured() const { return bExInit; }
+
+		FORCEINLINE const std::string& GetErrorString() const { return errStr; }
+
+		FORCEINLINE int GetErrorCode() const { return errCode; }
+
+		FORCEINLINE size_t GetWorkerCount() const { return workers.size(); }
+	};
+}
@@ -0,0 +1,259 @@
+#pragma once
+
+/// STD
+#include <atomic>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <cstdint>
+#include <cstring>
+#include <vector>
+#include <limits>
+#include <algorithm>
+#include <exception>
+
+/// CUSTOM
+#include "UDPRDebugHeaders.h"
+#include "UDPRMisc.h"
+
+namespace UDPR
+{
+	// Reads a StreamSender's stream ahead of the requests for it, on a thread of its own. The stream is cut into chunks
+	// of RA_chunkSz, and the RA_chunkCount of them from the one holding the furthest position read so far on are kept
+	// read, so payloads asked for in order come out of memory. Anything else is read right away, as it would have been
+	// without read-ahead. Only one thread may use the stream at a time, everything else has to lock it first.
+	template<class TStream>
+	class ReadAhead
+	{
+	public:
+		static constexpr size_t RA_chunkSz = 256 * 1024;
+		static constexpr size_t RA_chunkCount = 16;
+
+	public:
+		// Starts reading at pos, and not past endPos.
+		ReadAhead(TStream* _stream, uint64_t pos, uint64_t _endPos) :
+			stream(_stream),
+			startPos(pos),
+			endPos(_endPos),
+			chunks(RA_chunkCount),
+			data(RA_chunkCount * RA_chunkSz),
+			low(pos / RA_chunkSz)
+		{
+			process = std::thread(&ReadAhead::Prefetch, this);
+		}
+
+		~ReadAhead()
+		{
+			{
+				std::lock_guard<std::mutex> lock(mutex);
+				bShouldStop = true;
+			}
+
+			wanted.notify_one();
+			process.join();
+		}
+
+		ReadAhead(const ReadAhead&) = delete;
+		ReadAhead& operator=(const ReadAhead&) = delete;
+
+		// Reads up to len bytes from pos into dst, like a seekg followed by a read would. Returns how many there were,
+		// fewer than len only at the end of the stream. Stream errors are thrown just the same.
+		size_t Read(uint64_t pos, BYTE* dst, size_t len)
+		{
+			size_t copied;
+			if (!TryCopy(pos, dst, len, copied))
+			{
+				std::lock_guard<std::mutex> lock(streamMutex);
+
+				stream->clear();
+				stream->seekg(pos);
+				stream->read(dst, static_cast<std::streamsize>(len));
+
+				copied = static_cast<size_t>(stream->gcount());
+				stream->clear();
+			}
+
+			// Whatever follows is likely asked for next.
+			const uint64_t next = (pos + len) / RA_chunkSz;
+			{
+				std::lock_guard<std::mutex> lock(mutex);
+				if (next <= low)
+				{
+					return copied;
+				}
+
+				low = next;
+			}
+
+			wanted.notify_one();
+			return copied;
+		}
+
+		// Where it was started at and what it doesn't read past.
+		FORCEINLINE uint64_t GetStartPos() const { return startPos; }
+		FORCEINLINE uint64_t GetEndPos() const { return endPos; }
+
+		// Keeps the read-ahead away from the stream while the lock is held.
+		FORCEINLINE std::unique_lock<std::mutex> LockStream()
+		{
+			return std::unique_lock<std::mutex>(streamMutex);
+		}
+
+	private:
+		enum class State : uint8_t
+		{
+			empty,
+			filling,
+			ready
+		};
+
+		struct Chunk
+		{
+			uint64_t index = 0;
+			size_t len = 0;
+			State state = State::empty;
+		};
+
+		// Copies the whole of [pos, pos + len) out of chunks already read, or nothing at all. Chunks being read are
+		// waited for, reading them again wouldn't be any faster.
+		bool TryCopy(uint64_t pos, BYTE* dst, size_t len, size_t& copied)
+		{
+			std::unique_lock<std::mutex> lock(mutex);
+
+			// Checking first, everything has to be there.
+			size_t available = 0;
+			for (uint64_t at = pos; available < len; )
+			{
+				const uint64_t index = at / RA_chunkSz;
+				if (index > endIndex)
+				{
+					break;
+				}
+
+				const Chunk& chunk = chunks[index % RA_chunkCount];
+				if ((chunk.state == State::filling) && (chunk.index == index))
+				{
+					filled.wait(lock);
+					continue;
+				}
+
+				if ((chunk.state != State::ready) || (chunk.index != index))
+				{
+					return false;
+				}
+
+				// A short chunk is the end of the stream.
+				const size_t offset = static_cast<size_t>(at - index * RA_chunkSz);
+				const size_t taken = (chunk.len > offset) ? (std::min)(chunk.len - offset, len - available) : 0;
+				available += taken;
+				at += taken;
+
+				if (chunk.len < RA_chunkSz)
+				{
+					break;
+				}
+			}
+
+			copied = 0;
+			while (copied < available)
+			{
+				const uint64_t at = pos + copied;
+				const uint64_t index = at / RA_chunkSz;
+				const size_t offset = static_cast<size_t>(at - index * RA_chunkSz);
+				const size_t taken = (std::min)(RA_chunkSz - offset, available - copied);
+
+				std::memcpy(dst + copied, data.data() + (index % RA_chunkCount) * RA_chunkSz + offset, taken);
+				copied += taken;
+			}
+
+			return true;
+		}
+
+		// The read-ahead's thread, fills the first chunk of the window that isn't read yet.
+		void Prefetch()
+		{
+			std::unique_lock<std::mutex> lock(mutex);
+			while (!bShouldStop)
+			{
+				uint64_t index = low;
+				for (; index < low + RA_chunkCount; ++index)
+				{
+					const Chunk& chunk = chunks[index % RA_chunkCount];
+					if ((chunk.state != State::ready) || (chunk.index != index))
+					{
+						break;
+					}
+				}
+
+				if ((index == low + RA_chunkCount) || (index > endIndex) || (index * RA_chunkSz >= endPos) || bFailed)
+				{
+					wanted.wait(lock);
+					continue;
+				}
+
+				// Nobody copies out of a chunk being filled, so it is filled unlocked.
+				Chunk& chunk = chunks[index % RA_chunkCount];
+				chunk.index = index;
+				chunk.state = State::filling;
+				lock.unlock();
+
+				size_t len = 0;
+				bool bRead = true;
+				try
+				{
+					std::lock_guard<std::mutex> lockStream(streamMutex);
+
+					stream->clear();
+					stream->seekg(index * RA_chunkSz);
+					stream->read(data.data() + (index % RA_chunkCount) * RA_chunkSz, static_cast<std::streamsize>(RA_chunkSz));
+
+					len = static_cast<size_t>(stream->gcount());
+					stream->clear();
+				}
+				catch (const std::exception&)
+				{
+					// Read again right away when asked for, which throws where it can be handled.
+					bRead = false;
+				}
+
+				lock.lock();
+
+				chunk.len = len;
+				chunk.state = bRead ? State::ready : State::empty;
+				bFailed = !bRead;
+
+				if (bRead && (len < RA_chunkSz))
+				{
+					endIndex = index;
+				}
+
+				filled.notify_all();
+			}
+		}
+
+	private:
+		TStream* stream;
+		std::mutex streamMutex;
+
+		// Nothing is read past it.
+		const uint64_t startPos;
+		const uint64_t endPos;
+
+		// Chunk i of the stream goes into slot i % RA_chunkCount, the slots' data back to back.
+		std::vector<Chunk> chunks;
+		std::vector<BYTE> data;
+
+		// The first chunk of the window, and the one the stream ended in once a short one was read.
+		uint64_t low;
+		uint64_t endIndex = (std::numeric_limits<uint64_t>::max)();
+
+		// Guards everything but the stream and the data of chunks being filled.
+		std::mutex mutex;
+		std::condition_variable wanted;
+		std::condition_variable filled;
+
+		bool bShouldStop = false;
+		bool bFailed = false;
+		std::thread process;
+	};
+}
@@ -0,0 +1,503 @@
+#pragma once
+
+/// STD
+#include <atomic>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <cstdint>
+#include <cstring>
+#include <vector>
+#include <string>
+#include <exception>
+#include <type_traits>
+#include <utility>
+#include <algorithm>
+
+/// CUSTOM
+#include "UDPRDebugHeaders.h"
+#include "UDPRMisc.h"
+#include "UDPRCheckpoint.h"
+#include "UDPRPacketPool.h"
+
+namespace UDPR
+{
+	/// Streams a StreamReceiver flushes before checkpointing what it wrote to them, like a std::basic_ofstream.
+	template<class TStream, class = void>
+	struct IsFlushableStream : std::false_type {};
+
+	template<class TStream>
+	struct IsFlushableStream<TStream, std::void_t<decltype(std::declval<TStream&>().flush())>> : std::true_type {};
+
+	/// Streams written at the sender's stream positions instead of one after another, like a file written with pwrite.
+	/// They have a WriteAt(const BYTE* data, size_t len, uint64_t pos), and need not be opened at any position.
+	template<class TStream, class = void>
+	struct IsPositionalStream : std::false_type {};
+
+	template<class TStream>
+	struct IsPositionalStream<TStream, std::void_t<decltype(std::declval<TStream&>().WriteAt(std::declval<const BYTE*>(),
+																							 std::declval<size_t>(),
+																							 std::declval<uint64_t>()))>> : std::true_type {};
+
+	// Payloads held by packet ID until they can be used, like those that arrived ahead of the next one to write. There
+	// is a slot for every ID of the window and a payload always lands in the same one, held in a buffer from the packet
+	// pool. Payloads already in one are shared rather than copied.
+	class ReorderBuffer
+	{
+	public:
+		// A payload held, len bytes from offset into its buffer.
+		struct Entry
+		{
+			PacketBuffer buffer;
+			size_t offset = 0;
+			size_t len = 0;
+
+			FORCEINLINE const BYTE* data() const { return buffer.data() + offset; }
+			FORCEINLINE size_t size() const { return len; }
+		};
+
+	public:
+		void Reset(size_t slotCount)
+		{
+			Clear();
+			slots.resize(slotCount);
+		}
+
+		void Clear()
+		{
+			for (Slot& slot : slots)
+			{
+				Release(slot);
+			}
+
+			erasedBefore = 0;
+		}
+
+		// id has to be within a window of the oldest ID held. Returns false if the pool is out of buffers.
+		bool Put(uint64_t id, const BYTE* data, size_t len)
+		{
+			PacketBuffer buffer = PacketPool::Acquire(len);
+			if (!buffer)
+			{
+				return false;
+			}
+
+			std::memcpy(buffer.data(), data, len);
+			Put(id, std::move(buffer), 0, len);
+
+			return true;
+		}
+
+		void Put(uint64_t id, PacketBuffer buffer, size_t offset, size_t len)
+		{
+			Slot& slot = slots[id % slots.size()];
+			slot.id = id;
+			slot.bUsed = true;
+			slot.entry.buffer = std::move(buffer);
+			slot.entry.offset = offset;
+			slot.entry.len = len;
+		}
+
+		FORCEINLINE bool Has(uint64_t id) const
+		{
+			const Slot& slot = slots[id % slots.size()];
+			return slot.bUsed && (slot.id == id);
+		}
+
+		// id has to be held.
+		FORCEINLINE const Entry& Get(uint64_t id) const
+		{
+			return slots[id % slots.size()].entry;
+		}
+
+		FORCEINLINE void Erase(uint64_t id)
+		{
+			Release(slots[id % slots.size()]);
+		}
+
+		// Drops everything past id.
+		void EraseAfter(uint64_t id)
+		{
+			for (Slot& slot : slots)
+			{
+				if (slot.bUsed && (slot.id > id))
+				{
+					Release(slot);
+				}
+			}
+		}
+
+		// Drops everything before id. Only the slots of IDs from the last call on are looked at, so ids have to grow.
+		void EraseBefore(uint64_t id)
+		{
+			const uint64_t from = (id - (std::min)(id, erasedBefore) > slots.size()) ? (id - slots.size()) : erasedBefore;
+			for (uint64_t i = from; i < id; ++i)
+			{
+				Slot& slot = slots[i % slots.size()];
+				if (slot.bUsed && (slot.id < id))
+				{
+					Release(slot);
+				}
+			}
+
+			erasedBefore = (std::max)(erasedBefore, id);
+		}
+
+	private:
+		struct Slot
+		{
+			uint64_t id = 0;
+			bool bUsed = false;
+			Entry entry;
+		};
+
+		static FORCEINLINE void Release(Slot& slot)
+		{
+			slot.bUsed = false;
+			slot.entry.buffer.Reset();
+		}
+
+		std::vector<Slot> slots;
+		uint64_t erasedBefore = 0;
+	};
+
+	// Ring between one producing and one consuming thread, neither of which ever locks. Holds Capacity - 1 entries,
+	// Push fails while it is full and Pop while it is empty.
+	template<class T, size_t Capacity>
+	class SpscQueue
+	{
+		static_assert((Capacity & (Capacity - 1)) == 0, "The capacity has to be a power of two.");
+
+	public:
+		bool Push(const T& item)
+		{
+			const size_t t = tail.load(std::memory_order_relaxed);
+			const size_t next = (t + 1) & (Capacity - 1);
+			if (next == head.load(std::memory_order_acquire))
+			{
+				return false;
+			}
+
+			items[t] = item;
+			tail.store(next, std::memory_order_release);
+			return true;
+		}
+
+		bool Pop(T& item)
+		{
+			const size_t h = head.load(std::memory_order_relaxed);
+			if (h == tail.load(std::memory_order_acquire))
+			{
+				return false;
+			}
+
+			item = items[h];
+			head.store((h + 1) & (Capacity - 1), std::memory_order_release);
+			return true;
+		}
+
+		FORCEINLINE bool IsEmpty() const
+		{
+			return head.load(std::memory_order_acquire) == tail.load(std::memory_order_acquire);
+		}
+
+	private:
+		/// Each side's index on a cache line of its own, so they don't keep taking it from each other.
+		alignas(64) std::atomic<size_t> head { 0 };
+		alignas(64) std::atomic<size_t> tail { 0 };
+		alignas(64) T items[Capacity];
+	};
+
+	// Puts a thread to sleep until another one changed something it waits for, without the other one taking a lock
+	// unless somebody actually sleeps.
+	class Notifier
+	{
+	public:
+		template<class TPredicate>
+		void Wait(TPredicate ready)
+		{
+			std::unique_lock<std::mutex> lock(mutex);
+			bWaiting.store(true);
+
+			// Pairs with the fence in Wake, either the waker sees bWaiting or we see what it changed.
+			std::atomic_thread_fence(std::memory_order_seq_cst);
+			changed.wait(lock, ready);
+
+			bWaiting.store(false);
+		}
+
+		void Wake()
+		{
+			std::atomic_thread_fence(std::memory_order_seq_cst);
+			if (bWaiting.load())
+			{
+				std::lock_guard<std::mutex> lock(mutex);
+				changed.notify_all();
+			}
+		}
+
+	private:
+		std::mutex mutex;
+		std::condition_variable changed;
+		std::atomic_bool bWaiting = false;
+	};
+
+	// Writes what a StreamReceiver hands it on a thread of its own, so a slow disk or a flush doesn't hold up receiving.
+	// Payloads are copied into chunks of WB_chunkSz, which are written whole, at their position on positional streams.
+	// Only WB_chunkCount chunks exist, whoever hands over more waits for the writer once they are all in its queue. The
+	// stream belongs to the writer until Stop returns.
+	template<class TStream>
+	class WriteBehind
+	{
+	public:
+		static constexpr size_t WB_chunkSz = 1024 * 1024;
+		static constexpr uint32_t WB_chunkCount = 8;
+
+	public:
+		// pos is where the first byte handed over goes, checkpoints are saved to checkpointPath if it isn't empty.
+		WriteBehind(TStream* _stream, uint64_t _pos, const std::string& _checkpointPath) :
+			stream(_stream),
+			checkpointPath(_checkpointPath),
+			chunks(WB_chunkCount * WB_chunkSz),
+			pos(_pos),
+			writtenPos(_pos)
+		{
+			for (uint32_t i = 0; i < WB_chunkCount; ++i)
+			{
+				free.Push(i);
+			}
+
+			process = std::thread(&WriteBehind::Write, this);
+		}
+
+		~WriteBehind()
+		{
+			Stop();
+		}
+
+		WriteBehind(const WriteBehind&) = delete;
+		WriteBehind& operator=(const WriteBehind&) = delete;
+
+		// Copies the data into the chunk being filled, returns false once writing failed.
+		bool Append(const BYTE* data, size_t len)
+		{
+			while (len > 0)
+			{
+				if (!current.bHeld && !Acquire())
+				{
+					return false;
+				}
+
+				const size_t copied = (std::min)(len, WB_chunkSz - current.len);
+				std::memcpy(chunks.data() + current.index * WB_chunkSz + current.len, data, copied);
+
+				current.len += static_cast<uint32_t>(copied);
+				pos += copied;
+				data += copied;
+				len -= copied;
+
+				// Full chunks go right away.
+				if ((current.len == WB_chunkSz) && !Submit())
+				{
+					return false;
+				}
+			}
+
+			return !bFailed.load(std::memory_order_acquire);
+		}
+
+		// Has the writer save a checkpoint once everything handed over so far is on the stream.
+		bool Checkpoint(uint64_t fingerprint)
+		{
+			if (!current.bHeld && !Acquire())
+			{
+				return false;
+			}
+
+			current.bCheckpoint = true;
+			current.fingerprint = fingerprint;
+
+			return Submit();
+		}
+
+		// Waits until everything handed over so far is on the stream, returns false if writing failed.
+		bool Drain()
+		{
+			if (current.bHeld && (current.len > 0) && !Submit())
+			{
+				return false;
+			}
+
+			drained.Wait([this]() { return (outstanding.load() == 0); });
+			return !bFailed.load(std::memory_order_acquire);
+		}
+
+		// Writes everything handed over and ends the thread.
+		void Stop()
+		{
+			if (!process.joinable())
+			{
+				return;
+			}
+
+			Drain();
+
+			bShouldStop = true;
+			submitted.Wake();
+			process.join();
+		}
+
+		FORCEINLINE bool Failed() const { return bFailed.load(std::memory_order_acquire); }
+
+		// Only set once Failed.
+		FORCEINLINE const std::string& GetErrorString() const { return errStr; }
+
+		// Everything before it is on the stream, which is also where the last checkpoint saved is.
+		FORCEINLINE uint64_t GetWrittenPos() const { return writtenPos.load(std::memory_order_acquire); }
+
+	private:
+		struct Chunk
+		{
+			uint32_t index = 0;
+			uint32_t len = 0;
+			uint64_t pos = 0;
+			bool bHeld = false;
+			bool bCheckpoint = false;
+			uint64_t fingerprint = 0;
+		};
+
+		// Takes a free chunk to fill, waiting for the writer to hand one back if there is none.
+		bool Acquire()
+		{
+			uint32_t index;
+			while (!free.Pop(index))
+			{
+				if (bFailed.load(std::memory_order_acquire))
+				{
+					return false;
+				}
+
+				drained.Wait([this]() { return !free.IsEmpty() || bFailed.load(); });
+			}
+
+			current = Chunk();
+			current.index = index;
+			current.pos = pos;
+			current.bHeld = true;
+
+			return true;
+		}
+
+		// Queues the chunk being filled, there are never more in the queue than it has room for.
+		bool Submit()
+		{
+			++outstanding;
+			filled.Push(current);
+			current.bHeld = false;
+
+			submitted.Wake();
+			return !bFailed.load(std::memory_order_acquire);
+		}
+
+		// The writer's thread.
+		void Write()
+		{
+			Chunk chunk;
+			while (true)
+			{
+				if (!filled.Pop(chunk))
+				{
+					if (bShouldStop)
+					{
+						break;
+					}
+
+					submitted.Wait([this]() { return !filled.IsEmpty() || bShouldStop; });
+					continue;
+				}
+
+				// Nothing is written past a failure, what is written has to stay contiguous.
+				if (!bFailed.load(std::memory_order_relaxed))
+				{
+					WriteChunk(chunk);
+				}
+
+				free.Push(chunk.index);
+				--outstanding;
+				drained.Wake();
+			}
+		}
+
+		void WriteChunk(const Chunk& chunk)
+		{
+			try
+			{
+				const BYTE* data = chunks.data() + chunk.index * WB_chunkSz;
+				if (chunk.len > 0)
+				{
+					if constexpr (IsPositionalStream<TStream>::value)
+					{
+						stream->WriteAt(data, chunk.len, chunk.pos);
+					}
+					else
+					{
+						stream->write(data, chunk.len);
+					}
+				}
+
+				if (chunk.bCheckpoint)
+				{
+					if constexpr (IsFlushableStream<TStream>::value)
+					{
+						stream->flush();
+					}
+				}
+			}
+			catch (const std::exception& ex)
+			{
+				Fail(std::string("Failed some stream operation with message:'") + std::string(ex.what()) + std::string("'"));
+				return;
+			}
+
+			if (chunk.bCheckpoint && !checkpointPath.empty() && !UDPR::Checkpoint{ chunk.pos + chunk.len, chunk.fingerprint }.Save(checkpointPath))
+			{
+				Fail("Failed to save the checkpoint.");
+				return;
+			}
+
+			writtenPos.store(chunk.pos + chunk.len, std::memory_order_release);
+		}
+
+		void Fail(const std::string& _errStr)
+		{
+			errStr = _errStr;
+			bFailed.store(true, std::memory_order_release);
+		}
+
+	private:
+		TStream* stream;
+		const std::string checkpointPath;
+
+		// WB_chunkCount chunks back to back. Indices of the free ones go back to the receiver, filled ones to the writer.
+		std::vector<BYTE> chunks;
+		SpscQueue<uint32_t, WB_chunkCount * 2> free;
+		SpscQueue<Chunk, WB_chunkCount * 2> filled;
+
+		// The receiver's side, the chunk being filled and where the next byte handed over goes.
+		Chunk current;
+		uint64_t pos;
+
+		// Chunks handed over and not written yet.
+		std::atomic<uint32_t> outstanding { 0 };
+		std::atomic<uint64_t> writtenPos;
+
+		Notifier submitted;
+		Notifier drained;
+
+		std::atomic_bool bShouldStop = false;
+		std::atomic_bool bFailed = false;
+		std::string errStr;
+
+		std::thread process;
+	};
+}
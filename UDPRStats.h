@@ -0,0 +1,336 @@
+#pragma once
+
+/// STD
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <cstdio>
+#include <string>
+#include <vector>
+#include <utility>
+
+/// CUSTOM
+#include "UDPRDebugHeaders.h"
+#include "UDPRMisc.h"
+
+namespace UDPR
+{
+	// A counter only its transfer's own thread adds to, anything else may read it at any time. Being the only writer,
+	// it gets by with relaxed loads and stores, which cost the I/O thread no more than a plain integer would.
+	class StatCounter
+	{
+	public:
+		FORCEINLINE void Add(uint64_t n = 1)
+		{
+			value.store(value.load(std::memory_order_relaxed) + n, std::memory_order_relaxed);
+		}
+
+		FORCEINLINE uint64_t Get() const { return value.load(std::memory_order_relaxed); }
+
+	private:
+		std::atomic<uint64_t> value { 0 };
+	};
+
+	// What a LatencyHistogram held at some point, bucket i counts samples up to 2^i microseconds, the last one anything longer.
+	struct LatencySnapshot
+	{
+		static constexpr int LATENCY_bucketCount = 24;
+
+		uint64_t buckets[LATENCY_bucketCount] = {  };
+		uint64_t sumMicros = 0;
+
+		// Microseconds, the last bucket has no bound.
+		static constexpr uint64_t GetBound(int bucket) { return static_cast<uint64_t>(1) << bucket; }
+
+		uint64_t GetCount() const
+		{
+			uint64_t count = 0;
+			for (uint64_t bucketCount : buckets)
+			{
+				count += bucketCount;
+			}
+
+			return count;
+		}
+
+		// The bound of the bucket the p-th quantile falls into, zero without samples and the maximum past the last bound.
+		std::chrono::steady_clock::duration GetQuantile(double p) const
+		{
+			const uint64_t count = GetCount();
+			if (count == 0)
+			{
+				return std::chrono::steady_clock::duration::zero();
+			}
+
+			const double rank = p * static_cast<double>(count);
+			uint64_t seen = 0;
+			for (int bucket = 0; bucket < LATENCY_bucketCount - 1; ++bucket)
+			{
+				seen += buckets[bucket];
+				if ((seen > 0) && (static_cast<double>(seen) >= rank))
+				{
+					return std::chrono::microseconds(GetBound(bucket));
+				}
+			}
+
+			return std::chrono::steady_clock::duration::max();
+		}
+
+		LatencySnapshot& operator+=(const LatencySnapshot& other)
+		{
+			for (int bucket = 0; bucket < LATENCY_bucketCount; ++bucket)
+			{
+				buckets[bucket] += other.buckets[bucket];
+			}
+
+			sumMicros += other.sumMicros;
+			return *this;
+		}
+	};
+
+	// Durations in buckets whose bounds double from a microsecond on, written by one thread like a StatCounter.
+	class LatencyHistogram
+	{
+	public:
+		static constexpr int LATENCY_bucketCount = LatencySnapshot::LATENCY_bucketCount;
+
+	public:
+		void Add(std::chrono::steady_clock::duration latency)
+		{
+			const auto micros = std::chrono::duration_cast<std::chrono::microseconds>(latency).count();
+			const uint64_t us = (micros > 0) ? static_cast<uint64_t>(micros) : 0;
+
+			int bucket = 0;
+			while ((bucket < LATENCY_bucketCount - 1) && (LatencySnapshot::GetBound(bucket) < us))
+			{
+				++bucket;
+			}
+
+			buckets[bucket].Add();
+			sumMicros.Add(us);
+		}
+
+		LatencySnapshot GetSnapshot() const
+		{
+			LatencySnapshot snapshot;
+			for (int bucket = 0; bucket < LATENCY_bucketCount; ++bucket)
+			{
+				snapshot.buckets[bucket] = buckets[bucket].Get();
+			}
+
+			snapshot.sumMicros = sumMicros.Get();
+			return snapshot;
+		}
+
+	private:
+		StatCounter buckets[LATENCY_bucketCount];
+		StatCounter sumMicros;
+	};
+
+	// What a sender or receiver counted up to some point. Counters that don't apply to one end stay zero there.
+	struct TransferStatsSnapshot
+	{
+		// Every datagram, handshakes, probes, requests and reports included. Bytes are UDP payloads.
+		uint64_t datagramsSent = 0;
+		uint64_t bytesSent = 0;
+		uint64_t datagramsReceived = 0;
+		uint64_t bytesReceived = 0;
+
+		// Payloads a pushing sender sent again, or requests a pulling receiver did.
+		uint64_t retransmits = 0;
+
+		// Payloads the receiver already had, or never asked for.
+		uint64_t duplicates = 0;
+
+		// Payloads the receiver had to park until the gap before them was filled.
+		uint64_t outOfOrder = 0;
+
+		// Retransmission timeouts that expired.
+		uint64_t timeouts = 0;
+
+		// Payloads whose checksum didn't match, and payloads rebuilt from repairs.
+		uint64_t corrupt = 0;
+		uint64_t recovered = 0;
+
+		// Time spent reading or writing the stream, which tells a transfer waiting on the disk apart from one waiting on the network.
+		uint64_t streamMicros = 0;
+
+		// Round trip samples, the ones the retransmission timeout is estimated from.
+		LatencySnapshot rtt;
+
+		TransferStatsSnapshot& operator+=(const TransferStatsSnapshot& other)
+		{
+			datagramsSent += other.datagramsSent;
+			bytesSent += other.bytesSent;
+			datagramsReceived += other.datagramsReceived;
+			bytesReceived += other.bytesReceived;
+			retransmits += other.retransmits;
+			duplicates += other.duplicates;
+			outOfOrder += other.outOfOrder;
+			timeouts += other.timeouts;
+			corrupt += other.corrupt;
+			recovered += other.recovered;
+			streamMicros += other.streamMicros;
+			rtt += other.rtt;
+
+			return *this;
+		}
+	};
+
+	// The counters a sender or receiver keeps, written by the thread it runs on, readable from any other.
+	struct TransferStats
+	{
+		StatCounter datagramsSent;
+		StatCounter bytesSent;
+		StatCounter datagramsReceived;
+		StatCounter bytesReceived;
+		StatCounter retransmits;
+		StatCounter duplicates;
+		StatCounter outOfOrder;
+		StatCounter timeouts;
+		StatCounter corrupt;
+		StatCounter recovered;
+		StatCounter streamMicros;
+		LatencyHistogram rtt;
+
+		FORCEINLINE void AddSent(uint64_t datagrams, uint64_t bytes)
+		{
+			datagramsSent.Add(datagrams);
+			bytesSent.Add(bytes);
+		}
+
+		FORCEINLINE void AddReceived(uint64_t datagrams, uint64_t bytes)
+		{
+			datagramsReceived.Add(datagrams);
+			bytesReceived.Add(bytes);
+		}
+
+		FORCEINLINE void AddStreamTime(std::chrono::steady_clock::duration time)
+		{
+			streamMicros.Add(static_cast<uint64_t>(std::chrono::duration_cast<std::chrono::microseconds>(time).count()));
+		}
+
+		// Counters are read one after another, a snapshot taken mid-transfer may be a few packets apart between them.
+		TransferStatsSnapshot GetSnapshot() const
+		{
+			TransferStatsSnapshot snapshot;
+			snapshot.datagramsSent = datagramsSent.Get();
+			snapshot.bytesSent = bytesSent.Get();
+			snapshot.datagramsReceived = datagramsReceived.Get();
+			snapshot.bytesReceived = bytesReceived.Get();
+			snapshot.retransmits = retransmits.Get();
+			snapshot.duplicates = duplicates.Get();
+			snapshot.outOfOrder = outOfOrder.Get();
+			snapshot.timeouts = timeouts.Get();
+			snapshot.corrupt = corrupt.Get();
+			snapshot.recovered = recovered.Get();
+			snapshot.streamMicros = streamMicros.Get();
+			snapshot.rtt = rtt.GetSnapshot();
+
+			return snapshot;
+		}
+	};
+
+	// Snapshots in the Prometheus text exposition format, every metric named after name (e.g. "udpr_receiver") and
+	// holding a sample per snapshot. Labels go in as they would between the braces (e.g. "peer=\"10.0.0.2\""), they
+	// have to tell the snapshots apart.
+	inline std::string ToPrometheus(const std::string& name, const std::vector<std::pair<std::string, TransferStatsSnapshot>>& snapshots)
+	{
+		std::string text;
+		char number[32];
+
+		auto appendSample = [&](const std::string& metric, const std::string& labels, const std::string& extraLabel, const char* value)
+		{
+			text += metric;
+			if (!labels.empty() || !extraLabel.empty())
+			{
+				text += '{';
+				text += labels;
+				text += (!labels.empty() && !extraLabel.empty()) ? "," : "";
+				text += extraLabel;
+				text += '}';
+			}
+
+			text += ' ';
+			text += value;
+			text += '\n';
+		};
+
+		auto appendCounter = [&](const char* suffix, const char* help, uint64_t TransferStatsSnapshot::* counter)
+		{
+			const std::string metric = name + suffix;
+			text += "# HELP " + metric + ' ' + help + '\n';
+			text += "# TYPE " + metric + " counter\n";
+
+			for (auto& [labels, snapshot] : snapshots)
+			{
+				std::snprintf(number, sizeof(number), "%llu", static_cast<unsigned long long>(snapshot.*counter));
+				appendSample(metric, labels, std::string(), number);
+			}
+		};
+
+		appendCounter("_datagrams_sent_total", "Datagrams sent.", &TransferStatsSnapshot::datagramsSent);
+		appendCounter("_bytes_sent_total", "UDP payload bytes sent.", &TransferStatsSnapshot::bytesSent);
+		appendCounter("_datagrams_received_total", "Datagrams received.", &TransferStatsSnapshot::datagramsReceived);
+		appendCounter("_bytes_received_total", "UDP payload bytes received.", &TransferStatsSnapshot::bytesReceived);
+		appendCounter("_retransmits_total", "Payloads or requests sent again.", &TransferStatsSnapshot::retransmits);
+		appendCounter("_duplicates_total", "Payloads received that were already there or never asked for.", &TransferStatsSnapshot::duplicates);
+		appendCounter("_out_of_order_total", "Payloads parked until the gap before them was filled.", &TransferStatsSnapshot::outOfOrder);
+		appendCounter("_timeouts_total", "Retransmission timeouts that expired.", &TransferStatsSnapshot::timeouts);
+		appendCounter("_corrupt_total", "Payloads dropped for a checksum mismatch.", &TransferStatsSnapshot::corrupt);
+		appendCounter("_recovered_total", "Payloads rebuilt from repairs.", &TransferStatsSnapshot::recovered);
+
+		{
+			const std::string metric = name + "_stream_seconds_total";
+			text += "# HELP " + metric + " Time spent reading or writing the stream.\n";
+			text += "# TYPE " + metric + " counter\n";
+
+			for (auto& [labels, snapshot] : snapshots)
+			{
+				std::snprintf(number, sizeof(number), "%.6f", static_cast<double>(snapshot.streamMicros) / 1e6);
+				appendSample(metric, labels, std::string(), number);
+			}
+		}
+
+		{
+			const std::string metric = name + "_rtt_seconds";
+			text += "# HELP " + metric + " Round trip samples.\n";
+			text += "# TYPE " + metric + " histogram\n";
+
+			for (auto& [labels, snapshot] : snapshots)
+			{
+				uint64_t cumulative = 0;
+				for (int bucket = 0; bucket < LatencySnapshot::LATENCY_bucketCount; ++bucket)
+				{
+					cumulative += snapshot.rtt.buckets[bucket];
+
+					char bound[48];
+					if (bucket < LatencySnapshot::LATENCY_bucketCount - 1)
+					{
+						std::snprintf(bound, sizeof(bound), "le=\"%.9g\"", static_cast<double>(LatencySnapshot::GetBound(bucket)) / 1e6);
+					}
+					else
+					{
+						std::snprintf(bound, sizeof(bound), "le=\"+Inf\"");
+					}
+
+					std::snprintf(number, sizeof(number), "%llu", static_cast<unsigned long long>(cumulative));
+					appendSample(metric + "_bucket", labels, bound, number);
+				}
+
+				std::snprintf(number, sizeof(number), "%.6f", static_cast<double>(snapshot.rtt.sumMicros) / 1e6);
+				appendSample(metric + "_sum", labels, std::string(), number);
+
+				std::snprintf(number, sizeof(number), "%llu", static_cast<unsigned long long>(cumulative));
+				appendSample(metric + "_count", labels, std::string(), number);
+			}
+		}
+
+		return text;
+	}
+
+	inline std::string ToPrometheus(const std::string& name, const TransferStatsSnapshot& snapshot, const std::string& labels = std::string())
+	{
+		return ToPrometheus(name, { { labels, snapshot } });
+	}
+}
@@ -3,336 +3,1945 @@
 /// STD
 #include <memory>
 #include <thread>
+#include <mutex>
 #include <atomic>
 #include <cstdint>
 #include <vector>
 #include <cstring>
 #include <string>
-
-/// WINDOWS
-#include <WinSock2.h>
+#include <map>
+#include <chrono>
+#include <limits>
+#include <algorithm>
+#include <functional>
+#include <type_traits>
 
 /// CUSTOM
 #include "UDPRDebugHeaders.h"
 #include "UDPRMisc.h"
+#include "UDPRWire.h"
+#include "UDPRReactor.h"
 #include "UDPRStreamSender.h"
+#include "UDPRCongestion.h"
+#include "UDPRCheckpoint.h"
+#include "UDPRFec.h"
+#include "UDPRLz.h"
+#include "UDPRCrc.h"
+#include "UDPRReassembly.h"
+#include "UDPRStats.h"
+#include "UDPRTrace.h"
+#include "UDPRCoroutine.h"
 
 namespace UDPR
 {
+	/// Optional behaviour of a StreamReceiver, everything is off by default.
+	struct ReceiverOptions
+	{
+		// Lets the kernel hand over runs of same-size payloads in a single read (UDP_GRO, Linux only).
+		// Falls back to one datagram per read wherever that isn't supported.
+		bool bCoalescing = false;
+
+		// Receives only [rangeBegin, rangeEnd) of the sender's stream, the stream handed to the receiver is written
+		// from rangeBegin on. Anything but the whole stream needs a sender that serves ranges.
+		uint64_t rangeBegin = 0;
+		uint64_t rangeEnd = (std::numeric_limits<uint64_t>::max)();
+
+		// Called once with the size of the sender's stream, from whichever thread runs the receiver. Asking for it
+		// needs a sender that serves ranges too, streams which can't tell their size come up as the maximum.
+		std::function<void(uint64_t)> onStreamSize;
+
+		// Saves a Checkpoint there every checkpointInterval bytes and whenever the receiver stops early, and removes it
+		// once the stream is complete. A receiver started with a checkpoint there resumes from it, as long as the
+		// sender's stream still has the same fingerprint, so its stream has to be opened at the checkpoint's position.
+		std::string checkpointPath;
+		uint64_t checkpointInterval = 64 * 1024 * 1024;
+
+		// Asks a pushing sender for repair packets, lost payloads they cover are rebuilt instead of asked for again.
+		// Costs a copy of every payload until its group is complete. Senders without repairs ignore it.
+		bool bFec = false;
+
+		// Asks the sender to compress every packet's block of the stream, worth it for text like logs or JSON whenever
+		// the network is slower than decompressing. Senders that don't compress ignore it.
+		bool bCompression = false;
+
+		// Asks the sender to checksum every payload, those that don't match are dropped and asked for again. Once
+		// everything arrived, the sender's digest of the stream has to match what was written before the receiver
+		// counts as complete. Senders that don't checksum ignore it.
+		bool bChecksums = false;
+
+		// Writes to the stream on a thread of its own (see WriteBehind), which also flushes it and saves checkpoints.
+		// Receiving then goes on while the stream is slow to take what arrived. Positional streams (see
+		// IsPositionalStream) are written at the sender's positions either way.
+		bool bWriteBehind = false;
+
+		// Called once the receiver is done, complete, failed or stopped, from whichever thread finished it. The
+		// receiver may be stopped from there but not destroyed, that has to wait for the call to return.
+		std::function<void()> onFinished;
+	};
+
 	template<class TStream>
-	class StreamReceiver
+	class StreamReceiver : private Reactor::Handler
 	{
+		using Clock = Reactor::Clock;
+
+		enum class State : uint8_t
+		{
+			handshaking,
+			streaming,
+			verifying
+		};
+
+		/// A request (see WireRequest).
+		static constexpr int REQ_size = WireRequest::size;
+
+		/// Largest probe that can arrive while handshaking.
+		static constexpr int PROBE_maxSz = 65535;
+
+		/// Timeouts in a row without a single payload after which the path is assumed to have shrunk, it is probed
+		/// again and the transfer resumes from what has been written.
+		static constexpr int PMTU_blackHoleTimeouts = 3;
+
+		/// Answers to later requests after which an unanswered request is sent again without waiting for its timeout.
+		static constexpr uint8_t FAST_retransmitThreshold = 3;
+
 	public:
-		StreamReceiver(TStream* _stream, const SOCKADDR_IN& _peerAddr, const timeval& _timeout = { 0, 500 * 1000 }) :
-			peer(INVALID_SOCKET),
-			peerAddr { _peerAddr },
-			packet {  },
-			timeout(_timeout),
-			packetID(0ULL),
-			pos(0ULL),
-			stream(_stream),
-			bShouldStop(false),
-			bFinished(false),
-			process(&StreamReceiver::Receive, this)
+		StreamReceiver(TStream* _stream, const SOCKADDR_IN& _peerAddr, const timeval& _timeout = { 0, 500 * 1000 }, uint16_t _windowSz = 32,
+					   TransferMode _mode = TransferMode::pull, const ReceiverOptions& _options = ReceiverOptions()) :
+			StreamReceiver(nullptr, _stream, _peerAddr, _timeout, _windowSz, _mode, _options)
+		{
+			StartProcess();
+		}
+
+		// Driven by the reactor's threads instead of a thread of its own.
+		StreamReceiver(Reactor& _reactor, TStream* _stream, const SOCKADDR_IN& _peerAddr, const timeval& _timeout = { 0, 500 * 1000 }, 
+					   uint16_t _windowSz = 32, TransferMode _mode = TransferMode::pull, const ReceiverOptions& _options = ReceiverOptions()) :
+			StreamReceiver(&_reactor, _stream, _peerAddr, _timeout, _windowSz, _mode, _options)
 		{
+			if (int err; (err = NetStartup()) != 0)
+			{
+				InitEx("Failed the startup.", err);
+				MarkFinished();
+				return;
+			}
+
+			if (!Open() || !reactor->Attach(this))
+			{
+				if (!bExInit)
+				{
+					InitEx("Failed to attach to the reactor.", -1);
+				}
+
+				Finish();
+			}
 		}
 
 		~StreamReceiver()
 		{
 			Stop();
+
+			waker.Close();
+			if (bWakerNetStarted)
+			{
+				NetCleanup();
+			}
 		}
 
+		// Returns once the receiver stopped, which is right away however long the timeout is.
 		void Stop()
 		{
+			// Called from onFinished, the thread or worker that finished is on its way out already and can't wait on itself.
+			if (IsFinishingThread())
+			{
+				return;
+			}
+
 			if (process.joinable())
 			{
 				bShouldStop = true;
+				waker.Wake();
 				process.join();
 				bShouldStop = false;
 			}
+			else if (reactor != nullptr)
+			{
+				reactor->Detach(this);
+				Finish();
+			}
+		}
+
+		// Asks the receiver to stop without waiting for it, onFinished is called once it did.
+		void RequestStop()
+		{
+			bShouldStop = true;
+
+			if (reactor != nullptr)
+			{
+				reactor->Wake(this);
+			}
+			else
+			{
+				waker.Wake();
+			}
+		}
+
+	private:
+		StreamReceiver(Reactor* _reactor, TStream* _stream, const SOCKADDR_IN& _peerAddr, const timeval& _timeout, uint16_t _windowSz,
+					   TransferMode _mode, const ReceiverOptions& _options) :
+			peer(INVALID_SOCKET),
+			peerAddr { _peerAddr },
+			packet {  },
+			inbox(BATCH_maxDatagrams),
+			packetSz(0),
+			requests(BATCH_maxDatagrams * REQ_size),
+			outbox(BATCH_maxDatagrams),
+			queued(0),
+			timeout(_timeout),
+			packetID(0ULL),
+			pos(_options.rangeBegin),
+			windowSz((std::max)(_windowSz, static_cast<uint16_t>(1))),
+			nextID(0ULL),
+			lastID((std::numeric_limits<uint64_t>::max)()),
+			mode(_mode),
+			options(_options),
+			basePos(_options.rangeBegin),
+			rtt(ToDuration(_timeout)),
+			stream(_stream),
+			reactor(_reactor),
+			bShouldStop(false),
+			bFinished(false)
+		{
+			checkpointedPos = pos;
+
+			// Only checkpoints within the range are ours.
+			Checkpoint checkpoint;
+			if (!options.checkpointPath.empty() && Checkpoint::Load(options.checkpointPath, checkpoint) &&
+				(checkpoint.pos >= options.rangeBegin) && (checkpoint.pos <= options.rangeEnd))
+			{
+				pos = basePos = checkpointedPos = checkpoint.pos;
+				fingerprint = checkpoint.fingerprint;
+				bFingerprint = bResumingCheckpoint = true;
+			}
+
+			digestFrom = pos;
+
+			// The sizer of a striped receiver has no stream.
+			if (options.bWriteBehind && (stream != nullptr))
+			{
+				writer.reset(new WriteBehind<TStream>(stream.get(), pos, options.checkpointPath));
+			}
+		}
+
+		// The waker is opened before the thread starts so Stop can always wake it. Without one, Stop waits for the
+		// thread to notice within a timeout, as it would without the waker.
+		void StartProcess()
+		{
+			if (NetStartup() == 0)
+			{
+				bWakerNetStarted = true;
+				waker.Open();
+			}
+
+			process = std::thread(&StreamReceiver::Receive, this);
+		}
+
+		void Receive()
+		{
+			if (int err; (err = NetStartup()) != 0)
+			{
+				InitEx("Failed the startup.", err);
+				MarkFinished();
+				return;
+			}
+			
+			if (Open())
+			{
+				// The same steps the reactor takes, waiting on the socket in between.
+				while (!bShouldStop && !bExInit)
+				{
+					if (DataAvailable(peer, waker, TimeUntil(GetDeadline(), timeout), this))
+					{
+						if (!OnReadable()) { break; }
+					}
+					else if (bExInit)
+					{
+						break;
+					}
+
+					if ((Clock::now() >= GetDeadline()) && !OnTimer()) { break; }
+				}
+			}
+
+			Finish();
+		}
+
+	private:
+		void Cleanup()
+		{
+			if (stream.get() != nullptr)
+			{
+				delete stream.release();
+			}
+
+			if (peer != INVALID_SOCKET)
+			{
+				CloseSocket(peer);
+				peer = INVALID_SOCKET;
+			}
+		}
+
+		// Runs once, whichever of the thread, the reactor or Stop gets here first.
+		void Finish()
+		{
+			if (bCleanedUp.exchange(true))
+			{
+				return;
+			}
+
+			// Whatever the writer still has goes out first. Where it failed is as far as the stream got.
+			uint64_t writtenPos = pos;
+			if (writer != nullptr)
+			{
+				writer->Stop();
+				writtenPos = writer->GetWrittenPos();
+				checkpointedPos = (writtenPos < pos) ? writtenPos : checkpointedPos;
+
+				if (writer->Failed() && !bExInit)
+				{
+					InitEx(writer->GetErrorString(), -1);
+				}
+			}
+
+			Cleanup();
+
+			// The stream is closed by now, so everything written is in it.
+			if (!options.checkpointPath.empty() && bFingerprint)
+			{
+				if (bComplete)
+				{
+					Checkpoint::Remove(options.checkpointPath);
+				}
+				else if ((writtenPos != checkpointedPos) && !Checkpoint{ writtenPos, fingerprint }.Save(options.checkpointPath) && !bExInit)
+				{
+					InitEx("Failed to save the checkpoint.", -1);
+				}
+			}
+
+			NetCleanup();
+
+			MarkFinished();
+		}
+
+		// Calls back whoever waits for the finish, once.
+		void MarkFinished()
+		{
+			std::function<void()> callback;
+			{
+				std::lock_guard<std::mutex> lock(finishMutex);
+				bFinished = true;
+				finishingThread = std::this_thread::get_id();
+				callback = std::move(onceFinished);
+			}
+
+			if (options.onFinished)
+			{
+				options.onFinished();
+			}
+
+			if (callback)
+			{
+				callback();
+			}
+		}
+
+		bool IsFinishingThread()
+		{
+			std::lock_guard<std::mutex> lock(finishMutex);
+			return finishingThread == std::this_thread::get_id();
+		}
+
+		// Calls back from whichever thread finishes, returns false without calling back if that already happened.
+		bool CallOnceFinished(std::function<void()> callback)
+		{
+			std::lock_guard<std::mutex> lock(finishMutex);
+			if (bFinished)
+			{
+				return false;
+			}
+
+			onceFinished = std::move(callback);
+			return true;
+		}
+
+		template<class TTransfer>
+		friend class FinishedAwaitable;
+
+		template<class T>
+		friend bool UDPR::DataAvailable(SOCKET sock, const timeval& timeout, T* owner);
+
+		template<class T>
+		friend bool UDPR::DataAvailable(SOCKET sock, Waker& waker, const timeval& timeout, T* owner);
+
+		template<class T>
+		friend bool UDPR::WaitForRoom(SOCKET sock, T* owner, const std::atomic_bool& bShouldStop);
+
+		template<class T>
+		friend bool UDPR::WaitForData(SOCKET sock, const timeval& timeout, T* owner,
+									  const std::atomic_bool& bShouldStop, const std::atomic_bool& bExInit);
+
+		template<class T>
+		friend bool UDPR::ReceiveData(SOCKET sock, const timeval& timeout, T* owner,
+									  const std::atomic_bool& bShouldStop, const std::atomic_bool& bExInit,
+									  char* data, int len, int flags, sockaddr* from, int* fromlen, int* packetLen);
+
+		template<class T>
+		friend bool UDPR::SendData(SOCKET sock, T* owner,
+								   const std::atomic_bool& bShouldStop, const char* data, int len, 
+								   int flags, const sockaddr* to, int tolen);
+
+		template<class T>
+		friend bool UDPR::SendDataGather(SOCKET sock, T* owner,
+										 const std::atomic_bool& bShouldStop, const Datagram& datagram, int flags);
+
+		template<class T>
+		friend bool UDPR::SendDataBatch(SOCKET sock, T* owner,
+										const std::atomic_bool& bShouldStop, const Datagram* datagrams, int count, int flags,
+										bool* bSegmentation);
+
+		template<class T>
+		friend bool UDPR::ReceiveDataBatch(SOCKET sock, const timeval& timeout, T* owner,
+										   const std::atomic_bool& bShouldStop, const std::atomic_bool& bExInit,
+										   Datagram* datagrams, int count, int flags, int* received);
+
+		template<class T>
+		friend bool UDPR::ReceiveDataCoalesced(SOCKET sock, const timeval& timeout, T* owner,
+											   const std::atomic_bool& bShouldStop, const std::atomic_bool& bExInit,
+											   char* buffers, int bufferSz, int bufferCount, Datagram* datagrams, int flags, int* received,
+											   bool* bDrained);
+
+	private:
+		/// Reactor::Handler.
+
+		SOCKET GetSocket() const override
+		{
+			return peer;
+		}
+
+		Clock::time_point GetDeadline() const override
+		{
+			// Due right away once asked to stop, OnTimer then lets go of the receiver.
+			if (bShouldStop)
+			{
+				return Clock::time_point::min();
+			}
+
+			if (state == State::handshaking)
+			{
+				// Resending the handshake until the sender answers.
+				return handshakeAt + rtt.GetRto();
+			}
+
+			if (state == State::verifying)
+			{
+				// Asking for the digest again until the sender answers.
+				return digestAt + rtt.GetRto();
+			}
+
+			if (mode == TransferMode::push)
+			{
+				// Reporting again once nothing arrived for a whole timeout, or once gaps held back for repairs are due.
+				Clock::time_point idleAt = lastActivityAt + rtt.GetRto();
+				return (fecHeldAt != Clock::time_point()) ? (std::min)(idleAt, fecHeldAt + GetFecHoldTime()) : idleAt;
+			}
+
+			// The oldest unanswered request is due for a retransmission first.
+			Clock::time_point oldest = Clock::time_point::max();
+			for (auto& [reqID, req] : pending)
+			{
+				oldest = (std::min)(oldest, req.sentAt);
+			}
+
+			return (oldest == Clock::time_point::max()) ? oldest : (oldest + rtt.GetRto());
+		}
+
+		bool OnReadable() override
+		{
+			if (bShouldStop)
+			{
+				return false;
+			}
+
+			// A reactor may report a socket an earlier run already drained, waiting on it would hold the worker.
+			const timeval noWait = { 0, 0 };
+			if (!DataAvailable(peer, noWait, this))
+			{
+				return !bExInit;
+			}
+
+			if (state == State::handshaking)
+			{
+				// Probes come in bursts ahead of the handshake, all of them are answered right away. Once stopping nothing
+				// is read anymore, so whatever is still waiting can't hold the loop.
+				bool bHandshake;
+				while (!(bHandshake = ReceiveHandshake()) && !bExInit && !bShouldStop && DataAvailable(peer, noWait, this));
+
+				if (!bHandshake)
+				{
+					return !bExInit;
+				}
+
+				state = State::streaming;
+				stalledTimeouts = 0;
+				lastActivityAt = Clock::now();
+
+				// The handshake makes for the first sample, unless it had to be resent or waited for probes.
+				if (!bHandshakeUntimed)
+				{
+					AddRttSample(lastActivityAt - handshakeAt);
+				}
+
+				// Only the first handshake tells, reprobes would repeat it.
+				if (options.onStreamSize && !bStreamSzTold)
+				{
+					bStreamSzTold = true;
+					options.onStreamSize(streamSz.load(std::memory_order_relaxed));
+				}
+
+				// An empty range is complete as soon as the sender answered.
+				if (pos >= options.rangeEnd)
+				{
+					bComplete = true;
+					return false;
+				}
+
+				// Telling a pushing sender we are ready, this also acknowledges its handshake.
+				return (mode == TransferMode::push) ? SendReport() : RequestMore();
+			}
+
+			if (state == State::verifying)
+			{
+				return ReceiveDigest();
+			}
+
+			int received;
+			if (!ReceivePayloads(received))
+			{
+				return !bExInit;
+			}
+
+			lastActivityAt = Clock::now();
+			stalledTimeouts = (received > 0) ? 0 : stalledTimeouts;
+
+			return (mode == TransferMode::push) ? AcceptPushed(received) : AcceptRequested(received);
+		}
+
+		bool OnTimer() override
+		{
+			if (bShouldStop)
+			{
+				return false;
+			}
+
+			if (state == State::handshaking)
+			{
+				RecordTimeout();
+				rtt.Backoff();
+				bHandshakeUntimed = true;
+
+				return SendHandshake();
+			}
+
+			if (state == State::verifying)
+			{
+				RecordTimeout();
+				rtt.Backoff();
+				return RequestDigest();
+			}
+
+			// Repairs that would have rebuilt the gaps held back got lost too, which doesn't make the transfer stall.
+			if ((mode == TransferMode::push) && (fecHeldAt != Clock::time_point()) && (Clock::now() < lastActivityAt + rtt.GetRto()))
+			{
+				return SendReport();
+			}
+
+			RecordTimeout();
+
+			// Only a sender that resumes can be asked to probe again.
+			if ((++stalledTimeouts >= PMTU_blackHoleTimeouts) && bResumes)
+			{
+				return Reprobe();
+			}
+
+			if (mode == TransferMode::push)
+			{
+				// Nothing arrived for a whole timeout, the tail or our last report got lost. Repairs aren't coming either.
+				rtt.Backoff();
+				lastActivityAt = Clock::now();
+				return SendReport(true);
+			}
+
+			// Re-sending the requests which timed out, the backed off timeout only applies to what is sent from now on.
+			auto now = Clock::now();
+			Clock::duration rto = rtt.GetRto();
+			rtt.Backoff();
+
+			for (auto& [reqID, req] : pending)
+			{
+				if (now - req.sentAt >= rto)
+				{
+					if (!QueueRequest(reqID, req.pos))
+					{
+						return false;
+					}
+
+					req.sentAt = now;
+					req.bResent = true;
+					stats.retransmits.Add();
+					Tracer::Record(TraceEventType::retransmit, traceID, reqID, req.pos);
+				}
+			}
+
+			return FlushRequests();
+		}
+
+		void OnDetached() override
+		{
+			Finish();
+		}
+
+	private:
+		// Creating the socket and starting the handshake.
+		bool Open()
+		{
+			if ((peer = socket(AF_INET, SOCK_DGRAM, IPPROTO_UDP)) == INVALID_SOCKET)
+			{
+				InitEx("Failed the socket.", LastError());
+				return false;
+			}
+
+			bCoalescing = options.bCoalescing && EnableCoalescing(peer);
+
+			packet.resize(PROBE_maxSz);
+
+			Tracer::Record(TraceEventType::receiverOpened, traceID, 0, ntohs(peerAddr.sin_port));
+
+			bHandshakeUntimed = false;
+			return SendHandshake();
+		}
+
+		// Starts over from what has been written, with a handshake that asks the sender to probe the path again.
+		bool Reprobe()
+		{
+			basePos = pos;
+			packetID = 0;
+			nextID = 0;
+			lastID = (std::numeric_limits<uint64_t>::max)();
+			pending.clear();
+			reorder.Clear();
+			fecData.Clear();
+			fecRepairs.clear();
+			fecCoveredID = 0;
+			horizon = 0;
+			sinceReport = 0;
+			stalledTimeouts = 0;
+
+			if (packet.size() < PROBE_maxSz)
+			{
+				packet.resize(PROBE_maxSz);
+			}
+
+			bReprobe = true;
+			bHandshakeUntimed = false;
+			return SendHandshake();
+		}
+
+		// Set if the sender has to end the transfer early, or tell how large the stream is.
+		FORCEINLINE bool IsRanged() const
+		{
+			return (options.rangeEnd != (std::numeric_limits<uint64_t>::max)()) || static_cast<bool>(options.onStreamSize);
+		}
+
+		// Sends the handshake once, the timer sends it again until the sender answers.
+		bool SendHandshake()
+		{
+			uint8_t flags = StreamSender<class T>::HS_probes | (bReprobe ? StreamSender<class T>::HS_reprobe : 0) |
+							(IsRanged() ? StreamSender<class T>::HS_range : 0) |
+							(!options.checkpointPath.empty() ? StreamSender<class T>::HS_fingerprint : 0) |
+							(options.bFec ? StreamSender<class T>::HS_fec : 0) |
+							(options.bCompression ? StreamSender<class T>::HS_compress : 0) |
+							(options.bChecksums ? StreamSender<class T>::HS_checksum : 0);
+
+			// The position to end at if a range is asked for, then the wire version.
+			BYTE data[WireHandshake::size + sizeof(uint64_t) + sizeof(uint8_t)];
+			WireHandshake::Write(data, StreamSender<class T>::INM_handshake, static_cast<uint8_t>(mode), windowSz, flags, basePos);
+
+			WireWriter tail(data, WireHandshake::size);
+			if (IsRanged())
+			{
+				tail.Write(options.rangeEnd);
+			}
+
+			tail.Write(WIRE_version);
+			const int dataLen = tail.GetLength();
+
+			state = State::handshaking;
+			handshakeAt = Clock::now();
+
+			stats.AddSent(1, dataLen);
+			Tracer::Record(TraceEventType::handshakeSent, traceID, 0, basePos);
+			return SendData(peer, this, bShouldStop, reinterpret_cast<const char*>(data),
+							dataLen, NULL, reinterpret_cast<const sockaddr*>(&peerAddr), sizeof(peerAddr));
+		}
+
+		// Returns false if the datagram isn't the sender's handshake, probes are answered on the way.
+		bool ReceiveHandshake()
+		{
+			SOCKADDR_IN from;
+			ZeroMemory(&from, sizeof(from));
+
+			int fromlen = sizeof(from);
+
+			// Probes may be as large as anything the sender tries, the packet buffer has room for them until the handshake.
+			BYTE* data = packet.data();
+			int dataLen;
+
+			if (!ReceiveData(peer, timeout, this, bShouldStop, bExInit, 
+							 reinterpret_cast<char*>(data), (int) packet.size(), NULL, 
+							 reinterpret_cast<sockaddr*>(&from), &fromlen, &dataLen))
+			{
+				return false;
+			}
+
+			stats.AddReceived(1, dataLen);
+
+			if (!SameAddress(from, peerAddr) || (dataLen < (int) sizeof(uint8_t)))
+			{
+				return false;
+			}
+
+			const uint8_t msgType = WireHandshakeAnswer::Get<WireHandshakeAnswer::type>(data);
+			if (msgType == StreamSender<class T>::OUTM_probe)
+			{
+				// Probing holds the handshake back, it can't be timed anymore.
+				bHandshakeUntimed = true;
+				SendProbeAck(dataLen);
+				return false;
+			}
+
+			// Payloads still in flight from before a reprobe are dropped.
+			if (msgType != StreamSender<class T>::OUTM_handshake)
+			{
+				return false;
+			}
+
+			if (dataLen < (int) WireHandshakeAnswer::end<WireHandshakeAnswer::packetSz>)
+			{
+				InitEx("Invalid handshake.", -1);
+				return false;
+			}
+
+			packetSz = WireHandshakeAnswer::Get<WireHandshakeAnswer::packetSz>(data);
+			if (packetSz < WirePayload::size)
+			{
+				InitEx("Invalid handshake.", -1);
+				return false;
+			}
+
+			// Senders which don't negotiate only serve requests.
+			uint8_t accepted = static_cast<uint8_t>(TransferMode::pull);
+			if (dataLen >= (int) WireHandshakeAnswer::end<WireHandshakeAnswer::mode>)
+			{
+				accepted = WireHandshakeAnswer::Get<WireHandshakeAnswer::mode>(data);
+			}
+
+			mode = (accepted == static_cast<uint8_t>(TransferMode::push)) ? TransferMode::push : TransferMode::pull;
+
+			// Senders which don't send flags start at the beginning of the stream, and can't be asked otherwise.
+			uint8_t flags = 0;
+			if (dataLen >= (int) WireHandshakeAnswer::end<WireHandshakeAnswer::flags>)
+			{
+				flags = WireHandshakeAnswer::Get<WireHandshakeAnswer::flags>(data);
+			}
+
+			bResumes = (flags & StreamSender<class T>::HS_resume) != 0;
+			bCompressed = options.bCompression && (flags & StreamSender<class T>::HS_compress);
+			bChecksummed = options.bChecksums && (flags & StreamSender<class T>::HS_checksum);
+
+			if ((bCompressed || bChecksummed) && (packetSz <= GetPayloadHeaderSize()))
+			{
+				InitEx("Invalid handshake.", -1);
+				return false;
+			}
+
+			if ((basePos != 0) && !bResumes)
+			{
+				InitEx("The sender can't resume.", -1);
+				return false;
+			}
+
+			// Whatever the flags call for follows them, in this order, then the wire version.
+			WireReader tail(data, dataLen, WireHandshakeAnswer::size);
+
+			uint64_t senderStreamSz = 0, senderFingerprint = 0;
+			uint8_t groupSz = 0;
+			const bool bStreamSz = (flags & StreamSender<class T>::HS_range) && tail.Read(senderStreamSz);
+			const bool bFingerprint = (flags & StreamSender<class T>::HS_fingerprint) && tail.Read(senderFingerprint);
+			if (flags & StreamSender<class T>::HS_fec)
+			{
+				tail.Read(groupSz);
+			}
+
+			// Senders from before the version leave it out.
+			version = 0;
+			tail.Read(version);
+			version = (std::min)(version, WIRE_version);
+
+			if (IsRanged() && !bStreamSz)
+			{
+				InitEx("The sender can't serve ranges.", -1);
+				return false;
+			}
+
+			if (IsRanged())
+			{
+				streamSz.store(senderStreamSz, std::memory_order_relaxed);
+			}
+
+			if (!options.checkpointPath.empty() && !ReceiveFingerprint(bFingerprint, senderFingerprint))
+			{
+				return false;
+			}
+
+			if (!ReceiveFecGroupSize(flags, groupSz))
+			{
+				return false;
+			}
+
+			// A whole window has to fit into the socket buffer, larger packets than before may have been settled on.
+			GrowSocketBuffer(peer, SO_RCVBUF, 2 * windowSz * GetSlotSize());
+
+			// Buffers only ever grow, handshaking again doesn't allocate them anew.
+			if (bCoalescing)
+			{
+				packet.resize(GRO_maxBuffers * GRO_bufferSz);
+				inbox.resize(GRO_maxBuffers * GSO_maxSegments);
+			}
+			else
+			{
+				packet.resize(BATCH_maxDatagrams * GetSlotSize());
+			}
+
+			block.resize(bCompressed ? GetBlockSize() : 0);
+			reorder.Reset(windowSz);
+
+			// Groups reach back at most their size from the packet being written.
+			fecData.Reset(windowSz + fecGroupSz);
+
+			bReprobe = false;
+
+			return true;
+		}
+
+		// Takes the fingerprint from the sender's handshake, a checkpoint can only be resumed from if it is the same.
+		bool ReceiveFingerprint(bool bSent, uint64_t senderFingerprint)
+		{
+			if (!bSent)
+			{
+				InitEx("The sender can't fingerprint its stream.", -1);
+				return false;
+			}
+
+			if (bResumingCheckpoint && (senderFingerprint != fingerprint))
+			{
+				InitEx("The sender's stream changed since the checkpoint.", -1);
+				return false;
+			}
+
+			fingerprint = senderFingerprint;
+			bFingerprint = true;
+
+			return true;
+		}
+
+		// Takes the size of a repair group from the sender's handshake, zero if it didn't send one.
+		bool ReceiveFecGroupSize(uint8_t flags, uint8_t groupSz)
+		{
+			fecGroupSz = 0;
+			fecData.Clear();
+			fecRepairs.clear();
+			fecCoveredID = 0;
+			fecHeldAt = Clock::time_point();
+			fecRecovered = 0;
+
+			if (!(flags & StreamSender<class T>::HS_fec))
+			{
+				return true;
+			}
+
+			if ((groupSz < 2) || (groupSz > FecCodec::FEC_maxGroupSz) || (packetSz <= StreamSender<class T>::REPAIR_headerSz))
+			{
+				InitEx("Invalid handshake.", -1);
+				return false;
+			}
+
+			fecGroupSz = groupSz;
+			return true;
+		}
+
+		// Where a payload's body starts, past the header and the checksum if the sender agreed to one.
+		FORCEINLINE uint16_t GetBodyOffset() const
+		{
+			return static_cast<uint16_t>(bChecksummed ? WireChecksummedPayload::size : WirePayload::size);
+		}
+
+		// The payload header, and the byte that tells how the block is encoded if the sender agreed to compress.
+		FORCEINLINE uint16_t GetPayloadHeaderSize() const
+		{
+			return static_cast<uint16_t>(GetBodyOffset() + (bCompressed ? WireBlock::end<WireBlock::encoding> : 0));
+		}
+
+		// Bytes of the stream every full payload carries.
+		FORCEINLINE uint16_t GetBlockSize() const
+		{
+			return packetSz - GetPayloadHeaderSize();
+		}
+
+		// Repairs are larger than payloads by the part of their header the payload header doesn't have.
+		FORCEINLINE uint16_t GetSlotSize() const
+		{
+			return packetSz + ((fecGroupSz > 0) ? StreamSender<class T>::FEC_repairExtra : 0);
+		}
+
+		// Tells the sender how large a probe arrived.
+		bool SendProbeAck(int probeLen)
+		{
+			uint16_t probeSz = static_cast<uint16_t>(probeLen);
+
+			BYTE data[WireProbe::size];
+			WireProbe::Write(data, StreamSender<class T>::INM_probeAck, probeSz);
+
+			stats.AddSent(1, sizeof(data));
+			return SendData(peer, this, bShouldStop, reinterpret_cast<const char*>(data),
+							sizeof(data), NULL, reinterpret_cast<const sockaddr*>(&peerAddr), sizeof(peerAddr));
+		}
+
+	private:
+		// A request that has been sent, but not answered yet.
+		struct PendingRequest
+		{
+			uint64_t pos;
+			Clock::time_point sentAt;
+
+			// Answers can't be timed once the request has been sent again.
+			bool bResent = false;
+
+			// Answers to requests sent after this one.
+			uint8_t overtaken = 0;
+		};
+
+		// Takes the answers out of the inbox, returns false once the stream is complete.
+		bool AcceptRequested(int received)
+		{
+			for (int i = 0; i < received; ++i)
+			{
+				uint64_t reqID;
+				if (!ParsePayload(inbox[i], reqID))
+				{
+					continue;
+				}
+
+				Tracer::Record(TraceEventType::payloadReceived, traceID, reqID, inbox[i].len);
+
+				// Dropping duplicates and answers to requests that were never sent.
+				auto it = pending.find(reqID);
+				if (it == pending.end())
+				{
+					stats.duplicates.Add();
+					continue;
+				}
+
+				auto now = Clock::now();
+				Clock::time_point sentAt = it->second.sentAt;
+				if (!it->second.bResent)
+				{
+					AddRttSample(now - sentAt);
+				}
+
+				pending.erase(it);
+
+				// Earlier requests that keep being overtaken got lost, they go out again right away.
+				for (auto earlier = pending.begin(); (earlier != pending.end()) && (earlier->first < reqID); ++earlier)
+				{
+					PendingRequest& req = earlier->second;
+					if ((req.sentAt <= sentAt) && (++req.overtaken >= FAST_retransmitThreshold))
+					{
+						if (!QueueRequest(earlier->first, req.pos))
+						{
+							return false;
+						}
+
+						req.sentAt = now;
+						req.bResent = true;
+						req.overtaken = 0;
+						stats.retransmits.Add();
+						Tracer::Record(TraceEventType::retransmit, traceID, earlier->first, req.pos);
+					}
+				}
+
+				if (!AcceptPayload(reqID, reinterpret_cast<const BYTE*>(inbox[i].data), inbox[i].len))
+				{
+					return false;
+				}
+			}
+
+			if (packetID > lastID)
+			{
+				return Complete();
+			}
+
+			return RequestMore();
+		}
+
+		// Fills the window with new requests.
+		bool RequestMore()
+		{
+			// Every full payload carries a block of the stream.
+			const uint64_t dataSz = GetBlockSize();
+
+			while ((nextID <= lastID) && (nextID - packetID < windowSz))
+			{
+				uint64_t reqPos = basePos + nextID * dataSz;
+				if (!QueueRequest(nextID, reqPos))
+				{
+					return false;
+				}
+
+				pending[nextID] = { reqPos, Clock::now() };
+				++nextID;
+			}
+
+			return FlushRequests();
+		}
+
+		// Takes the pushed payloads out of the inbox, returns false once the stream is complete.
+		bool AcceptPushed(int received)
+		{
+			// Reporting every quarter of the window keeps the sender's window sliding.
+			const uint16_t reportEvery = (std::max)(static_cast<uint16_t>(windowSz / 4), static_cast<uint16_t>(1));
+			const uint64_t firstMissing = packetID;
+
+			bool bGap = false;
+			for (int i = 0; i < received; ++i)
+			{
+				if ((fecGroupSz > 0) && ParseRepair(inbox[i]))
+				{
+					continue;
+				}
+
+				uint64_t reqID;
+				if (!ParsePayload(inbox[i], reqID))
+				{
+					continue;
+				}
+
+				Tracer::Record(TraceEventType::payloadReceived, traceID, reqID, inbox[i].len);
+
+				if (!AcceptPushedPayload(reqID, reinterpret_cast<const BYTE*>(inbox[i].data), inbox[i].len, bGap))
+				{
+					return false;
+				}
+			}
+
+			if ((fecGroupSz > 0) && !RecoverPackets(bGap))
+			{
+				return false;
+			}
+
+			// Pushed payloads are never timed after the handshake, so the idle timeout would keep doubling over the whole
+			// transfer. Moving on in order shows the sender gets through again.
+			if (packetID > firstMissing)
+			{
+				rtt.ResetBackoff();
+			}
+
+			if (lastID != (std::numeric_limits<uint64_t>::max)())
+			{
+				horizon = (std::min)(horizon, lastID + 1);
+			}
+
+			// Everything arrived, the final report lets the sender go idle.
+			if (packetID > lastID)
+			{
+				SendReport();
+				return Complete();
+			}
+
+			// Once the socket has been drained, whatever arrived is reported too. The sender's congestion window may be
+			// smaller than ours, it would otherwise wait for the idle report.
+			if (bGap || (sinceReport >= reportEvery) || (bDrained && (sinceReport > 0)))
+			{
+				return SendReport();
+			}
+
+			return true;
+		}
+
+		// Takes a single pushed payload, whether it arrived or was rebuilt. A payload that is already in a pooled packet
+		// comes with it, data pointing at its start.
+		bool AcceptPushedPayload(uint64_t reqID, const BYTE* data, int packetLen, bool& bGap, const PacketBuffer& packet = PacketBuffer())
+		{
+			// Dropping duplicates and anything the sender had no room to send.
+			if ((reqID < packetID) || reorder.Has(reqID))
+			{
+				stats.duplicates.Add();
+				return true;
+			}
+
+			if (reqID - packetID >= windowSz)
+			{
+				return true;
+			}
+
+			// Skipping past the horizon opens a new gap, which is reported right away.
+			bGap = bGap || (reqID > horizon);
+			horizon = (std::max)(horizon, reqID + 1);
+			++sinceReport;
+
+			// Kept for rebuilding the rest of its group, if any of it gets lost. The reorder buffer shares the copy if the
+			// payload has to wait there too.
+			PacketBuffer held = packet;
+			if ((fecGroupSz > 0) && !held)
+			{
+				held = PacketPool::Acquire(packetLen);
+				if (held)
+				{
+					std::memcpy(held.data(), data, packetLen);
+					data = held.data();
+				}
+			}
+
+			if ((fecGroupSz > 0) && held)
+			{
+				fecData.Put(reqID, held, WirePayload::size, packetLen - WirePayload::size);
+			}
+
+			return AcceptPayload(reqID, data, packetLen, held);
+		}
+
+		// Returns false if the datagram isn't a repair from the peer, keeps it otherwise.
+		bool ParseRepair(const Datagram& datagram)
+		{
+			if (!SameAddress(datagram.addr, peerAddr))
+			{
+				return false;
+			}
+
+			const BYTE* data = reinterpret_cast<const BYTE*>(datagram.data);
+			if ((datagram.len < (int) WireRepair::end<WireRepair::type>) || (WireRepair::Get<WireRepair::type>(data) != StreamSender<class T>::OUTM_repair))
+			{
+				return false;
+			}
+
+			// The header, then the repair itself.
+			const size_t dataSz = packetSz - WirePayload::size;
+			if (datagram.len != (int) (WireRepair::size + dataSz))
+			{
+				return true;
+			}
+
+			const uint64_t firstID = WireRepair::Get<WireRepair::firstID>(data);
+			const uint8_t count = WireRepair::Get<WireRepair::count>(data);
+			const uint8_t index = WireRepair::Get<WireRepair::index>(data);
+			const uint16_t lastLen = WireRepair::Get<WireRepair::lastLen>(data);
+
+			if ((count == 0) || (count > fecGroupSz) || (index >= FecCodec::FEC_maxRepair) || (lastLen > dataSz))
+			{
+				return true;
+			}
+
+			// Repairs only go out once the whole group has, whatever of it didn't arrive by now got lost.
+			fecCoveredID = (std::max)(fecCoveredID, firstID + count);
+			horizon = (std::max)(horizon, firstID + count);
+
+			// Groups already written need nothing.
+			if (firstID + count <= packetID)
+			{
+				return true;
+			}
+
+			// Out of buffers it is as good as lost.
+			PacketBuffer repair = PacketPool::Acquire(dataSz);
+			if (!repair)
+			{
+				return true;
+			}
+
+			std::memcpy(repair.data(), data + WireRepair::size, dataSz);
+			bRepaired = true;
+
+			RepairGroup& group = fecRepairs[firstID];
+			group.count = count;
+			group.lastLen = lastLen;
+			group.repairs.emplace(index, std::move(repair));
+
+			return true;
+		}
+
+		// Rebuilds the packets of every group that lost no more of them than it got repairs for.
+		bool RecoverPackets(bool& bGap)
+		{
+			const size_t offset = WirePayload::size;
+			const size_t dataSz = packetSz - offset;
+
+			for (auto it = fecRepairs.begin(); it != fecRepairs.end(); )
+			{
+				const uint64_t firstID = it->first;
+				RepairGroup& group = it->second;
+
+				std::vector<int> missing;
+				for (int i = 0; i < group.count; ++i)
+				{
+					if (!fecData.Has(firstID + i))
+					{
+						missing.push_back(i);
+					}
+				}
+
+				if ((missing.size() > group.repairs.size()) && (firstID + group.count > packetID))
+				{
+					++it;
+					continue;
+				}
+
+				if (!missing.empty())
+				{
+					// Everything padded to a whole payload, the missing ones are rebuilt right in place.
+					std::vector<PacketBuffer> symbols(group.count);
+					std::vector<BYTE*> symbolPtrs(group.count);
+					for (int i = 0; i < group.count; ++i)
+					{
+						symbols[i] = PacketPool::Acquire(dataSz);
+						if (!symbols[i])
+						{
+							break;
+						}
+
+						size_t len = 0;
+						if (fecData.Has(firstID + i))
+						{
+							const ReorderBuffer::Entry& data = fecData.Get(firstID + i);
+							len = (std::min)(data.size(), dataSz);
+							std::memcpy(symbols[i].data(), data.data(), len);
+						}
+
+						std::memset(symbols[i].data() + len, 0, dataSz - len);
+						symbolPtrs[i] = symbols[i].data();
+					}
+
+					// Out of buffers the group waits, or is asked for again.
+					if (!symbols.back())
+					{
+						++it;
+						continue;
+					}
+
+					std::vector<const BYTE*> repairPtrs;
+					std::vector<int> repairIndices;
+					for (auto& [index, repair] : group.repairs)
+					{
+						repairPtrs.push_back(repair.data());
+						repairIndices.push_back(index);
+					}
+
+					if (FecCodec::Recover(symbolPtrs.data(), group.count, missing, repairPtrs.data(), repairIndices, dataSz))
+					{
+						for (int i : missing)
+						{
+							const uint64_t reqID = firstID + i;
+							const size_t len = (i + 1 == group.count) ? group.lastLen : dataSz;
+
+							// Put back together the way it would have arrived.
+							PacketBuffer rebuilt = PacketPool::Acquire(offset + len);
+							if (!rebuilt)
+							{
+								bGap = true;
+								continue;
+							}
+
+							WirePayload::Write(rebuilt.data(), StreamSender<class T>::OUTM_payload, reqID);
+							std::memcpy(rebuilt.data() + offset, symbols[i].data(), len);
+
+							// Rebuilt from a repair that got corrupted, it is asked for again like a lost one.
+							if (bChecksummed && !VerifyChecksum(rebuilt.data(), static_cast<int>(offset + len)))
+							{
+								stats.corrupt.Add();
+								bGap = true;
+								continue;
+							}
+
+							++fecRecovered;
+							stats.recovered.Add();
+							if (!AcceptPushedPayload(reqID, rebuilt.data(), static_cast<int>(offset + len), bGap, rebuilt))
+							{
+								return false;
+							}
+						}
+					}
+				}
+
+				it = fecRepairs.erase(it);
+			}
+
+			// No group reaches back further than its size from the packet being written.
+			const uint64_t keepFrom = (packetID > fecGroupSz) ? (packetID - fecGroupSz) : 0;
+			fecData.EraseBefore(keepFrom);
+
+			// Groups left over lost more than their repairs make up for, they are asked for again right away.
+			bGap = bGap || (bRepaired && !fecRepairs.empty());
+			bRepaired = false;
+
+			return true;
 		}
 
-	private:
-		void Receive()
+		// Drains every datagram that is already waiting into the inbox, bDrained tells whether it all fit.
+		bool ReceivePayloads(int& received)
 		{
-			/// WSAStartup.
+			if (bCoalescing)
 			{
-				WSADATA wsaData;
-				ZeroMemory(&wsaData, sizeof(wsaData));
-
-				if (int err; (err = WSAStartup(MAKEWORD(2, 2), &wsaData)) != 0)
+				if (!ReceiveDataCoalesced(peer, timeout, this, bShouldStop, bExInit, reinterpret_cast<char*>(packet.data()),
+										  GRO_bufferSz, GRO_maxBuffers, inbox.data(), NULL, &received, &bDrained))
 				{
-					return InitEx("Failed the startup.", err);
+					return false;
 				}
 			}
-			
-			HandShake();
-
-			if (!bExInit)
+			else
 			{
-				ReceiveStream();
-			}
+				for (size_t i = 0; i < inbox.size(); ++i)
+				{
+					inbox[i].data = reinterpret_cast<char*>(packet.data() + i * GetSlotSize());
+					inbox[i].len  = GetSlotSize();
+				}
 
+				if (!ReceiveDataBatch(peer, timeout, this, bShouldStop, bExInit, inbox.data(), (int) inbox.size(), NULL, &received))
+				{
+					return false;
+				}
 
-			Cleanup();
+				bDrained = (received < (int) inbox.size());
+			}
 
-			/// WSACleanup.
+			uint64_t receivedBytes = 0;
+			for (int i = 0; i < received; ++i)
 			{
-				while (WSACleanup() != 0)
-				{
-					int err = WSAGetLastError();
-					if ((err == WSANOTINITIALISED) || (err == WSAENETDOWN))
-					{
-						break;
-					}
-				}
+				receivedBytes += inbox[i].len;
 			}
 
-			bFinished = true;
+			stats.AddReceived(received, receivedBytes);
+			return true;
 		}
 
-	private:
-		void Cleanup()
+		// Returns false if the datagram isn't a payload from the peer, or if it got corrupted on the way.
+		bool ParsePayload(const Datagram& datagram, uint64_t& reqID)
 		{
-			if (stream.get() != nullptr)
+			if (!SameAddress(datagram.addr, peerAddr))
 			{
-				delete stream.release();
+				return false;
 			}
 
-			if (peer != INVALID_SOCKET)
+			const BYTE* data = reinterpret_cast<const BYTE*>(datagram.data);
+			if ((datagram.len < (int) WirePayload::size) || (WirePayload::Get<WirePayload::type>(data) != StreamSender<class T>::OUTM_payload))
 			{
-				closesocket(peer);
-				peer = INVALID_SOCKET;
+				return false;
 			}
-		}
 
-		template<class T>
-		friend bool UDPR::DataAvailable(SOCKET sock, const timeval& timeout, T* owner);
+			if (bChecksummed && !VerifyChecksum(data, datagram.len))
+			{
+				stats.corrupt.Add();
+				return false;
+			}
 
-		template<class T>
-		friend bool UDPR::WaitForData(SOCKET sock, const timeval& timeout, T* owner,
-									  const std::atomic_bool& bShouldStop, const std::atomic_bool& bExInit);
+			reqID = WirePayload::Get<WirePayload::packetID>(data);
 
-		template<class T>
-		friend bool UDPR::ReceiveData(SOCKET sock, const timeval& timeout, T* owner,
-									  const std::atomic_bool& bShouldStop, const std::atomic_bool& bExInit,
-									  char* data, int len, int flags, sockaddr* from, int* fromlen, int* packetLen);
+			return true;
+		}
 
-		template<class T>
-		friend bool UDPR::SendData(SOCKET sock, T* owner,
-								   const std::atomic_bool& bShouldStop, const char* data, int len, 
-								   int flags, const sockaddr* to, int tolen);
+		// Whether the checksum matches the packet ID and everything after it.
+		FORCEINLINE bool VerifyChecksum(const BYTE* data, int packetLen) const
+		{
+			const int checkedFrom = WireChecksummedPayload::size;
+			if (packetLen < checkedFrom)
+			{
+				return false;
+			}
 
-	private:
-		void HandShake()
+			uint32_t crc = Crc32c::Compute(data + WireChecksummedPayload::offset<WireChecksummedPayload::packetID>, sizeof(uint64_t));
+			crc = Crc32c::Compute(data + checkedFrom, packetLen - checkedFrom, crc);
+			return crc == WireChecksummedPayload::Get<WireChecksummedPayload::checksum>(data);
+		}
+
+		// Writes the payload, or parks it if it arrived ahead of packetID. A payload that is already in a pooled packet
+		// comes with it, and is parked without another copy.
+		bool AcceptPayload(uint64_t reqID, const BYTE* data, int packetLen, const PacketBuffer& packet = PacketBuffer())
 		{
-			if ((peer = socket(AF_INET, SOCK_DGRAM, IPPROTO_UDP)) == SOCKET_ERROR)
+			const size_t offset = GetBodyOffset();
+
+			const BYTE* body = data + offset;
+			size_t bodyLen = packetLen - offset;
+			if (bCompressed && !DecodeBlock(body, bodyLen))
+			{
+				return false;
+			}
+
+			// A short packet marks the end of the stream, nothing past it is needed.
+			if (bCompressed ? (bodyLen < GetBlockSize()) : (packetLen < packetSz))
+			{
+				lastID = (std::min)(lastID, reqID);
+				pending.erase(pending.upper_bound(lastID), pending.end());
+				reorder.EraseAfter(lastID);
+			}
+
+			if (reqID > lastID)
 			{
-				return InitEx("Failed the socket.", WSAGetLastError());
+				return true;
 			}
 
-		RETRY_SENDHANDSHAKE:
-			do
+			// Parking out of order payloads until the gap before them is filled.
+			if (reqID != packetID)
 			{
-				SendHandshake();
+				stats.outOfOrder.Add();
 
-				if (bExInit) 
-				{ 
-					break; 
+				if (!bCompressed && packet)
+				{
+					reorder.Put(reqID, packet, static_cast<size_t>(body - packet.data()), bodyLen);
+				}
+				else if (!reorder.Put(reqID, body, bodyLen) && (mode == TransferMode::pull))
+				{
+					// Out of buffers it is as good as lost, a pulled one is asked for again once the request times out.
+					pending[reqID] = { basePos + reqID * GetBlockSize(), Clock::time_point(), true };
 				}
+
+				return true;
+			}
+
+			if (!WritePayload(body, bodyLen))
+			{
+				return false;
 			}
-			while (!bShouldStop && !DataAvailable(peer, timeout, this) && !bExInit);
 
-			if (!bExInit && !bShouldStop)
+			// Flushing the payloads which became contiguous.
+			while (reorder.Has(packetID))
 			{
-				if (!ReceiveHandshake())
+				const uint64_t writtenID = packetID;
+				const ReorderBuffer::Entry& parked = reorder.Get(writtenID);
+				if (!WritePayload(parked.data(), parked.size()))
 				{
-					if (!bExInit && !bShouldStop)
-					{
-						goto RETRY_SENDHANDSHAKE;
-					}
+					return false;
 				}
+
+				reorder.Erase(writtenID);
 			}
+
+			return true;
 		}
 
-		void SendHandshake()
+		// Turns an encoded block into the stream's bytes, decompressing it into block if it has to be.
+		bool DecodeBlock(const BYTE*& body, size_t& bodyLen)
 		{
-			do
+			// The encoding, then the compressed length and the compressed block itself.
+			const size_t storedHeaderSz = WireBlock::end<WireBlock::encoding>;
+			const size_t lzHeaderSz = WireBlock::size;
+
+			uint8_t encoding = (bodyLen >= storedHeaderSz) ? WireBlock::Get<WireBlock::encoding>(body) : 0xFF;
+			if ((encoding == StreamSender<class T>::BLOCK_stored) && (bodyLen - storedHeaderSz <= block.size()))
+			{
+				body += storedHeaderSz;
+				bodyLen -= storedHeaderSz;
+				return true;
+			}
+
+			if ((encoding == StreamSender<class T>::BLOCK_lz) && (bodyLen >= lzHeaderSz))
 			{
-				if (!SendData(peer, this, bShouldStop, reinterpret_cast<const char*>(&StreamSender<class T>::INM_handshake),
-							  sizeof(uint8_t), NULL, reinterpret_cast<const sockaddr*>(&peerAddr), sizeof(peerAddr)))
+				const uint16_t compressedLen = WireBlock::Get<WireBlock::compressedLen>(body);
+
+				// Repairs rebuild blocks padded to a whole payload, which is why the length is sent along.
+				int len = (lzHeaderSz + compressedLen <= bodyLen) ? LzCodec::Decompress(body + lzHeaderSz, compressedLen, block.data(), block.size()) : -1;
+				if (len >= 0)
 				{
-					return;
+					body = block.data();
+					bodyLen = static_cast<size_t>(len);
+					return true;
 				}
 			}
-			while(!bShouldStop && !DataAvailable(peer, timeout, this) && !bExInit);
+
+			InitEx("Corrupt compressed payload.", -1);
+			return false;
 		}
 
-		bool ReceiveHandshake()
+		// Tells the sender everything before packetID arrived, along with the gaps up to the horizon. With repairs, gaps
+		// no repair covered yet may still be rebuilt and are held back for a while (see HoldGaps), unless bFull is set.
+		bool SendReport(bool bFull = false)
 		{
-			SOCKADDR_IN from;
-			ZeroMemory(&from, sizeof(from));
+			sinceReport = 0;
 
-			int fromlen = sizeof(from);
+			const uint8_t maxRanges = StreamSender<class T>::NACK_maxRanges;
 
-			BYTE data[sizeof(uint8_t) + sizeof(uint16_t)];
+			// The report (see WireReport), every missing range, then how many packets have been rebuilt so far if repairs come.
+			BYTE data[StreamSender<class T>::INM_maxSz];
 
-		RETRY_RECV:
-			if (!ReceiveData(peer, timeout, this, bShouldStop, bExInit, 
-							 reinterpret_cast<char*>(data), sizeof(data), NULL, 
-							 reinterpret_cast<sockaddr*>(&from), &fromlen))
+			const uint64_t nackEnd = HoldGaps(bFull) ? (std::min)(horizon, (std::max)(fecCoveredID, (horizon > fecGroupSz) ? (horizon - fecGroupSz) : 0)) : horizon;
+
+			// The range count is filled in once the ranges are.
+			WireReport::Write(data, StreamSender<class T>::INM_nack, packetID, horizon, 0);
+			int offset = WireReport::size;
+
+			// Every gap between the parked payloads is missing.
+			uint8_t rangeCount = 0;
+			uint64_t cursor = packetID;
+			auto addRange = [&](uint64_t first, uint64_t last)
 			{
-				return false;
+				WireReportRange::Write(data + offset, first, static_cast<uint32_t>(last - first));
+				offset += WireReportRange::size;
+				++rangeCount;
+			};
+
+			for (uint64_t id = packetID + 1; (id < nackEnd) && (rangeCount < maxRanges); ++id)
+			{
+				if (!reorder.Has(id))
+				{
+					continue;
+				}
+
+				if (id > cursor)
+				{
+					addRange(cursor, id);
+				}
+
+				cursor = id + 1;
 			}
 
-			if (from.sin_addr.S_un.S_addr != peerAddr.sin_addr.S_un.S_addr)
+			if ((cursor < nackEnd) && (rangeCount < maxRanges))
 			{
-				goto RETRY_RECV;
+				addRange(cursor, nackEnd);
 			}
 
+			WireReport::Set<WireReport::rangeCount>(data, rangeCount);
+
+			if (fecGroupSz > 0)
 			{
-				uint8_t msgType;
-				std::memcpy(reinterpret_cast<void*>(&msgType), 
-							reinterpret_cast<const void*>(data), sizeof(uint8_t));
+				WireStore(data + offset, static_cast<uint32_t>(fecRecovered));
+				offset += sizeof(uint32_t);
+			}
 
-				if (msgType != StreamSender<class T>::OUTM_handshake)
-				{
-					InitEx("Invalid handshake.", -1);
-					return false;
-				}
+			stats.AddSent(1, offset);
+			return SendData(peer, this, bShouldStop, reinterpret_cast<const char*>(data),
+							offset, NULL, reinterpret_cast<const sockaddr*>(&peerAddr), sizeof(peerAddr));
+		}
+
+		// Whether gaps no repair covered yet are left out of the report. Repairs come right after their group, so only
+		// gaps within a group of the horizon are, and for about a round trip at most.
+		bool HoldGaps(bool bFull)
+		{
+			const uint64_t heldFrom = (std::max)({ packetID, fecCoveredID, (horizon > fecGroupSz) ? (horizon - fecGroupSz) : 0 });
+			if ((fecGroupSz == 0) || bFull || (heldFrom >= horizon) || !HasGap(heldFrom, horizon))
+			{
+				fecHeldAt = Clock::time_point();
+				return false;
 			}
+
+			auto now = Clock::now();
+			if (fecHeldAt == Clock::time_point())
 			{
-				uint16_t packetSz;
-				std::memcpy(reinterpret_cast<void*>(&packetSz),
-							reinterpret_cast<const void*>(data + sizeof(uint8_t)), sizeof(uint16_t));
+				fecHeldAt = now;
+			}
 
-				packet = std::vector<BYTE>(packetSz);
+			if (now - fecHeldAt >= GetFecHoldTime())
+			{
+				fecHeldAt = Clock::time_point();
+				return false;
 			}
 
 			return true;
 		}
 
-	private:
-		void ReceiveStream()
+		// Whether anything in [first, last) is still missing.
+		bool HasGap(uint64_t first, uint64_t last) const
+		{
+			for (uint64_t id = first; id < last; ++id)
+			{
+				if (!reorder.Has(id))
+				{
+					return true;
+				}
+			}
+
+			return false;
+		}
+
+		FORCEINLINE Clock::duration GetFecHoldTime() const
+		{
+			return rtt.HasSample() ? rtt.GetSmoothedRtt() : rtt.GetRto();
+		}
+
+		FORCEINLINE void AddRttSample(Clock::duration sample)
 		{
+			rtt.AddSample(sample);
+			stats.rtt.Add(sample);
+		}
 
-		BEGIN_SENDREQ:
-			// Sending the request.
-			if (bShouldStop) { return; }
+		// Nothing arrived within the timeout, before it is backed off.
+		void RecordTimeout()
+		{
+			stats.timeouts.Add();
+			Tracer::Record(TraceEventType::timeout, traceID, packetID,
+						   static_cast<uint64_t>(std::chrono::duration_cast<std::chrono::microseconds>(rtt.GetRto()).count()));
+		}
 
+		// Adds a request to the next batch, sending the batch first if it is full.
+		bool QueueRequest(uint64_t reqID, uint64_t reqPos)
+		{
+			if ((queued == BATCH_maxDatagrams) && !FlushRequests())
 			{
+				return false;
+			}
 
-				// 1 byte for message type, 8 bytes for the ID, 8 bytes for the position, 2 bytes for the length.
-				BYTE reqData[sizeof(uint8_t) + sizeof(uint64_t) + sizeof(uint64_t) + sizeof(uint16_t)];
-			
-				int offset = 0;
-				std::memcpy(reinterpret_cast<void*>(reqData + offset), 
-							reinterpret_cast<const void*>(&StreamSender<class T>::INM_request), sizeof(uint8_t));
-				offset += sizeof(uint8_t);
-			
-				std::memcpy(reinterpret_cast<void*>(reqData + offset),
-							reinterpret_cast<const void*>(&packetID), sizeof(uint64_t));
-				offset += sizeof(uint64_t);
+			Tracer::Record(TraceEventType::requestSent, traceID, reqID, reqPos);
 
-				std::memcpy(reinterpret_cast<void*>(reqData + offset),
-							reinterpret_cast<const void*>(&pos), sizeof(uint64_t));
-				offset += sizeof(uint64_t);
+			BYTE* reqData = requests.data() + queued * REQ_size;
 
-				uint16_t auxSz = static_cast<uint16_t>(packet.size());
-				std::memcpy(reinterpret_cast<void*>(reqData + offset),
-							reinterpret_cast<const void*>(&auxSz), sizeof(uint16_t));
-				offset += sizeof(uint16_t);
+			WireRequest::Write(reqData, StreamSender<class T>::INM_request, reqID, reqPos, packetSz);
 
+			outbox[queued].data = reinterpret_cast<char*>(reqData);
+			outbox[queued].len  = REQ_size;
+			outbox[queued].addr = peerAddr;
+			++queued;
 
-				if (!SendData(peer, this, bShouldStop, reinterpret_cast<const char*>(reqData),
-							  sizeof(reqData), NULL, reinterpret_cast<const sockaddr*>(&peerAddr), sizeof(peerAddr)))
+			return true;
+		}
+
+		// Sends every queued request at once.
+		bool FlushRequests()
+		{
+			int count = queued;
+			queued = 0;
+
+			stats.AddSent(count, static_cast<uint64_t>(count) * REQ_size);
+			return SendDataBatch(peer, this, bShouldStop, outbox.data(), count, NULL);
+		}
+
+		// Writes the payload of the next packet in line to the stream.
+		bool WritePayload(const BYTE* data, size_t len)
+		{
+			const auto writeAt = Clock::now();
+			Tracer::Record(TraceEventType::streamBegin, traceID, packetID, len);
+			try
+			{
+				if (writer != nullptr)
+				{
+					if (!writer->Append(data, len))
+					{
+						InitEx(writer->GetErrorString(), -1);
+						return false;
+					}
+				}
+				else if constexpr (IsPositionalStream<TStream>::value)
+				{
+					stream->WriteAt(data, len, pos);
+				}
+				else
 				{
-					return;
+					stream->write(data, len);
 				}
 			}
+			catch (const std::exception& ex)
+			{
+				std::string err = std::string("Failed some stream operation with message:'") + std::string(ex.what()) + std::string("'");
+				InitEx(err, -1);
+				return false;
+			}
 
-			// Receiving the data requested.
-			SOCKADDR_IN from;
-			ZeroMemory(&from, sizeof(from));
-			int fromlen = sizeof(from);
+			stats.AddStreamTime(Clock::now() - writeAt);
+			Tracer::Record(TraceEventType::streamEnd, traceID, packetID, len);
+
+			pos += len;
+			++packetID;
 
-			int packetLen;
-			if (!ReceiveData(peer, timeout, this, bShouldStop, bExInit,
-							 reinterpret_cast<char*>(packet.data()), (int) packet.size(), NULL,
-							 reinterpret_cast<sockaddr*>(&from), &fromlen, &packetLen))
+			if (bChecksummed)
 			{
-				return;
+				digest = Crc32c::Compute(data, len, digest);
+			}
+
+			if (!options.checkpointPath.empty() && (pos - checkpointedPos >= options.checkpointInterval))
+			{
+				return SaveCheckpoint();
+			}
+
+			return true;
+		}
+
+		// Done once everything has been written, unless the sender's digest of it has to be checked first. Returns false
+		// once the receiver is done.
+		bool Complete()
+		{
+			// Complete means on the stream.
+			if ((writer != nullptr) && !writer->Drain())
+			{
+				InitEx(writer->GetErrorString(), -1);
+				return false;
 			}
 
-			if (from.sin_addr.S_un.S_addr != peerAddr.sin_addr.S_un.S_addr)
+			if (!bChecksummed)
 			{
-				goto BEGIN_SENDREQ;
+				bComplete = true;
+				return false;
 			}
 
-			// Decyphering data.
-			size_t offset = 0;
+			state = State::verifying;
+			return RequestDigest();
+		}
+
+		// Asks the sender for the digest of what this receiver wrote, the timer asks again until it answers.
+		bool RequestDigest()
+		{
+			BYTE data[WireDigestRequest::size];
+			WireDigestRequest::Write(data, StreamSender<class T>::INM_digest, digestFrom, pos);
+
+			digestAt = Clock::now();
+
+			stats.AddSent(1, sizeof(data));
+			return SendData(peer, this, bShouldStop, reinterpret_cast<const char*>(data),
+							sizeof(data), NULL, reinterpret_cast<const sockaddr*>(&peerAddr), sizeof(peerAddr));
+		}
+
+		// Looks for the sender's digest among whatever arrived, payloads still in flight are dropped. Returns false once
+		// it has been compared.
+		bool ReceiveDigest()
+		{
+			int received;
+			if (!ReceivePayloads(received))
 			{
-				uint8_t msgType;
-				std::memcpy(reinterpret_cast<void*>(&msgType), 
-							reinterpret_cast<const void*>(packet.data()), sizeof(uint8_t));
-				offset += sizeof(uint8_t);
+				return !bExInit;
+			}
 
-				if (msgType != StreamSender<class T>::OUTM_payload)
+			for (int i = 0; i < received; ++i)
+			{
+				const BYTE* data = reinterpret_cast<const BYTE*>(inbox[i].data);
+				if (!SameAddress(inbox[i].addr, peerAddr) || (inbox[i].len != (int) WireDigest::size) ||
+					(WireDigest::Get<WireDigest::type>(data) != StreamSender<class T>::OUTM_digest))
 				{
-					goto BEGIN_SENDREQ;
+					continue;
 				}
 
-				uint64_t reqID;
-				std::memcpy(reinterpret_cast<void*>(&reqID), 
-							reinterpret_cast<const void*>(packet.data() + offset), sizeof(uint64_t));
-				offset += sizeof(uint64_t);
+				const uint32_t senderDigest = WireDigest::Get<WireDigest::digest>(data);
+				if ((WireDigest::Get<WireDigest::from>(data) != digestFrom) || (WireDigest::Get<WireDigest::to>(data) != pos))
+				{
+					continue;
+				}
 
-				if (reqID != packetID)
+				if (senderDigest != digest)
 				{
-					goto BEGIN_SENDREQ;
+					// Resuming would keep whatever doesn't match.
+					if (!options.checkpointPath.empty())
+					{
+						Checkpoint::Remove(options.checkpointPath);
+						checkpointedPos = pos;
+					}
+
+					InitEx("The stream doesn't match the sender's digest.", -1);
+					return false;
 				}
-				else
+
+				bComplete = true;
+				return false;
+			}
+
+			return true;
+		}
+
+		// Everything written has to reach the stream before the checkpoint says it did, the writer sees to that itself.
+		bool SaveCheckpoint()
+		{
+			if (writer != nullptr)
+			{
+				checkpointedPos = pos;
+				if (!writer->Checkpoint(fingerprint))
 				{
-					++packetID;
+					InitEx(writer->GetErrorString(), -1);
+					return false;
 				}
+
+				return true;
 			}
 
 			try
 			{
-				stream->write(packet.data() + offset, packetLen - offset);
+				if constexpr (IsFlushableStream<TStream>::value)
+				{
+					stream->flush();
+				}
 			}
 			catch (const std::exception& ex)
 			{
 				std::string err = std::string("Failed some stream operation with message:'") + std::string(ex.what()) + std::string("'");
-				return InitEx(err, -1);
+				InitEx(err, -1);
+				return false;
 			}
-			
-			pos += packetLen - offset;
 
-			if (packetLen == packet.size())
+			if (!Checkpoint{ pos, fingerprint }.Save(options.checkpointPath))
 			{
-				goto BEGIN_SENDREQ;
+				InitEx("Failed to save the checkpoint.", -1);
+				return false;
 			}
+
+			checkpointedPos = pos;
+			return true;
 		}
 
 	private:
 		SOCKET peer;
 		SOCKADDR_IN peerAddr;
 
+		// Incoming datagrams are drained together, one packetSz slot each, or GRO_bufferSz ones when coalescing.
 		std::vector<BYTE> packet;
+		std::vector<Datagram> inbox;
+		uint16_t packetSz;
+
+		// Outgoing requests are sent together too.
+		std::vector<BYTE> requests;
+		std::vector<Datagram> outbox;
+		int queued;
+
 		const timeval timeout;
 		uint64_t packetID;
 		uint64_t pos;
 
+	private:
+		// Sliding window of outstanding requests.
+		const uint16_t windowSz;
+		uint64_t nextID;
+		uint64_t lastID;
+		std::map<uint64_t, PendingRequest> pending;
+
+		// Payloads that arrived ahead of packetID.
+		ReorderBuffer reorder;
+
+		// Proposed by us, settled by the sender's handshake.
+		TransferMode mode;
+
+		const ReceiverOptions options;
+
+		// Set if the kernel agreed to coalesce.
+		bool bCoalescing = false;
+
+		State state = State::handshaking;
+		Clock::time_point handshakeAt;
+		Clock::time_point lastActivityAt;
+
+		// Push mode, one past the highest packet ID seen so far and how many arrived since the last report.
+		uint64_t horizon = 0;
+		uint16_t sinceReport = 0;
+
+		// Set if the last read took everything that was waiting on the socket.
+		bool bDrained = false;
+
+		// Where packet 0 starts in the stream, past whatever had been written before a reprobe.
+		uint64_t basePos = 0;
+
+		// Set if the sender starts wherever asked, and if the next handshake asks it to probe again.
+		bool bResumes = false;
+		bool bReprobe = false;
+
+		// The lower of both ends' wire versions, see WIRE_version. Nothing reads it yet.
+		uint8_t version = 0;
+
+		// Timeouts in a row without a payload.
+		int stalledTimeouts = 0;
+
+		// Round trip estimate, all retransmissions wait for its timeout.
+		RttEstimator rtt;
+		bool bHandshakeUntimed = false;
+
+		// As told by a sender that serves ranges, read from any thread.
+		std::atomic<uint64_t> streamSz { (std::numeric_limits<uint64_t>::max)() };
+		bool bStreamSzTold = false;
+
+		// Checkpointing, the sender's fingerprint is known once bFingerprint is set. bResumingCheckpoint is set if
+		// the sender's has to match the one of the checkpoint we started from.
+		uint64_t fingerprint = 0;
+		uint64_t checkpointedPos = 0;
+		bool bFingerprint = false;
+		bool bResumingCheckpoint = false;
+
+		// Set once everything up to the end of the stream (or range) has been written, and matched the sender's digest
+		// if it checksums.
+		bool bComplete = false;
+
+		// Set if the sender agreed to checksum. The CRC of everything written from digestFrom on, and when the sender's
+		// digest was last asked for.
+		bool bChecksummed = false;
+		uint64_t digestFrom = 0;
+		uint32_t digest = 0;
+		Clock::time_point digestAt;
+
+		// Counted by the thread receiving, read by anyone.
+		TransferStats stats;
+
+		// Tells this receiver's events apart from everyone else's.
+		const uint32_t traceID = Tracer::NewObject();
+
+	private:
+		// The repairs that arrived for a group, by their index.
+		struct RepairGroup
+		{
+			uint8_t count = 0;
+			uint16_t lastLen = 0;
+			std::map<uint8_t, PacketBuffer> repairs;
+		};
+
+		// Set if the sender agreed to compress, blocks are decompressed into block before they are written.
+		bool bCompressed = false;
+		std::vector<BYTE> block;
+
+		// Packets per group as told by a sender that sends repairs, 0 for one that doesn't.
+		uint8_t fecGroupSz = 0;
+
+		// Payloads of the groups that aren't written whole yet, and the repairs for them by the group's first ID.
+		ReorderBuffer fecData;
+		std::map<uint64_t, RepairGroup> fecRepairs;
+
+		// One past the last packet any repair that arrived covers, and whether one arrived since the last recovery.
+		uint64_t fecCoveredID = 0;
+		bool bRepaired = false;
+
+		// When gaps were first left out of a report, unset while none are.
+		Clock::time_point fecHeldAt;
+
+		// Packets rebuilt so far, the sender sends as many repairs as the loss that includes them calls for.
+		uint32_t fecRecovered = 0;
+
 	private:
 		// The stream, where received data will be written.
 		std::unique_ptr<TStream> stream;
 
+		// Writes to the stream on a thread of its own if write-behind is on, until Finish stops it.
+		std::unique_ptr<WriteBehind<TStream>> writer;
+
+		// Set if the reactor drives this instead of process.
+		Reactor* reactor;
+
 		// For the thread.
 		std::atomic_bool bShouldStop;
 		std::atomic_bool bFinished;
+		std::atomic_bool bCleanedUp = false;
 		std::thread process;
 
+		// Whoever waits for the finish, guarded by finishMutex along with setting bFinished and the thread that did.
+		std::mutex finishMutex;
+		std::function<void()> onceFinished;
+		std::thread::id finishingThread;
+
+		// Lets Stop cut the thread's wait short, never opened for the reactor.
+		Waker waker;
+		bool bWakerNetStarted = false;
+
 	private:
 		// Exception handling.
 		std::string errStr = "";
@@ -356,8 +1965,35 @@ namespace UDPR
 
 		FORCEINLINE const int GetErrorCode() const { return errCode; }
 
+		// The current retransmission timeout, the timeout given to the constructor until the first round trip.
+		FORCEINLINE Clock::duration GetRetryInterval() const { return rtt.GetRto(); }
+
+		FORCEINLINE Clock::duration GetSmoothedRtt() const { return rtt.GetSmoothedRtt(); }
+
 		FORCEINLINE const SOCKADDR_IN GetPeerAddress() const { return peerAddr; }
+
+		FORCEINLINE uint16_t GetWindowSize() const { return windowSz; }
+
+		FORCEINLINE TransferMode GetTransferMode() const { return mode; }
+
+		FORCEINLINE const ReceiverOptions& GetOptions() const { return options; }
+
+		FORCEINLINE bool IsComplete() const { return bComplete; }
+
+		// Payloads which arrived or were rebuilt corrupted, and were asked for again.
+		FORCEINLINE uint64_t GetCorruptPackets() const { return stats.corrupt.Get(); }
+
+		// Safe to call from any thread while the receiver runs.
+		FORCEINLINE TransferStatsSnapshot GetStats() const { return stats.GetSnapshot(); }
+
+		// The size of the sender's stream, the maximum until a sender that serves ranges told it.
+		FORCEINLINE uint64_t GetStreamSize() const { return streamSz.load(std::memory_order_relaxed); }
 		
 		FORCEINLINE bool IsRunning() const { return !bFinished; }
+
+	#ifdef UDPR_COROUTINES
+		// co_await it to wait for the receiver to finish, which comes out true if the stream arrived in full.
+		FORCEINLINE FinishedAwaitable<StreamReceiver> Fetch() { return FinishedAwaitable<StreamReceiver>(*this); }
+	#endif
 	};
 }
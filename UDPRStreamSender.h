@@ -4,342 +4,2099 @@
 #include <memory>
 #include <utility>
 #include <thread>
+#include <mutex>
 #include <atomic>
 #include <cstdint>
 #include <vector>
 #include <cstring>
 #include <string>
+#include <map>
+#include <deque>
+#include <unordered_map>
+#include <functional>
+#include <chrono>
+#include <limits>
+#include <algorithm>
+#include <ios>
+#include <type_traits>
+#include <cmath>
 
-/// WINDOWS
-#include <WinSock2.h>
+/// CUSTOM
+#include "UDPRDebugHeaders.h"
+#include "UDPRMisc.h"
+#include "UDPRWire.h"
+#include "UDPRReactor.h"
+#include "UDPRMappedFile.h"
+#include "UDPRCongestion.h"
+#include "UDPRCheckpoint.h"
+#include "UDPRFec.h"
+#include "UDPRLz.h"
+#include "UDPRCrc.h"
+#include "UDPRReadAhead.h"
+#include "UDPRStats.h"
+#include "UDPRTrace.h"
+#include "UDPRCoroutine.h"
+
+namespace UDPR
+{
+	/// Optional behaviour of a StreamSender, everything is off by default.
+	struct SenderOptions
+	{
+		// Hands runs of full payloads to the kernel as one buffer to be cut into datagrams (UDP_SEGMENT, Linux only).
+		// Falls back to one datagram per packet wherever that isn't supported.
+		bool bSegmentation = false;
+
+		// Limits and paces what is pushed to each receiver, pulled packets stay clocked by the receiver's requests. Off
+		// since both controllers take reordering for loss, a jittery path holds them at a couple of packets a round trip.
+		CongestionControl congestion = CongestionControl::none;
+
+		// Overrides congestion with a controller of your own, one is made for every session.
+		std::function<CongestionController*()> customCongestion;
+
+		// Probes every receiver's path during the handshake for the largest packet up to maxPacketSz that gets
+		// through unfragmented, the packetSz given to the constructor is the fallback that always has to.
+		// Receivers which don't answer probes are served with the fallback.
+		bool bPathMtuDiscovery = true;
+		uint16_t maxPacketSz = 8972;
+
+		// Follows every fecGroupSz pushed packets with repair packets a receiver can rebuild lost ones from without
+		// asking again, as many as the loss the receiver sees calls for within [fecMinRepair, fecMaxRepair]. Only
+		// receivers which ask for it get repairs, and only in push mode, pulled packets are asked for one by one.
+		bool bFec = false;
+		uint8_t fecGroupSz = 16;
+		uint8_t fecMinRepair = 1;
+		uint8_t fecMaxRepair = 4;
+
+		// Compresses every packet's block of the stream on its own for receivers which ask for it, so blocks can still be
+		// sent in any order and again. Blocks that don't get smaller are sent as they are. Mapped streams are then read
+		// through the packet buffer instead of being sent straight out of the mapping.
+		bool bCompression = false;
+
+		// Checksums every payload for receivers which ask for it, and answers their request for a digest of everything
+		// they received once they have it all. Receivers drop payloads that don't match and ask for them again.
+		bool bChecksums = false;
+
+		// Reads every receiver's stream ahead of its requests on a thread of its own, so payloads asked for in order are
+		// served from memory instead of waiting for the disk. Mapped streams are in memory already and never are.
+		bool bReadAhead = false;
+
+		// At most this many sessions read ahead at once, every one takes a thread and 4 MiB. The others read their
+		// stream as they would without read-ahead.
+		size_t maxReadAheads = 8;
+
+		// Called once the sender is done, failed or stopped, from whichever thread finished it. The sender may be
+		// stopped from there but not destroyed, that has to wait for the call to return.
+		std::function<void()> onFinished;
+	};
+
+	/// Streams whose size is found by seeking to their end, like a std::basic_ifstream.
+	template<class TStream, class = void>
+	struct IsSeekableStream : std::false_type {};
+
+	template<class TStream>
+	struct IsSeekableStream<TStream, std::void_t<decltype(std::declval<TStream&>().seekg(0, std::ios::end)),
+												 decltype(std::declval<TStream&>().tellg())>> : std::true_type {};
+
+	template<class TStream>
+	class StreamSender : private Reactor::Handler
+	{
+		using Clock = Reactor::Clock;
+
+	public:
+		/// Outgoing messages.
+		static constexpr uint8_t OUTM_handshake = 0;
+		static constexpr uint8_t OUTM_payload   = 1;
+		static constexpr uint8_t OUTM_probe     = 2;
+		static constexpr uint8_t OUTM_repair    = 3;
+		static constexpr uint8_t OUTM_digest    = 4;
+
+		/// Incoming messages.
+		static constexpr uint8_t INM_handshake = 0;
+		static constexpr uint8_t INM_request   = 1;
+		static constexpr uint8_t INM_nack      = 2;
+		static constexpr uint8_t INM_probeAck  = 3;
+		static constexpr uint8_t INM_digest    = 4;
+
+		/// Handshake flags. The receiver's tell what it understands and wants, the sender's what it agreed to.
+		static constexpr uint8_t HS_probes  = 1 << 0; // The receiver answers probes.
+		static constexpr uint8_t HS_reprobe = 1 << 1; // The receiver lost the path, probe it again before resuming.
+		static constexpr uint8_t HS_resume  = 1 << 2; // The sender starts at the position the receiver asked for.
+		static constexpr uint8_t HS_range   = 1 << 3; // The transfer ends where the receiver asked, the sender tells the stream's size.
+		static constexpr uint8_t HS_fingerprint = 1 << 4; // The sender tells the fingerprint of its stream, for checkpoints.
+		static constexpr uint8_t HS_fec     = 1 << 5; // Pushed packets are followed by repairs, the sender tells the group size.
+		static constexpr uint8_t HS_compress = 1 << 6; // Payloads start with how their block is encoded.
+		static constexpr uint8_t HS_checksum = 1 << 7; // Payloads carry a checksum, the sender answers digest requests.
+
+		/// Probe sizes tried above the fallback: IPv6 minimum, common tunnels, PPPoE, Ethernet and jumbo frames.
+		static constexpr uint16_t PMTU_candidates[] = { 1232, 1392, 1464, 1472, 4052, 8972 };
+
+		/// Each probe goes out this many times per round, rounds nothing answered are repeated this many times.
+		static constexpr int PMTU_probeCopies = 2;
+		static constexpr int PMTU_maxRounds = 3;
+
+		/// A stream's fingerprint hashes its size and this many samples spread across it.
+		static constexpr int FP_samples = 16;
+		static constexpr int FP_sampleSz = 4096;
+
+		/// A repair's header (see WireRepair). Payloads shrink by what it adds over their header.
+		static constexpr int REPAIR_headerSz = WireRepair::size;
+		static constexpr int FEC_repairExtra = REPAIR_headerSz - WirePayload::size;
+
+		/// Repairs sent per expected loss, the margin covers losses coming in bursts.
+		static constexpr double FEC_margin = 2.0;
+
+		/// How a block is encoded when compression was agreed on. Compressed ones are preceded by their 2 byte length,
+		/// so repairs that rebuild them padded still decode.
+		static constexpr uint8_t BLOCK_stored = 0;
+		static constexpr uint8_t BLOCK_lz     = 1;
+
+		/// A digest request and its answer (see WireDigestRequest and WireDigest). Streams that aren't mapped are read
+		/// this much at a time for it.
+		static constexpr int DIGEST_requestSz = WireDigestRequest::size;
+		static constexpr int DIGEST_answerSz = WireDigest::size;
+		static constexpr size_t DIGEST_chunkSz = 64 * 1024;
+
+		/// Most missing ranges a single report can carry.
+		static constexpr uint8_t NACK_maxRanges = 32;
+
+		/// Largest incoming message, which is a full report along with how many packets the receiver rebuilt.
+		static constexpr int INM_maxSz = WireReport::size + NACK_maxRanges * WireReportRange::size + sizeof(uint32_t);
+
+		/// In server mode, sessions which stay silent for this many timeouts are dropped.
+		static constexpr int SESSION_idleTimeouts = 120;
+
+		/// Opens the stream a new receiver gets, returning nullptr turns the receiver away.
+		using StreamFactory = std::function<TStream*(const SOCKADDR_IN&)>;
+
+	public:
+		// Serves a single receiver, whichever handshook last.
+		StreamSender(TStream* _stream, uint16_t _port, uint16_t _packetSz = 508, const timeval& _timeout = { 0, 500 * 1000 },
+					 const SenderOptions& _options = SenderOptions()) :
+			StreamSender(nullptr, _stream, nullptr, 1, _port, _packetSz, _timeout, _options)
+		{
+			StartProcess();
+		}
+
+		// Driven by the reactor's threads instead of a thread of its own.
+		StreamSender(Reactor& _reactor, TStream* _stream, uint16_t _port, uint16_t _packetSz = 508, const timeval& _timeout = { 0, 500 * 1000 },
+					 const SenderOptions& _options = SenderOptions()) :
+			StreamSender(&_reactor, _stream, nullptr, 1, _port, _packetSz, _timeout, _options)
+		{
+			AttachToReactor();
+		}
+
+		// Serves every receiver that handshakes on the port, each with a stream of its own.
+		StreamSender(StreamFactory _factory, uint16_t _port, uint16_t _packetSz = 508, const timeval& _timeout = { 0, 500 * 1000 },
+					 size_t _maxSessions = 1024, const SenderOptions& _options = SenderOptions()) :
+			StreamSender(nullptr, nullptr, std::move(_factory), _maxSessions, _port, _packetSz, _timeout, _options)
+		{
+			StartProcess();
+		}
+
+		StreamSender(Reactor& _reactor, StreamFactory _factory, uint16_t _port, uint16_t _packetSz = 508,
+					 const timeval& _timeout = { 0, 500 * 1000 }, size_t _maxSessions = 1024,
+					 const SenderOptions& _options = SenderOptions()) :
+			StreamSender(&_reactor, nullptr, std::move(_factory), _maxSessions, _port, _packetSz, _timeout, _options)
+		{
+			AttachToReactor();
+		}
+
+		~StreamSender()
+		{
+			Stop();
+
+			waker.Close();
+			if (bWakerNetStarted)
+			{
+				NetCleanup();
+			}
+		}
+
+		// Returns once the sender stopped, which is right away however long the timeout is.
+		void Stop()
+		{
+			// Called from onFinished, the thread or worker that finished is on its way out already and can't wait on itself.
+			if (IsFinishingThread())
+			{
+				return;
+			}
+
+			if (process.joinable())
+			{
+				bShouldStop = true;
+				waker.Wake();
+				process.join();
+				bShouldStop = false;
+			}
+			else if (reactor != nullptr)
+			{
+				reactor->Detach(this);
+				Finish();
+			}
+		}
+
+		// Asks the sender to stop without waiting for it, onFinished is called once it did.
+		void RequestStop()
+		{
+			bShouldStop = true;
+
+			if (reactor != nullptr)
+			{
+				reactor->Wake(this);
+			}
+			else
+			{
+				waker.Wake();
+			}
+		}
+
+	private:
+		StreamSender(Reactor* _reactor, TStream* _stream, StreamFactory _factory, size_t _maxSessions,
+					 uint16_t _port, uint16_t _packetSz, const timeval& _timeout, const SenderOptions& _options) :
+			packet(BATCH_maxDatagrams * GetSlotSize(_packetSz, _options)),
+			outbox(BATCH_maxDatagrams),
+			block(GetSlotSize(_packetSz, _options)),
+			inboxData(BATCH_maxDatagrams * INM_maxSz),
+			inbox(BATCH_maxDatagrams),
+			peer(INVALID_SOCKET),
+			packetSz(_packetSz),
+			slotSz(GetSlotSize(_packetSz, _options)),
+			port(_port),
+			timeout(_timeout),
+			options(_options),
+			maxSessions((std::max)(_maxSessions, static_cast<size_t>(1))),
+			stream(_stream),
+			factory(std::move(_factory)),
+			reactor(_reactor),
+			bShouldStop(false),
+			bFinished(false)
+		{
+		}
+
+		// The waker is opened before the thread starts so Stop can always wake it. Without one, Stop waits for the
+		// thread to notice within a timeout, as it would without the waker.
+		void StartProcess()
+		{
+			if (NetStartup() == 0)
+			{
+				bWakerNetStarted = true;
+				waker.Open();
+			}
+
+			process = std::thread(&StreamSender::Send, this);
+		}
+
+		void AttachToReactor()
+		{
+			if (int err; (err = NetStartup()) != 0)
+			{
+				InitEx("Failed the WSAStartup.", err);
+				MarkFinished();
+				return;
+			}
+
+			if (!Open() || !reactor->Attach(this))
+			{
+				if (!bExInit)
+				{
+					InitEx("Failed to attach to the reactor.", -1);
+				}
+
+				Finish();
+			}
+		}
+
+		void Cleanup()
+		{
+			sessions.clear();
+
+			if (stream.get() != nullptr)
+			{
+				delete stream.release();
+			}
+
+			if (peer != INVALID_SOCKET)
+			{
+				CloseSocket(peer);
+				peer = INVALID_SOCKET;
+			}
+		}
+
+		// Runs once, whichever of the thread, the reactor or Stop gets here first.
+		void Finish()
+		{
+			if (bCleanedUp.exchange(true))
+			{
+				return;
+			}
+
+			Cleanup();
+
+			NetCleanup();
+
+			MarkFinished();
+		}
+
+		// Calls back whoever waits for the finish, once.
+		void MarkFinished()
+		{
+			std::function<void()> callback;
+			{
+				std::lock_guard<std::mutex> lock(finishMutex);
+				bFinished = true;
+				finishingThread = std::this_thread::get_id();
+				callback = std::move(onceFinished);
+			}
+
+			if (options.onFinished)
+			{
+				options.onFinished();
+			}
+
+			if (callback)
+			{
+				callback();
+			}
+		}
+
+		bool IsFinishingThread()
+		{
+			std::lock_guard<std::mutex> lock(finishMutex);
+			return finishingThread == std::this_thread::get_id();
+		}
+
+		// Calls back from whichever thread finishes, returns false without calling back if that already happened.
+		bool CallOnceFinished(std::function<void()> callback)
+		{
+			std::lock_guard<std::mutex> lock(finishMutex);
+			if (bFinished)
+			{
+				return false;
+			}
+
+			onceFinished = std::move(callback);
+			return true;
+		}
+
+		template<class TTransfer>
+		friend class FinishedAwaitable;
+
+		void Send()
+		{
+			if (int err; (err = NetStartup()) != 0)
+			{
+				InitEx("Failed the WSAStartup.", err);
+				MarkFinished();
+				return;
+			}
+
+			if (Open())
+			{
+				// The same steps the reactor takes, waiting on the socket in between.
+				while (!bShouldStop && !bExInit)
+				{
+					if (DataAvailable(peer, waker, TimeUntil(GetDeadline(), timeout), this))
+					{
+						if (!OnReadable()) { break; }
+					}
+					else if (bExInit)
+					{
+						break;
+					}
+
+					if ((Clock::now() >= GetDeadline()) && !OnTimer()) { break; }
+				}
+			}
+
+			Finish();
+		}
+
+		template<class T>
+		friend bool UDPR::DataAvailable(SOCKET sock, const timeval& timeout, T* owner);
+
+		template<class T>
+		friend bool UDPR::DataAvailable(SOCKET sock, Waker& waker, const timeval& timeout, T* owner);
+
+		template<class T>
+		friend bool UDPR::WaitForRoom(SOCKET sock, T* owner, const std::atomic_bool& bShouldStop);
+
+		template<class T>
+		friend bool UDPR::WaitForData(SOCKET sock, const timeval& timeout, T* owner,
+									  const std::atomic_bool& bShouldStop, const std::atomic_bool& bExInit);
+
+		template<class T>
+		friend bool UDPR::ReceiveData(SOCKET sock, const timeval& timeout, T* owner,
+									  const std::atomic_bool& bShouldStop, const std::atomic_bool& bExInit,
+									  char* data, int len, int flags, sockaddr* from, int* fromlen, int* packetLen);
+
+		template<class T>
+		friend bool UDPR::SendData(SOCKET sock, T* owner,
+								   const std::atomic_bool& bShouldStop, const char* data, int len,
+								   int flags, const sockaddr* to, int tolen);
+
+		template<class T>
+		friend bool UDPR::SendDataGather(SOCKET sock, T* owner,
+										 const std::atomic_bool& bShouldStop, const Datagram& datagram, int flags);
+
+		template<class T>
+		friend bool UDPR::SendDataBatch(SOCKET sock, T* owner,
+										const std::atomic_bool& bShouldStop, const Datagram* datagrams, int count, int flags,
+										bool* bSegmentation);
+
+		template<class T>
+		friend bool UDPR::ReceiveDataBatch(SOCKET sock, const timeval& timeout, T* owner,
+										   const std::atomic_bool& bShouldStop, const std::atomic_bool& bExInit,
+										   Datagram* datagrams, int count, int flags, int* received);
+
+	private:
+		enum class State : uint8_t
+		{
+			probing,
+			handshaking,
+			serving
+		};
+
+		// Everything the sender keeps per receiver.
+		struct Session
+		{
+			SOCKADDR_IN peerAddr;
+			std::unique_ptr<TStream> stream;
+
+			State state = State::handshaking;
+			Clock::time_point handshakeAt;
+			Clock::time_point lastHeardAt;
+
+			// Set once the receiver sent anything after our handshake.
+			bool bAcknowledged = false;
+
+			// Round trip estimate, the handshake can't be timed once it has been resent.
+			RttEstimator rtt;
+			bool bHandshakeUntimed = false;
+
+			// Negotiated in the handshake.
+			TransferMode mode = TransferMode::pull;
+			uint16_t pushWindow = 1;
+			uint16_t packetSz = 0;
+			uint8_t flags = 0;
+			bool bFlags = false;
+			bool bFec = false;
+			bool bCompress = false;
+			bool bChecksum = false;
+
+			// The lower of both ends' wire versions, see WIRE_version. Nothing reads it yet.
+			uint8_t version = 0;
+
+			// The largest datagram the path takes, payloads are smaller by the repair's extra header with FEC.
+			uint16_t pathSz = 0;
+
+			// Where packet 0 starts in the stream, past whatever the receiver already had when it resumed, and where
+			// the stream ends for a receiver that asked for a range.
+			uint64_t basePos = 0;
+			uint64_t endPos = (std::numeric_limits<uint64_t>::max)();
+
+			// Of the stream, only for receivers that asked for it.
+			uint64_t fingerprint = 0;
+
+			// Path MTU discovery, the largest probe answered so far.
+			uint16_t probedSz = 0;
+			int probeRound = 0;
+			Clock::time_point probeAt;
+			Clock::time_point probeAckAt;
+
+			// Push mode progress, every packet before ackID has been received.
+			uint64_t nextPushID = 0;
+			uint64_t ackID = 0;
+			uint64_t pushEndID = (std::numeric_limits<uint64_t>::max)();
+			Clock::time_point lastPushAt;
+
+			// Packets past ackID the last report said have arrived, they no longer count against the congestion window.
+			uint64_t arrived = 0;
+
+			std::deque<uint64_t> resendQueue;
+			std::map<uint64_t, Clock::time_point> resentAt;
+
+			// Push mode rate control, null if only the receiver's window limits the push.
+			std::unique_ptr<CongestionController> congestion;
+			Pacer pacer;
+
+			// When every packet from ackID on was first pushed, resent ones aren't timed since the answer is ambiguous.
+			std::deque<Clock::time_point> pushedAt;
+
+			// Repairs of the group being pushed, fecRepairCount of them built up as its packets go out.
+			uint64_t fecFirstID = 0;
+			int fecRepairCount = 0;
+			uint16_t fecLastLen = 0;
+			std::vector<BYTE> fecRepairs;
+
+			// Loss the receiver sees before rebuilding anything, and how many packets it said it rebuilt so far.
+			double fecLossRate = 0.0;
+			uint32_t fecRecovered = 0;
+
+			// CRC of the stream from digestFrom to digestPos, carried along as payloads are first served in order. A
+			// receiver asking for the digest of just that range needs nothing read again.
+			uint64_t digestFrom = 0;
+			uint64_t digestPos = 0;
+			uint32_t digest = 0;
+
+			// Reads the stream from basePos on, null without read-ahead. Declared after the stream, so it stops before that goes.
+			std::unique_ptr<ReadAhead<TStream>> readAhead;
+		};
+
+	private:
+		/// Reactor::Handler.
+
+		SOCKET GetSocket() const override
+		{
+			return peer;
+		}
+
+		Clock::time_point GetDeadline() const override
+		{
+			// Due right away once asked to stop, OnTimer then lets go of the sender.
+			if (bShouldStop)
+			{
+				return Clock::time_point::min();
+			}
+
+			Clock::time_point deadline = Clock::time_point::max();
+			for (auto& [key, session] : sessions)
+			{
+				deadline = (std::min)(deadline, GetDeadline(session));
+			}
+
+			return deadline;
+		}
+
+		Clock::time_point GetDeadline(const Session& session) const
+		{
+			Clock::time_point deadline = Clock::time_point::max();
+
+			if (session.state == State::probing)
+			{
+				// Larger probes that went out together should have been answered within another round trip, a round
+				// nothing answered is repeated after the timeout.
+				deadline = (session.probeAckAt != Clock::time_point()) ?
+					(session.probeAckAt + (session.probeAckAt - session.probeAt) + std::chrono::milliseconds(1)) :
+					(session.probeAt + session.rtt.GetRto());
+			}
+			// Resending the handshake until the receiver says anything.
+			else if (session.state == State::handshaking)
+			{
+				deadline = session.handshakeAt + session.rtt.GetRto();
+			}
+			// As long as the window has room, the push goes on as soon as the pacer lets it.
+			else if ((session.mode == TransferMode::push) && HasPushWork(session))
+			{
+				deadline = session.pacer.GetReadyAt(session.packetSz);
+			}
+
+			if (IsServer())
+			{
+				deadline = (std::min)(deadline, session.lastHeardAt + SESSION_idleTimeouts * GetRetryInterval());
+			}
+
+			return deadline;
+		}
+
+		bool OnReadable() override
+		{
+			if (bShouldStop)
+			{
+				return false;
+			}
+
+			// A reactor may report a socket an earlier run already drained, waiting on it would hold the worker.
+			const timeval noWait = { 0, 0 };
+			if (!DataAvailable(peer, noWait, this))
+			{
+				return !bExInit;
+			}
+
+			// Draining every message that is already waiting, each slot goes in with its full capacity.
+			for (size_t i = 0; i < inbox.size(); ++i)
+			{
+				inbox[i].data = reinterpret_cast<char*>(inboxData.data() + i * INM_maxSz);
+				inbox[i].len  = INM_maxSz;
+			}
+
+			int received;
+			if (!ReceiveDataBatch(peer, timeout, this, bShouldStop, bExInit, inbox.data(), (int) inbox.size(), NULL, &received))
+			{
+				return !bExInit;
+			}
+
+			uint64_t receivedBytes = 0;
+			for (int i = 0; i < received; ++i)
+			{
+				receivedBytes += inbox[i].len;
+			}
+
+			stats.AddReceived(received, receivedBytes);
+
+			// Sessions that have to be answered once the batch has been handled, a replaced session is just skipped.
+			std::vector<std::pair<uint64_t, bool>> touched;
+
+			for (int i = 0; i < received; ++i)
+			{
+				const BYTE* inData = reinterpret_cast<const BYTE*>(inbox[i].data);
+
+				Session* session = FindSession(inData, inbox[i].len, inbox[i].addr);
+				if (session == nullptr)
+				{
+					if (bExInit) { return false; }
+
+					continue;
+				}
+
+				session->lastHeardAt = Clock::now();
+
+				bool bRehandshake = !ParseMessage(*session, inData, inbox[i].len);
+				if (bExInit)
+				{
+					// Whatever was answered so far still goes out.
+					FlushPayloads();
+					return false;
+				}
+
+				uint64_t key = AddressKey(inbox[i].addr);
+				auto it = std::find_if(touched.begin(), touched.end(), [key](auto& entry) { return entry.first == key; });
+				if (it == touched.end())
+				{
+					touched.emplace_back(key, bRehandshake);
+				}
+				else
+				{
+					it->second = it->second || bRehandshake;
+				}
+			}
+
+			if (!FlushPayloads())
+			{
+				return false;
+			}
+
+			for (auto& [key, bRehandshake] : touched)
+			{
+				auto it = sessions.find(key);
+				if (it == sessions.end())
+				{
+					continue;
+				}
+
+				Session* session = &it->second;
+				if (session->state == State::probing)
+				{
+					// The handshake follows once probing is over, the largest probe being answered ends it early.
+					if ((session->probedSz == GetLargestProbe()) && !SendHandshake(*session)) { return false; }
+
+					continue;
+				}
+
+				if (bRehandshake)
+				{
+					if (!StartHandshake(*session)) { return false; }
+
+					continue;
+				}
+
+				// Anything from the peer means it has seen our handshake.
+				if ((session->state == State::handshaking) && session->bAcknowledged)
+				{
+					session->state = State::serving;
+
+					if (!session->bHandshakeUntimed)
+					{
+						AddRttSample(*session, Clock::now() - session->handshakeAt);
+					}
+				}
+
+				if ((session->state == State::serving) && (session->mode == TransferMode::push))
+				{
+					if (!PushPackets(*session)) { return false; }
+				}
+			}
+
+			return !bExInit;
+		}
+
+		bool OnTimer() override
+		{
+			if (bShouldStop)
+			{
+				return false;
+			}
+
+			auto now = Clock::now();
+
+			for (auto it = sessions.begin(); it != sessions.end();)
+			{
+				Session& session = it->second;
+
+				if (IsServer() && (now - session.lastHeardAt >= SESSION_idleTimeouts * GetRetryInterval()))
+				{
+					it = sessions.erase(it);
+					continue;
+				}
+
+				if (GetDeadline(session) <= now)
+				{
+					if (session.state == State::probing)
+					{
+						bool bAnswered = (session.probeAckAt != Clock::time_point());
+						if (!bAnswered)
+						{
+							RecordTimeout(session);
+						}
+
+						bool bSettled = bAnswered || (session.probeRound + 1 >= PMTU_maxRounds);
+						if (!(bSettled ? SendHandshake(session) : SendProbes(session))) { return false; }
+					}
+					else if (session.state == State::handshaking)
+					{
+						RecordTimeout(session);
+						if (!SendHandshake(session)) { return false; }
+					}
+					else if (session.mode == TransferMode::push)
+					{
+						if (!PushPackets(session)) { return false; }
+					}
+				}
+
+				++it;
+			}
+
+			return !bExInit;
+		}
+
+		void OnDetached() override
+		{
+			Finish();
+		}
+
+	private:
+		// Creating and binding the socket, then waiting for handshakes.
+		bool Open()
+		{
+			// Creating the socket.
+			if ((peer = socket(AF_INET, SOCK_DGRAM, IPPROTO_UDP)) == INVALID_SOCKET)
+			{
+				InitEx("Failed the socket.", LastError());
+				return false;
+			}
+
+			// Binding the socket.
+			SOCKADDR_IN anyAddr;
+			ZeroMemory(&anyAddr, sizeof(anyAddr));
+
+			anyAddr.sin_family		= AF_INET;
+			anyAddr.sin_port		= htons(port);
+			anyAddr.sin_addr.s_addr = htonl(INADDR_ANY);
+
+			if (bind(peer, reinterpret_cast<const sockaddr*>(&anyAddr), sizeof(anyAddr)) == SOCKET_ERROR)
+			{
+				InitEx("Failed the bind.", LastError());
+				return false;
+			}
+
+			// A whole batch of the largest packets has to fit into the socket buffer.
+			GrowSocketBuffer(peer, SO_SNDBUF, 2 * BATCH_maxDatagrams * slotSz);
+
+			bSegmentation = options.bSegmentation && EnableSegmentation(peer, packetSz);
+
+			// Probes must not be fragmented, whatever is larger than the path allows has to get lost.
+			bProbing = options.bPathMtuDiscovery && (GetLargestProbe() > packetSz) && SetDontFragment(peer);
+
+			Tracer::Record(TraceEventType::senderOpened, traceID, 0, port);
+			return true;
+		}
+
+		// Every packet slot has room for the largest packet a session may settle on.
+		static uint16_t GetSlotSize(uint16_t _packetSz, const SenderOptions& _options)
+		{
+			return _options.bPathMtuDiscovery ? (std::max)(_packetSz, _options.maxPacketSz) : _packetSz;
+		}
+
+		FORCEINLINE uint16_t GetLargestProbe() const
+		{
+			uint16_t largest = 0;
+			for (uint16_t candidate : PMTU_candidates)
+			{
+				if (candidate <= options.maxPacketSz)
+				{
+					largest = (std::max)(largest, candidate);
+				}
+			}
+
+			// Limits which aren't a common MTU are probed as well.
+			if ((options.maxPacketSz > largest) && (options.maxPacketSz > packetSz))
+			{
+				largest = options.maxPacketSz;
+			}
+
+			return largest;
+		}
+
+		FORCEINLINE bool IsServer() const { return static_cast<bool>(factory); }
+
+		// Looks the sender of a message up, a handshake from someone new opens a session for them.
+		Session* FindSession(const BYTE* data, int dataLen, const SOCKADDR_IN& from)
+		{
+			uint64_t key = AddressKey(from);
+
+			auto it = sessions.find(key);
+			if (it != sessions.end())
+			{
+				return &it->second;
+			}
+
+			if ((dataLen < (int) WireHandshake::end<WireHandshake::type>) || (WireHandshake::Get<WireHandshake::type>(data) != INM_handshake))
+			{
+				return nullptr;
+			}
+
+			std::unique_ptr<TStream> sessionStream;
+			if (IsServer())
+			{
+				if (sessions.size() >= maxSessions)
+				{
+					return nullptr;
+				}
+
+				// A peer whose stream can't be opened is turned away, every other peer's transfer goes on.
+				try
+				{
+					sessionStream.reset(factory(from));
+				}
+				catch (const std::exception&)
+				{
+					return nullptr;
+				}
+
+				if (sessionStream.get() == nullptr)
+				{
+					return nullptr;
+				}
+			}
+			else
+			{
+				// A single receiver may come back from a new port, it takes the stream over.
+				if (!sessions.empty())
+				{
+					sessionStream = std::move(sessions.begin()->second.stream);
+					sessions.clear();
+				}
+				else
+				{
+					sessionStream = std::move(stream);
+				}
+			}
+
+			// A mapped file that failed to open would otherwise be served as an empty stream.
+			if constexpr (std::is_base_of<MappedFile, TStream>::value)
+			{
+				if ((sessionStream.get() != nullptr) && !sessionStream->IsOpen())
+				{
+					if (!IsServer())
+					{
+						InitEx("Failed to open the mapped file.", -1);
+					}
+
+					return nullptr;
+				}
+			}
+
+			Session& session = sessions[key];
+			session.peerAddr = from;
+			session.rtt = RttEstimator(GetRetryInterval());
+			session.stream = std::move(sessionStream);
+
+			return &session;
+		}
+
+		// Picks the transfer mode the receiver asked for, returns false if it isn't a handshake.
+		bool ParseHandshake(Session& session, const BYTE* data, int dataLen)
+		{
+			if ((dataLen < (int) WireHandshake::end<WireHandshake::type>) || (WireHandshake::Get<WireHandshake::type>(data) != INM_handshake))
+			{
+				return false;
+			}
+
+			// Receivers which don't negotiate only know how to pull.
+			session.mode = TransferMode::pull;
+			session.pushWindow = 1;
+
+			if (dataLen >= (int) WireHandshake::end<WireHandshake::window>)
+			{
+				session.pushWindow = WireHandshake::Get<WireHandshake::window>(data);
+
+				if (WireHandshake::Get<WireHandshake::mode>(data) == static_cast<uint8_t>(TransferMode::push))
+				{
+					session.mode = TransferMode::push;
+				}
+
+				session.pushWindow = (std::max)(session.pushWindow, static_cast<uint16_t>(1));
+			}
+
+			// Newer receivers add what they understand and where they want to start.
+			session.bFlags = (dataLen >= (int) WireHandshake::size);
+			session.flags = 0;
+			session.basePos = 0;
+			session.endPos = (std::numeric_limits<uint64_t>::max)();
+			session.version = 0;
+
+			if (session.bFlags)
+			{
+				session.flags = WireHandshake::Get<WireHandshake::flags>(data);
+				session.basePos = WireHandshake::Get<WireHandshake::basePos>(data);
+
+				// A range without its end is served to the end of the stream, receivers from before the version leave it out.
+				WireReader tail(data, dataLen, WireHandshake::size);
+				if (!(session.flags & HS_range) || tail.Read(session.endPos))
+				{
+					tail.Read(session.version);
+				}
+
+				session.version = (std::min)(session.version, WIRE_version);
+			}
+
+			if (session.flags & HS_fingerprint)
+			{
+				session.fingerprint = GetFingerprint(session);
+			}
+
+			session.bCompress = options.bCompression && (session.flags & HS_compress);
+			session.bChecksum = options.bChecksums && (session.flags & HS_checksum);
+			session.digestFrom = session.digestPos = session.basePos;
+			session.digest = 0;
+
+			// Repairs only make sense for pushed packets.
+			session.bFec = options.bFec && (session.flags & HS_fec) && (session.mode == TransferMode::push);
+			session.fecFirstID = 0;
+			session.fecRepairCount = 0;
+			session.fecRecovered = 0;
+
+			// Starting the push over, the receiver has nothing past basePos yet.
+			session.nextPushID = 0;
+			session.ackID = 0;
+			session.pushEndID = (std::numeric_limits<uint64_t>::max)();
+			session.arrived = 0;
+			session.resendQueue.clear();
+			session.resentAt.clear();
+			session.pushedAt.clear();
+
+			session.congestion.reset(MakeCongestionController());
+			session.pacer = Pacer();
+
+			if constexpr (!IsMappedStream<TStream>::value)
+			{
+				StartReadAhead(session);
+			}
+
+			return true;
+		}
+
+		// Reads ahead from wherever the receiver wants to start now. A handshake repeated for the same range keeps what
+		// was read so far, and sessions past maxReadAheads go without.
+		void StartReadAhead(Session& session)
+		{
+			if (!options.bReadAhead)
+			{
+				return;
+			}
+
+			if (session.readAhead && (session.readAhead->GetStartPos() == session.basePos) &&
+				(session.readAhead->GetEndPos() == session.endPos))
+			{
+				return;
+			}
+
+			session.readAhead.reset();
+
+			size_t readAheads = 0;
+			for (auto& [key, other] : sessions)
+			{
+				readAheads += other.readAhead ? 1 : 0;
+			}
+
+			if (readAheads < options.maxReadAheads)
+			{
+				session.readAhead.reset(new ReadAhead<TStream>(session.stream.get(), session.basePos, session.endPos));
+			}
+		}
+
+		CongestionController* MakeCongestionController() const
+		{
+			if (options.customCongestion)
+			{
+				return options.customCongestion();
+			}
+
+			switch (options.congestion)
+			{
+			case CongestionControl::cubic:
+				return new CubicController();
+			case CongestionControl::delay:
+				return new DelayController();
+			default:
+				return nullptr;
+			}
+		}
+
+		// Probes the path first if the receiver can answer, a path that was lost is probed again.
+		bool StartHandshake(Session& session)
+		{
+			bool bProbe = bProbing && (session.flags & HS_probes) &&
+						  ((session.pathSz == 0) || (session.flags & HS_reprobe));
+
+			if (!bProbe)
+			{
+				return SendHandshake(session);
+			}
+
+			session.probedSz = packetSz;
+			session.probeRound = -1;
+
+			return SendProbes(session);
+		}
+
+		// Sends every probe larger than what has been answered, a few times each since probes get lost like anything else.
+		bool SendProbes(Session& session)
+		{
+			session.state = State::probing;
+			session.probeAt = Clock::now();
+			session.probeAckAt = Clock::time_point();
+			++session.probeRound;
+
+			uint16_t largest = GetLargestProbe();
+			for (uint16_t probeSz : PMTU_candidates)
+			{
+				if ((probeSz > session.probedSz) && (probeSz < largest) && !SendProbe(session, probeSz)) { return false; }
+			}
+
+			return SendProbe(session, largest);
+		}
+
+		// A probe is its type and size padded to that size, sent with the don't fragment bit set.
+		bool SendProbe(Session& session, uint16_t probeSz)
+		{
+			if (probeSz <= session.probedSz)
+			{
+				return true;
+			}
+
+			// The payload slots are free between batches, the first one is large enough for any probe.
+			BYTE* data = packet.data();
+			WireProbe::Write(data, OUTM_probe, probeSz);
+			ZeroMemory(data + WireProbe::size, probeSz - WireProbe::size);
+
+			for (int i = 0; i < PMTU_probeCopies; ++i)
+			{
+				if (bShouldStop) { return false; }
+
+				// Probes larger than the local interface allows fail right away, that is just another lost probe.
+				if (sendto(peer, reinterpret_cast<const char*>(data), probeSz, 0,
+						   reinterpret_cast<const sockaddr*>(&session.peerAddr), sizeof(session.peerAddr)) == SOCKET_ERROR)
+				{
+					break;
+				}
+
+				stats.AddSent(1, probeSz);
+			}
+
+			return true;
+		}
+
+		// Records the answer to a probe, false if it is malformed.
+		bool ParseProbeAck(Session& session, const BYTE* data, int dataLen)
+		{
+			if (dataLen != (int) WireProbe::size)
+			{
+				return false;
+			}
+
+			const uint16_t probeSz = WireProbe::Get<WireProbe::probeSz>(data);
+
+			// Answers that come late, or to probes we never sent, are ignored.
+			if ((session.state != State::probing) || (probeSz > GetLargestProbe()))
+			{
+				return true;
+			}
+
+			if (probeSz > session.probedSz)
+			{
+				session.probedSz = probeSz;
+			}
+
+			if (session.probeAckAt == Clock::time_point())
+			{
+				session.probeAckAt = Clock::now();
+
+				// Later rounds may be answered by late copies of earlier probes, only the first one is timed.
+				if (session.probeRound == 0)
+				{
+					AddRttSample(session, session.probeAckAt - session.probeAt);
+				}
+			}
+
+			return true;
+		}
+
+		// Sends the handshake once, the timer sends it again until the receiver answers.
+		bool SendHandshake(Session& session)
+		{
+			// A probed path settles on the largest probe that got through.
+			if (session.state == State::probing)
+			{
+				session.pathSz = (std::max)(session.probedSz, packetSz);
+			}
+			else if (session.pathSz == 0)
+			{
+				session.pathSz = packetSz;
+			}
+
+			// Repairs still have to fit the path.
+			session.packetSz = session.pathSz - (session.bFec ? FEC_repairExtra : 0);
+
+			// What was agreed to, only for receivers that sent flags of their own.
+			const uint8_t accepted = HS_resume | (session.flags & (HS_range | HS_fingerprint)) | (session.bFec ? HS_fec : 0) |
+									 (session.bCompress ? HS_compress : 0) | (session.bChecksum ? HS_checksum : 0);
+
+			BYTE data[WireHandshakeAnswer::size + sizeof(uint64_t) + sizeof(uint64_t) + sizeof(uint8_t) + sizeof(uint8_t)];
+			WireHandshakeAnswer::Write(data, OUTM_handshake, session.packetSz, static_cast<uint8_t>(session.mode), accepted);
+
+			// Older receivers get no more than the mode.
+			WireWriter tail(data, session.bFlags ? WireHandshakeAnswer::size : WireHandshakeAnswer::end<WireHandshakeAnswer::mode>);
+			if (session.bFlags)
+			{
+				// The stream's size for receivers that asked for a range, its fingerprint for those that asked for it and
+				// the size of a repair group for those that asked for repairs.
+				if (accepted & HS_range)
+				{
+					tail.Write(GetStreamSize(session));
+				}
+
+				if (accepted & HS_fingerprint)
+				{
+					tail.Write(session.fingerprint);
+				}
+
+				if (accepted & HS_fec)
+				{
+					tail.Write(GetFecGroupSize());
+				}
+
+				tail.Write(WIRE_version);
+			}
+
+			const int dataLen = tail.GetLength();
+
+			// Resending it while the receiver hasn't answered leaves the answer ambiguous.
+			session.bHandshakeUntimed = (session.state == State::handshaking);
+			session.state = State::handshaking;
+			session.handshakeAt = Clock::now();
+			session.bAcknowledged = false;
+
+			stats.AddSent(1, dataLen);
+			Tracer::Record(TraceEventType::handshakeSent, traceID, 0, session.basePos);
+			return SendData(peer, this, bShouldStop, reinterpret_cast<const char*>(data), dataLen, NULL,
+							reinterpret_cast<const sockaddr*>(&session.peerAddr), sizeof(session.peerAddr));
+		}
+
+		// Keeps the session's read-ahead off the stream while it is used directly, locks nothing without read-ahead.
+		FORCEINLINE std::unique_lock<std::mutex> LockStream(Session& session)
+		{
+			return session.readAhead ? session.readAhead->LockStream() : std::unique_lock<std::mutex>();
+		}
+
+		// The size of the session's stream, the maximum if the stream can't tell.
+		uint64_t GetStreamSize(Session& session)
+		{
+			TStream* stream = session.stream.get();
+
+			if constexpr (IsMappedStream<TStream>::value)
+			{
+				return stream->GetSize();
+			}
+			else if constexpr (IsSeekableStream<TStream>::value)
+			{
+				auto lock = LockStream(session);
+				try
+				{
+					stream->clear();
+					stream->seekg(0, std::ios::end);
+
+					auto end = stream->tellg();
+					stream->clear();
+
+					if (static_cast<std::streamoff>(end) >= 0)
+					{
+						return static_cast<uint64_t>(static_cast<std::streamoff>(end));
+					}
+				}
+				catch (const std::exception&)
+				{
+					stream->clear();
+				}
+			}
+
+			return (std::numeric_limits<uint64_t>::max)();
+		}
+
+		// Hashes the stream's size and samples spread evenly across it. Cheap enough for every handshake, and any change
+		// to the size or to a sampled block tells a resuming receiver the stream isn't what it checkpointed.
+		uint64_t GetFingerprint(Session& session)
+		{
+			const uint64_t streamSz = GetStreamSize(session);
+			uint64_t hash = Fnv1a(&streamSz, sizeof(streamSz));
+
+			// Streams that can't tell their size are only sampled at the start.
+			const bool bSized = (streamSz != (std::numeric_limits<uint64_t>::max)());
+			const int sampleCount = bSized ? FP_samples : 1;
+
+			BYTE sample[FP_sampleSz];
+			for (int i = 0; i < sampleCount; ++i)
+			{
+				uint64_t samplePos = bSized ? (streamSz / sampleCount * i) : 0;
+				uint64_t sampleLen = bSized ? (std::min)(static_cast<uint64_t>(FP_sampleSz), streamSz - samplePos) : FP_sampleSz;
+
+				if constexpr (IsMappedStream<TStream>::value)
+				{
+					if (sampleLen > 0)
+					{
+						hash = Fnv1a(session.stream->GetData() + samplePos, static_cast<size_t>(sampleLen), hash);
+					}
+				}
+				else
+				{
+					auto lock = LockStream(session);
+					try
+					{
+						TStream* stream = session.stream.get();
+
+						stream->clear();
+						stream->seekg(samplePos);
+						stream->read(sample, static_cast<std::streamsize>(sampleLen));
+
+						hash = Fnv1a(sample, static_cast<size_t>(stream->gcount()), hash);
+						stream->clear();
+					}
+					catch (const std::exception&)
+					{
+						session.stream->clear();
+					}
+				}
+			}
+
+			return hash;
+		}
+
+	private:
+		// Handles a single message from the session's receiver, returns false if the handshake has to be sent again.
+		bool ParseMessage(Session& session, const BYTE* inData, int inLen)
+		{
+			if (inLen < (int) WireRequest::end<WireRequest::type>)
+			{
+				session.bAcknowledged = true;
+				return true;
+			}
+
+			const uint8_t msgType = WireRequest::Get<WireRequest::type>(inData);
+
+			// Probes are answered before the receiver has our handshake, so their answers don't count as noticing it.
+			if (msgType == INM_probeAck)
+			{
+				if (!ParseProbeAck(session, inData, inLen))
+				{
+					return DropMalformed("Corrupt probe answer.");
+				}
+
+				return true;
+			}
+
+			// If the actual peer sent you a message, then you have been noticed.
+			session.bAcknowledged = true;
+
+			// The receiver hasn't seen our handshake yet.
+			if (msgType == INM_handshake)
+			{
+				ParseHandshake(session, inData, inLen);
+				return false;
+			}
+
+			if (msgType == INM_nack)
+			{
+				if (!ParseReport(session, inData, inLen))
+				{
+					return DropMalformed("Corrupt report.");
+				}
+
+				return true;
+			}
+
+			if (msgType == INM_digest)
+			{
+				return SendDigest(session, inData, inLen);
+			}
+
+			// Verifing the integrity of the request.
+			if ((msgType != INM_request) || (inLen != (int) WireRequest::size))
+			{
+				return DropMalformed("Corrupt request.");
+			}
+
+			const uint64_t packetID = WireRequest::Get<WireRequest::packetID>(inData);
+			const uint64_t pos = WireRequest::Get<WireRequest::pos>(inData);
+			const uint16_t packetLen = WireRequest::Get<WireRequest::packetLen>(inData);
+
+			if ((packetLen > session.packetSz) || (packetLen < GetPayloadHeaderSize(session)))
+			{
+				return DropMalformed("Corrupt request.");
+			}
+
+			Tracer::Record(TraceEventType::requestReceived, traceID, packetID, pos);
+			return QueuePayload(session, packetID, pos, packetLen);
+		}
+
+		// A malformed message fails a sender serving a single receiver. A server drops it instead, a single datagram from
+		// whoever sent it mustn't end every other peer's transfer. Returns true, there is nothing to handshake again.
+		bool DropMalformed(const std::string& err)
+		{
+			if (!IsServer())
+			{
+				InitEx(err, -1);
+			}
+
+			return true;
+		}
+
+		// Reads packetLen bytes worth of payload from pos into the next free slot, bEnd is set if the stream ran out. With
+		// compression that is the size of the block uncompressed, it is sent compressed whenever that comes out smaller.
+		bool QueuePayload(Session& session, uint64_t packetID, uint64_t pos, uint16_t packetLen, bool* bEnd = nullptr)
+		{
+			if ((queued == BATCH_maxDatagrams) && !FlushPayloads())
+			{
+				return false;
+			}
+
+			Tracer::Record(TraceEventType::payloadSent, traceID, packetID, pos);
+
+			BYTE* slot = packet.data() + queued * slotSz;
+
+			// The checksum, if any, is stamped once the payload is complete.
+			WirePayload::Write(slot, OUTM_payload, packetID);
+
+			outbox[queued].data = reinterpret_cast<char*>(slot);
+			outbox[queued].addr = session.peerAddr;
+
+			// Receivers that asked for a range get a short packet where it ends, just like at the end of the stream.
+			const uint16_t bodyOffset = GetBodyOffset(session);
+			const uint64_t dataLen = packetLen - GetPayloadHeaderSize(session);
+			const uint64_t wanted = (pos < session.endPos) ? (std::min)(session.endPos - pos, dataLen) : 0;
+
+			// Mapped streams are sent straight out of the mapping, only the header goes through the slot.
+			if constexpr (IsMappedStream<TStream>::value)
+			{
+				const TStream* stream = session.stream.get();
+
+				uint64_t available = (pos < stream->GetSize()) ? (std::min)(stream->GetSize() - pos, wanted) : 0;
+
+				if (bEnd != nullptr)
+				{
+					(*bEnd) = (available < dataLen);
+				}
+
+				if (session.bCompress)
+				{
+					outbox[queued].len		= EncodeBlock(session, slot, stream->GetData() + pos, static_cast<size_t>(available));
+					outbox[queued].body		= nullptr;
+					outbox[queued].bodyLen	= 0;
+				}
+				else
+				{
+					outbox[queued].len		= bodyOffset;
+					outbox[queued].body		= (available > 0) ? reinterpret_cast<const char*>(stream->GetData() + pos) : nullptr;
+					outbox[queued].bodyLen	= static_cast<int>(available);
+				}
+
+				if (session.bChecksum)
+				{
+					AddToDigest(session, pos, stream->GetData() + pos, static_cast<size_t>(available));
+					StampChecksum(outbox[queued]);
+				}
+
+				++queued;
+
+				return true;
+			}
+
+			// Reading data from the stream, blocks to compress are read aside first.
+			BYTE* raw = session.bCompress ? block.data() : (slot + bodyOffset);
+			size_t rawLen = static_cast<size_t>(dataLen);
+			const auto readAt = Clock::now();
+			Tracer::Record(TraceEventType::streamBegin, traceID, packetID, wanted);
+			try
+			{
+				TStream* stream = session.stream.get();
+
+				if (session.readAhead)
+				{
+					rawLen = session.readAhead->Read(pos, raw, static_cast<size_t>(wanted));
+				}
+				else
+				{
+					stream->clear();
+					stream->seekg(pos);
+					stream->read(raw, static_cast<std::streamsize>(wanted));
+
+					// Pipelined receivers may ask for positions past the end, which only fail the seek.
+					if (stream->eof() || stream->fail() || (wanted < dataLen))
+					{
+						rawLen = static_cast<size_t>(stream->gcount());
+						stream->clear();
+					}
+				}
+			}
+			catch (const std::exception& ex)
+			{
+				std::string err = std::string("Failed some stream operation with message:'") + std::string(ex.what()) + std::string("'");
+				InitEx(err, -1);
+				return false;
+			}
 
-/// CUSTOM
-#include "UDPRDebugHeaders.h"
-#include "UDPRMisc.h"
+			stats.AddStreamTime(Clock::now() - readAt);
+			Tracer::Record(TraceEventType::streamEnd, traceID, packetID, rawLen);
 
-namespace UDPR
-{
-	template<class TStream>
-	class StreamSender
-	{
-	public:
-		/// Outgoing messages.
-		static const uint8_t OUTM_handshake = 0;
-		static const uint8_t OUTM_payload   = 1;
+			if (bEnd != nullptr)
+			{
+				(*bEnd) = (rawLen < dataLen);
+			}
 
-		/// Incoming messages.
-		static const uint8_t INM_handshake = 0;
-		static const uint8_t INM_request   = 1;
+			outbox[queued].len		= session.bCompress ? EncodeBlock(session, slot, raw, rawLen) : static_cast<int>(bodyOffset + rawLen);
+			outbox[queued].body		= nullptr;
+			outbox[queued].bodyLen	= 0;
 
-	public:
-		StreamSender(TStream* _stream, uint16_t _port, uint16_t _packetSz = 508, const timeval& _timeout = { 0, 500 * 1000 }) :
-			packet(_packetSz),
-			peer(INVALID_SOCKET),
-			peerAddr {  },
-			packetSz(_packetSz),
-			port(_port),
-			timeout(_timeout),
-			stream(_stream),
-			bShouldStop(false),
-			bAcknowledged(false),
-			bFinished(false),
-			process(&StreamSender::Send, this)
+			if (session.bChecksum)
+			{
+				AddToDigest(session, pos, raw, rawLen);
+				StampChecksum(outbox[queued]);
+			}
+
+			++queued;
+
+			return true;
+		}
+
+		// Writes the block after the slot's payload header, compressed if that makes it smaller. Returns the packet's length.
+		int EncodeBlock(const Session& session, BYTE* slot, const BYTE* raw, size_t rawLen)
 		{
+			const uint16_t bodyOffset = GetBodyOffset(session);
+			BYTE* body = slot + bodyOffset;
+
+			// The encoding, then the compressed length and the compressed block itself.
+			const size_t lzHeaderSz = WireBlock::size;
+			size_t compressedLen = (rawLen > lzHeaderSz) ? LzCodec::Compress(raw, rawLen, body + lzHeaderSz, rawLen - lzHeaderSz) : 0;
+
+			if (compressedLen > 0)
+			{
+				WireBlock::Write(body, BLOCK_lz, static_cast<uint16_t>(compressedLen));
+				return static_cast<int>(bodyOffset + lzHeaderSz + compressedLen);
+			}
+
+			const size_t storedHeaderSz = WireBlock::end<WireBlock::encoding>;
+			WireBlock::Set<WireBlock::encoding>(body, BLOCK_stored);
+			if (rawLen > 0)
+			{
+				std::memcpy(reinterpret_cast<void*>(body + storedHeaderSz), reinterpret_cast<const void*>(raw), rawLen);
+			}
+
+			return static_cast<int>(bodyOffset + storedHeaderSz + rawLen);
 		}
 
-		~StreamSender()
+		// Checksums the packet ID and everything after the checksum, including a body sent from elsewhere.
+		void StampChecksum(const Datagram& datagram)
 		{
-			Stop();
+			BYTE* data = reinterpret_cast<BYTE*>(datagram.data);
+			const int checkedFrom = WireChecksummedPayload::size;
+
+			uint32_t crc = Crc32c::Compute(data + WireChecksummedPayload::offset<WireChecksummedPayload::packetID>, sizeof(uint64_t));
+			crc = Crc32c::Compute(data + checkedFrom, datagram.len - checkedFrom, crc);
+			if (datagram.body != nullptr)
+			{
+				crc = Crc32c::Compute(datagram.body, datagram.bodyLen, crc);
+			}
+
+			WireChecksummedPayload::Set<WireChecksummedPayload::checksum>(data, crc);
 		}
 
-		void Stop()
+		// Carries the digest along if the payload continues it, which is how payloads are first served.
+		FORCEINLINE void AddToDigest(Session& session, uint64_t pos, const BYTE* raw, size_t rawLen)
 		{
-			if (process.joinable())
+			if ((pos == session.digestPos) && (rawLen > 0))
 			{
-				bShouldStop = true;
-				process.join();
-				bShouldStop = false;
+				session.digest = Crc32c::Compute(raw, rawLen, session.digest);
+				session.digestPos += rawLen;
 			}
 		}
 
-	private:
-		void Cleanup()
+		// Answers a request for the CRC of the stream between two positions, malformed ones are dropped.
+		bool SendDigest(Session& session, const BYTE* data, int dataLen)
 		{
-			if (stream.get() != nullptr)
+			if (!session.bChecksum || (dataLen != DIGEST_requestSz))
 			{
-				delete stream.release();
+				return DropMalformed("Corrupt digest request.");
 			}
-			
-			if (peer != INVALID_SOCKET)
+
+			const uint64_t from = WireDigestRequest::Get<WireDigestRequest::from>(data);
+			const uint64_t to = WireDigestRequest::Get<WireDigestRequest::to>(data);
+
+			if (from > to)
 			{
-				closesocket(peer);
-				peer = INVALID_SOCKET;
+				return DropMalformed("Corrupt digest request.");
 			}
+
+			uint32_t digest;
+			if (!GetDigest(session, from, to, digest))
+			{
+				return false;
+			}
+
+			BYTE answer[DIGEST_answerSz];
+			WireDigest::Write(answer, OUTM_digest, from, to, digest);
+
+			stats.AddSent(1, sizeof(answer));
+			return SendData(peer, this, bShouldStop, reinterpret_cast<const char*>(answer), sizeof(answer), NULL,
+							reinterpret_cast<const sockaddr*>(&session.peerAddr), sizeof(session.peerAddr));
 		}
 
-		void Send()
+		// The CRC of the stream in [from, to). Whatever the digest carried along doesn't cover is read again, all of it if
+		// the receiver started elsewhere, as it does after a reprobe.
+		bool GetDigest(Session& session, uint64_t from, uint64_t to, uint32_t& digest)
 		{
-			/// WSAStartup.
+			const bool bCarried = (from == session.digestFrom) && (session.digestPos <= to);
+
+			uint64_t digestPos = bCarried ? session.digestPos : from;
+			digest = bCarried ? session.digest : 0;
+
+			if constexpr (IsMappedStream<TStream>::value)
 			{
-				WSADATA wsaData;
-				ZeroMemory(&wsaData, sizeof(wsaData));
+				const TStream* stream = session.stream.get();
 
-				if (int err; (err = WSAStartup(MAKEWORD(2, 2), &wsaData)) != 0)
+				const uint64_t end = (std::min)(to, stream->GetSize());
+				if (digestPos < end)
 				{
-					return InitEx("Failed the WSAStartup.", err);
+					digest = Crc32c::Compute(stream->GetData() + digestPos, static_cast<size_t>(end - digestPos), digest);
+					digestPos = end;
 				}
 			}
-
-			HandShake();
-
-			if (!bExInit)
+			else
 			{
-				while (!SendStream())
+				auto lock = LockStream(session);
+				try
 				{
-					if (bExInit) { break; }
+					TStream* stream = session.stream.get();
 
-					SendHandshake();
+					stream->clear();
+					stream->seekg(digestPos);
 
-					if (bExInit) { break; }
-				}
-			}
+					std::vector<BYTE> chunk(DIGEST_chunkSz);
+					while (digestPos < to)
+					{
+						stream->read(chunk.data(), static_cast<std::streamsize>((std::min)(static_cast<uint64_t>(DIGEST_chunkSz), to - digestPos)));
 
-			Cleanup();
+						const size_t readLen = static_cast<size_t>(stream->gcount());
+						digest = Crc32c::Compute(chunk.data(), readLen, digest);
+						digestPos += readLen;
 
-			/// WSACleanup.
-			{
-				while (WSACleanup() != 0)
-				{
-					int err = WSAGetLastError();
-					if ((err == WSANOTINITIALISED) || (err == WSAENETDOWN))
-					{
-						break;
+						if ((readLen == 0) || stream->eof() || stream->fail())
+						{
+							break;
+						}
 					}
+
+					stream->clear();
+				}
+				catch (const std::exception& ex)
+				{
+					std::string err = std::string("Failed some stream operation with message:'") + std::string(ex.what()) + std::string("'");
+					InitEx(err, -1);
+					return false;
 				}
 			}
 
-			bFinished = true;
+			// Answered again if the answer gets lost, which then reads nothing.
+			if (from == session.digestFrom)
+			{
+				session.digestPos = digestPos;
+				session.digest = digest;
+			}
+
+			return true;
 		}
 
-		template<class T>
-		friend bool UDPR::DataAvailable(SOCKET sock, const timeval& timeout, T* owner);
+		// Where the payload's body starts, past the header and the checksum if one was agreed on.
+		FORCEINLINE uint16_t GetBodyOffset(const Session& session) const
+		{
+			return static_cast<uint16_t>(session.bChecksum ? WireChecksummedPayload::size : WirePayload::size);
+		}
 
-		template<class T>
-		friend bool UDPR::WaitForData(SOCKET sock, const timeval& timeout, T* owner,
-									  const std::atomic_bool& bShouldStop, const std::atomic_bool& bExInit);
+		// The payload header, and the byte that tells how the block is encoded if compression was agreed on.
+		FORCEINLINE uint16_t GetPayloadHeaderSize(const Session& session) const
+		{
+			return static_cast<uint16_t>(GetBodyOffset(session) + (session.bCompress ? WireBlock::end<WireBlock::encoding> : 0));
+		}
 
-		template<class T>
-		friend bool UDPR::ReceiveData(SOCKET sock, const timeval& timeout, T* owner,
-									  const std::atomic_bool& bShouldStop, const std::atomic_bool& bExInit,
-									  char* data, int len, int flags, sockaddr* from, int* fromlen, int* packetLen);
-		
-		template<class T>
-		friend bool UDPR::SendData(SOCKET sock, T* owner,
-								   const std::atomic_bool& bShouldStop, const char* data, int len, 
-								   int flags, const sockaddr* to, int tolen);
+		// Sends every queued payload at once.
+		bool FlushPayloads()
+		{
+			int count = queued;
+			queued = 0;
+
+			uint64_t sentBytes = 0;
+			for (int i = 0; i < count; ++i)
+			{
+				sentBytes += outbox[i].len + outbox[i].bodyLen;
+			}
+
+			stats.AddSent(count, sentBytes);
+			return SendDataBatch(peer, this, bShouldStop, outbox.data(), count, NULL, &bSegmentation);
+		}
 
 	private:
-		void HandShake()
+		// Retransmissions first, then new packets until the receiver's window is full.
+		bool PushPackets(Session& session)
 		{
-			// Creating the socket.
-			if ((peer = socket(AF_INET, SOCK_DGRAM, IPPROTO_UDP)) == SOCKET_ERROR)
+			const uint64_t dataSz = session.packetSz - GetPayloadHeaderSize(session);
+			const auto now = Clock::now();
+
+			while (!session.resendQueue.empty())
 			{
-				return InitEx("Failed the socket.", WSAGetLastError());
+				uint64_t packetID = session.resendQueue.front();
+
+				if ((packetID < session.ackID) || (packetID > session.pushEndID))
+				{
+					session.resendQueue.pop_front();
+					continue;
+				}
+
+				if (!session.pacer.TryConsume(session.packetSz, now))
+				{
+					return FlushPayloads();
+				}
+
+				session.resendQueue.pop_front();
+				stats.retransmits.Add();
+				Tracer::Record(TraceEventType::retransmit, traceID, packetID);
+
+				if (!QueuePayload(session, packetID, session.basePos + packetID * dataSz, session.packetSz))
+				{
+					return false;
+				}
 			}
 
-			// Binding the socket.
-			SOCKADDR_IN anyAddr;
-			ZeroMemory(&anyAddr, sizeof(anyAddr));
+			bool bPaced = false;
+			while ((session.nextPushID <= session.pushEndID) && HasPushRoom(session))
+			{
+				if (!session.pacer.TryConsume(session.packetSz, now))
+				{
+					bPaced = true;
+					break;
+				}
+
+				bool bEnd;
+				if (!QueuePayload(session, session.nextPushID, session.basePos + session.nextPushID * dataSz, session.packetSz, &bEnd))
+				{
+					return false;
+				}
 
-			anyAddr.sin_family			 = AF_INET;
-			anyAddr.sin_port			 = htons(port);
-			anyAddr.sin_addr.S_un.S_addr = htonl(ADDR_ANY);
+				if (bEnd)
+				{
+					session.pushEndID = session.nextPushID;
+				}
 
-			if (bind(peer, reinterpret_cast<const sockaddr*>(&anyAddr), sizeof(anyAddr)) == SOCKET_ERROR)
+				if (session.bFec && !AddToRepairs(session, session.nextPushID, bEnd, now))
+				{
+					return false;
+				}
+
+				++session.nextPushID;
+				session.lastPushAt = now;
+				session.pushedAt.push_back(now);
+			}
+
+			// A full window won't let the group complete until the receiver acks, which may wait for the repairs.
+			if (session.bFec && !bPaced && (session.fecFirstID < session.nextPushID) && !QueueRepairs(session, session.nextPushID, now))
+			{
+				return false;
+			}
+
+			return FlushPayloads();
+		}
+
+		// Adds the payload just queued to the group's repairs, and queues the repairs once the group is complete.
+		bool AddToRepairs(Session& session, uint64_t packetID, bool bEnd, Clock::time_point now)
+		{
+			const size_t dataSz = session.packetSz - WirePayload::size;
+			const int index = static_cast<int>(packetID - session.fecFirstID);
+
+			if (index == 0)
+			{
+				session.fecRepairCount = GetFecRepairCount(session);
+				session.fecRepairs.assign(session.fecRepairCount * dataSz, 0);
+			}
+
+			// Everything after the packet ID is repaired, the checksum too. Mapped payloads are only referenced by the
+			// datagram, they follow whatever of the header is left.
+			const Datagram& datagram = outbox[queued - 1];
+			const BYTE* head = reinterpret_cast<const BYTE*>(datagram.data + WirePayload::size);
+			const size_t headLen = datagram.len - WirePayload::size;
+			const size_t bodyLen = (datagram.body != nullptr) ? datagram.bodyLen : 0;
+
+			for (int j = 0; j < session.fecRepairCount; ++j)
 			{
-				return InitEx("Failed the bind.", WSAGetLastError());
+				BYTE* repair = session.fecRepairs.data() + j * dataSz;
+				const BYTE coefficient = FecCodec::Coefficient(j, index);
+
+				FecCodec::MultiplyAdd(repair, head, headLen, coefficient);
+				if (bodyLen > 0)
+				{
+					FecCodec::MultiplyAdd(repair + headLen, reinterpret_cast<const BYTE*>(datagram.body), bodyLen, coefficient);
+				}
 			}
 
-			ReceiveHandshake();
+			session.fecLastLen = static_cast<uint16_t>(headLen + bodyLen);
 
-			if (!bExInit)
+			if ((index + 1 < GetFecGroupSize()) && !bEnd)
 			{
-				SendHandshake();
+				return true;
 			}
+
+			return QueueRepairs(session, packetID + 1, now);
 		}
 
-		void ReceiveHandshake()
+		// Queues the repairs of the group's packets before endID, the next group starts there.
+		bool QueueRepairs(Session& session, uint64_t endID, Clock::time_point now)
 		{
-			ZeroMemory(&peerAddr, sizeof(peerAddr));
-			int peerAddrSz = sizeof(peerAddr);
-			uint8_t msgType;
-			if (ReceiveData(peer, timeout, this, bShouldStop, bExInit,
-							reinterpret_cast<char*>(&msgType), sizeof(uint8_t),
-							NULL, reinterpret_cast<sockaddr*>(&peerAddr), &peerAddrSz))
+			const size_t dataSz = session.packetSz - WirePayload::size;
+			const uint8_t count = static_cast<uint8_t>(endID - session.fecFirstID);
+			const uint16_t lastLen = session.fecLastLen;
+
+			for (int j = 0; j < session.fecRepairCount; ++j)
 			{
-				if (msgType != INM_handshake)
+				if ((queued == BATCH_maxDatagrams) && !FlushPayloads())
 				{
-					return InitEx("Corrupt handshake message.", -1);
+					return false;
 				}
+
+				BYTE* slot = packet.data() + queued * slotSz;
+
+				WireRepair::Write(slot, OUTM_repair, session.fecFirstID, count, static_cast<uint8_t>(j), lastLen);
+				std::memcpy(reinterpret_cast<void*>(slot + WireRepair::size), reinterpret_cast<const void*>(session.fecRepairs.data() + j * dataSz), dataSz);
+
+				outbox[queued].data		= reinterpret_cast<char*>(slot);
+				outbox[queued].len		= static_cast<int>(REPAIR_headerSz + dataSz);
+				outbox[queued].addr		= session.peerAddr;
+				outbox[queued].body		= nullptr;
+				outbox[queued].bodyLen	= 0;
+				++queued;
+
+				// Repairs don't take up the window, but they do take up the path.
+				session.pacer.Charge(outbox[queued - 1].len, now);
 			}
+
+			session.fecFirstID = endID;
+			return true;
+		}
+
+		FORCEINLINE uint8_t GetFecGroupSize() const
+		{
+			return static_cast<uint8_t>((std::min)((std::max)(static_cast<int>(options.fecGroupSz), 2), FecCodec::FEC_maxGroupSz));
 		}
 
-		void SendHandshake()
+		// Enough repairs for the loss the receiver sees, with a margin.
+		int GetFecRepairCount(const Session& session) const
 		{
-			BYTE data[sizeof(uint8_t) + sizeof(uint16_t)];
-			// First byte for message type.
-			std::memcpy(reinterpret_cast<void*>(data), 
-						reinterpret_cast<const void*>(&OUTM_handshake), sizeof(uint8_t));
+			const int maxRepair = (std::min)(static_cast<int>(options.fecMaxRepair), FecCodec::FEC_maxRepair);
+			const int minRepair = (std::min)(static_cast<int>(options.fecMinRepair), maxRepair);
+
+			int repairs = static_cast<int>(std::ceil(GetFecGroupSize() * session.fecLossRate * FEC_margin));
+			return (std::min)((std::max)(repairs, minRepair), maxRepair);
+		}
 
-			// Next two bytes for the MTU.
-			std::memcpy(reinterpret_cast<void*>(data + sizeof(uint8_t)), 
-						reinterpret_cast<const void*>(&packetSz), sizeof(uint16_t));
+		FORCEINLINE bool HasPushWork(const Session& session) const
+		{
+			return !session.resendQueue.empty() ||
+				   ((session.nextPushID <= session.pushEndID) && HasPushRoom(session));
+		}
 
-			do
+		// The receiver's window holds everything past the ack, the congestion window only what hasn't arrived yet.
+		FORCEINLINE bool HasPushRoom(const Session& session) const
+		{
+			const uint64_t unacked = session.nextPushID - session.ackID;
+			if (unacked >= session.pushWindow)
 			{
-				SendData(peer, this, bShouldStop,
-						 reinterpret_cast<const char*>(data), 
-						 sizeof(data), NULL, reinterpret_cast<const sockaddr*>(&peerAddr), sizeof(peerAddr));
+				return false;
 			}
-			while (!bShouldStop && !DataAvailable(peer, timeout, this) && !bExInit);
+
+			return (session.congestion == nullptr) || (unacked - (std::min)(session.arrived, unacked) < session.congestion->GetWindow());
 		}
 
-	private:
-		// Returns true, if succesful and false otherwise.
-		bool SendStream()
+		// How many of [first, last) fall within [from, to).
+		static FORCEINLINE uint64_t CountWithin(uint64_t first, uint64_t last, uint64_t from, uint64_t to)
+		{
+			first = (std::max)(first, from);
+			last = (std::min)(last, to);
+			return (last > first) ? (last - first) : 0;
+		}
+
+		// Applies a report of what the receiver got, returns false if it is malformed.
+		bool ParseReport(Session& session, const BYTE* data, int dataLen)
 		{
-			SOCKADDR_IN auxAddr;
-			ZeroMemory(&auxAddr, sizeof(auxAddr));
-			int auxAddrSz = sizeof(auxAddr);
+			if (dataLen < (int) WireReport::size)
+			{
+				return false;
+			}
+
+			const uint64_t reportAck = WireReport::Get<WireReport::ack>(data);
+			const uint64_t horizon = WireReport::Get<WireReport::horizon>(data);
+			const uint8_t rangeCount = WireReport::Get<WireReport::rangeCount>(data);
+			const BYTE* ranges = data + WireReport::size;
+
+			// Receivers which get repairs add how many packets they rebuilt so far.
+			const int recoveredSz = session.bFec ? (int) sizeof(uint32_t) : 0;
+			if ((rangeCount > NACK_maxRanges) || (dataLen != (int) (WireReport::size + rangeCount * WireReportRange::size) + recoveredSz))
+			{
+				return false;
+			}
 
-			// Begin receiving the request.
-		BEGIN_RECVREQ:
-			if (bShouldStop) 
+			if (session.mode != TransferMode::push)
 			{
-				return true; 
+				return true;
 			}
 
-			// 1 byte for message type, 8 bytes for the ID, 8 bytes for the position, 2 bytes for the length.
-			BYTE reqData[sizeof(uint8_t) + sizeof(uint64_t) + sizeof(uint64_t) + sizeof(uint16_t)];
+			auto now = Clock::now();
 
-			if (ReceiveData(peer, timeout, this, bShouldStop, bExInit,
-							reinterpret_cast<char*>(reqData), sizeof(reqData),
-							NULL, reinterpret_cast<sockaddr*>(&auxAddr), &auxAddrSz))
+			uint64_t acked = 0;
+			if (reportAck > session.ackID)
 			{
-				// If the actual peer sent you a message, then you have been noticed.
-				if (auxAddr.sin_addr.S_un.S_addr == peerAddr.sin_addr.S_un.S_addr)
+				// Timing the newest packet the ack covers, unless it has been resent.
+				acked = reportAck - session.ackID;
+				Clock::duration rtt = Clock::duration::zero();
+				if ((acked <= session.pushedAt.size()) && (session.pushedAt[acked - 1] != Clock::time_point()))
 				{
-					bAcknowledged = true;
+					rtt = now - session.pushedAt[acked - 1];
 				}
-				else
+
+				if (rtt > Clock::duration::zero())
 				{
-					if (bAcknowledged)
-					{
-						goto BEGIN_RECVREQ;
-					}
-					else
-					{
-						return false;
-					}
+					AddRttSample(session, rtt);
+				}
+
+				session.pushedAt.erase(session.pushedAt.begin(),
+									   session.pushedAt.begin() + static_cast<ptrdiff_t>((std::min)(acked, static_cast<uint64_t>(session.pushedAt.size()))));
+
+				session.ackID = reportAck;
+				session.nextPushID = (std::max)(session.nextPushID, session.ackID);
+				session.resentAt.erase(session.resentAt.begin(), session.resentAt.lower_bound(session.ackID));
+
+				if (session.congestion != nullptr)
+				{
+					session.congestion->OnAcked(static_cast<uint32_t>((std::min)(acked, static_cast<uint64_t>(UINT32_MAX))), rtt, now);
+					session.pacer.SetRate(session.congestion->GetPacingRate(session.packetSz), session.packetSz);
 				}
 			}
-			else
+
+			bool bLost = false;
+			uint64_t lost = 0;
+			uint64_t missing = 0;
+			uint64_t reportedEnd = horizon;
+			for (uint8_t i = 0; i < rangeCount; ++i)
 			{
-				return false; 
-			}
+				const BYTE* range = ranges + i * WireReportRange::size;
+				const uint64_t first = WireReportRange::Get<WireReportRange::first>(range);
+				const uint32_t count = WireReportRange::Get<WireReportRange::count>(range);
 
-			uint64_t packetID, pos;
-			uint16_t packetLen;
-			uint8_t msgType;
+				for (uint64_t packetID = first; (packetID < first + count) && (packetID < session.nextPushID); ++packetID)
+				{
+					if (QueueResend(session, packetID, now))
+					{
+						bLost = true;
+						++lost;
+					}
+				}
 
-			// Decyphering the request.
-			{
-				int offset = 0;
-				std::memcpy(reinterpret_cast<void*>(&msgType), reinterpret_cast<const void*>(reqData + offset), sizeof(uint8_t));
-				offset += sizeof(uint8_t);
-				std::memcpy(reinterpret_cast<void*>(&packetID), reinterpret_cast<const void*>(reqData + offset), sizeof(uint64_t));
-				offset += sizeof(uint64_t);
-				std::memcpy(reinterpret_cast<void*>(&pos), reinterpret_cast<const void*>(reqData + offset), sizeof(uint64_t));
-				offset += sizeof(uint64_t);
-				std::memcpy(reinterpret_cast<void*>(&packetLen), reinterpret_cast<const void*>(reqData + offset), sizeof(uint16_t));
-				offset += sizeof(uint16_t);
+				missing += CountWithin(first, first + count, session.ackID, session.nextPushID);
+				reportedEnd = (rangeCount == NACK_maxRanges) ? (first + count) : reportedEnd;
 			}
 
-			// Verifing the integrity of the request.
+			// Whatever the report covers past the ack and doesn't list as missing has arrived. Without counting it out, one
+			// hole would leave the congestion window full of packets the receiver has, and nothing more would go out to
+			// draw the reports that get the hole resent. A full report covers only as far as its last range.
+			const uint64_t covered = CountWithin(session.ackID, reportedEnd, session.ackID, session.nextPushID);
+			session.arrived = (covered > missing) ? (covered - missing) : 0;
+
+			if (session.bFec)
 			{
-				if ((msgType != INM_request) || (packetLen > packetSz))
+				const uint32_t recovered = WireLoad<uint32_t>(ranges + rangeCount * WireReportRange::size);
+
+				// What was rebuilt got lost just the same, the repairs have to keep up with it. Reports that arrive out of
+				// order carry an older count, which adds nothing.
+				uint64_t seenLost = lost;
+				if (recovered > session.fecRecovered)
 				{
-					InitEx("Corrupt request.", -1);
-					return false;
+					seenLost += recovered - session.fecRecovered;
+					session.fecRecovered = recovered;
 				}
-			}
 
-			// Setting the message type.
-			std::memcpy(reinterpret_cast<void*>(packet.data()),
-						reinterpret_cast<const void*>(&OUTM_payload), sizeof(uint8_t));
-			// Setting the packet ID.
-			std::memcpy(reinterpret_cast<void*>(packet.data() + sizeof(uint8_t)), 
-						reinterpret_cast<const void*>(&packetID), sizeof(uint64_t));
+				if (acked + lost > 0)
+				{
+					double sample = (std::min)(static_cast<double>(seenLost) / static_cast<double>(acked + lost), 1.0);
+					session.fecLossRate += (sample - session.fecLossRate) / 8.0;
+				}
+			}
 
-			// Reading data from the stream.
-			uint16_t byteCount = packetLen;
-			try
+			// Nothing has been pushed for a while and the receiver still hasn't seen the tail, so it got lost.
+			if ((horizon < session.nextPushID) && (now - session.lastPushAt >= session.rtt.GetRto()))
 			{
-				stream->seekg(pos);
-				stream->read(packet.data() + (sizeof(uint64_t) + sizeof(uint8_t)), packetLen - (sizeof(uint64_t) + sizeof(uint8_t)));
+				bool bTimedOut = false;
+				for (uint64_t packetID = (std::max)(horizon, session.ackID); packetID < session.nextPushID; ++packetID)
+				{
+					bTimedOut = QueueResend(session, packetID, now) || bTimedOut;
+				}
 
-				if (stream->eof())
+				if (bTimedOut)
 				{
-					byteCount = static_cast<decltype(byteCount)>(sizeof(uint64_t) + sizeof(uint8_t));
-					byteCount += static_cast<decltype(byteCount)>(stream->gcount());
-					stream->clear();
+					stats.timeouts.Add();
+					Tracer::Record(TraceEventType::timeout, traceID, session.nextPushID,
+								   static_cast<uint64_t>(std::chrono::duration_cast<std::chrono::microseconds>(session.rtt.GetRto()).count()));
+					bLost = true;
 				}
 			}
-			catch (const std::exception& ex)
+
+			if (bLost && (session.congestion != nullptr))
+			{
+				session.congestion->OnLost(now);
+				session.pacer.SetRate(session.congestion->GetPacingRate(session.packetSz), session.packetSz);
+			}
+
+			return true;
+		}
+
+		// Queues a retransmission, unless the same packet has been resent within the retransmission timeout. Returns true if queued.
+		bool QueueResend(Session& session, uint64_t packetID, Clock::time_point now)
+		{
+			if (packetID < session.ackID)
 			{
-				std::string err = std::string("Failed some stream operation with message:'") + std::string(ex.what()) + std::string("'");
-				InitEx(err, -1);
 				return false;
 			}
 
-			if (!SendData(peer, this, bShouldStop,
-						  reinterpret_cast<const char*>(packet.data()), byteCount, 
-						  NULL, reinterpret_cast<const sockaddr*>(&peerAddr), sizeof(peerAddr)))
+			auto it = session.resentAt.find(packetID);
+			if ((it != session.resentAt.end()) && (now - it->second < session.rtt.GetRto()))
 			{
 				return false;
 			}
 
-			goto BEGIN_RECVREQ;
+			session.resentAt[packetID] = now;
+			session.resendQueue.push_back(packetID);
+
+			if (packetID - session.ackID < session.pushedAt.size())
+			{
+				session.pushedAt[packetID - session.ackID] = Clock::time_point();
+			}
+
+			return true;
+		}
+
+		FORCEINLINE Clock::duration GetRetryInterval() const
+		{
+			return ToDuration(timeout);
+		}
+
+		FORCEINLINE void AddRttSample(Session& session, Clock::duration rtt)
+		{
+			session.rtt.AddSample(rtt);
+			stats.rtt.Add(rtt);
+		}
+
+		// Nothing answered within the session's timeout, which is backed off.
+		void RecordTimeout(Session& session)
+		{
+			stats.timeouts.Add();
+			Tracer::Record(TraceEventType::timeout, traceID, 0,
+						   static_cast<uint64_t>(std::chrono::duration_cast<std::chrono::microseconds>(session.rtt.GetRto()).count()));
+
+			session.rtt.Backoff();
 		}
 
 	private:
-		// Packet that will be filled and sent.
+		// Packets that will be filled and sent together, one slotSz slot each.
 		std::vector<BYTE> packet;
+		std::vector<Datagram> outbox;
+		int queued = 0;
+
+		// A block read from the stream before it is compressed into its slot.
+		std::vector<BYTE> block;
+
+		// Incoming messages are drained together too, one INM_maxSz slot each.
+		std::vector<BYTE> inboxData;
+		std::vector<Datagram> inbox;
 
 		// Networking objects.
 		SOCKET peer;
-		SOCKADDR_IN peerAddr;
 
+		// The fallback packet size, and the room every slot has for whatever a session settles on.
 		const uint16_t packetSz;
+		const uint16_t slotSz;
 		const uint16_t port;
 		const timeval timeout;
+		const SenderOptions options;
+
+		// Set if runs of full payloads are handed to the kernel to segment.
+		bool bSegmentation = false;
+
+		// Set if sessions probe their path before the handshake.
+		bool bProbing = false;
 
 	private:
-		// The stream that will be sent.
+		// Every receiver being served, by address and port.
+		std::unordered_map<uint64_t, Session> sessions;
+		const size_t maxSessions;
+
+		// Counted by the thread serving, read by anyone.
+		TransferStats stats;
+
+		// Tells this sender's events apart from everyone else's.
+		const uint32_t traceID = Tracer::NewObject();
+
+		// The stream that will be sent, until the first receiver takes it over.
 		std::unique_ptr<TStream> stream;
 
+		// Server mode, opens the stream of every new session.
+		StreamFactory factory;
+
+		// Set if the reactor drives this instead of process.
+		Reactor* reactor;
+
 		// For the thread.
 		std::atomic_bool bShouldStop;
-		std::atomic_bool bAcknowledged;
 		std::atomic_bool bFinished;
+		std::atomic_bool bCleanedUp = false;
 		std::thread process;
 
+		// Whoever waits for the finish, guarded by finishMutex along with setting bFinished and the thread that did.
+		std::mutex finishMutex;
+		std::function<void()> onceFinished;
+		std::thread::id finishingThread;
+
+		// Lets Stop cut the thread's wait short, never opened for the reactor.
+		Waker waker;
+		bool bWakerNetStarted = false;
+
 	private:
 		// Exception handling.
 		void InitEx(const std::string& _errStr, int _errCode)
 		{
 		#ifdef _DEBUG
-			if (bExInit) 
+			if (bExInit)
 			{
 				assert("Trying to override the exception.\n" == NULL);
 			}
@@ -358,13 +2115,18 @@ namespace UDPR
 
 	public:
 		/// Misc (e.g. getters, setters, status functions etc.).
-		
+
 		FORCEINLINE bool ErrorOccured() const { return bExInit; }
 
 		FORCEINLINE bool IsRunning() const { return !bFinished; }
 
+	#ifdef UDPR_COROUTINES
+		// co_await it to wait for the sender to finish, once stopped or failed since it serves until then.
+		FORCEINLINE FinishedAwaitable<StreamSender> Serve() { return FinishedAwaitable<StreamSender>(*this); }
+	#endif
+
 		FORCEINLINE const std::string& GetErrorString() const { return errStr; }
-		
+
 		FORCEINLINE int GetErrorCode() const { return errCode; }
 
 		FORCEINLINE uint16_t GetPort() const { return port; }
@@ -372,5 +2134,12 @@ namespace UDPR
 		FORCEINLINE uint16_t GetPacketSize() const { return packetSz; }
 
 		FORCEINLINE timeval GetTimeout() const { return timeout; }
+
+		FORCEINLINE size_t GetMaxSessions() const { return maxSessions; }
+
+		FORCEINLINE const SenderOptions& GetOptions() const { return options; }
+
+		// Summed over every session so far, safe to call from any thread while the sender runs.
+		FORCEINLINE TransferStatsSnapshot GetStats() const { return stats.GetSnapshot(); }
 	};
 }
@@ -0,0 +1,452 @@
+#pragma once
+
+/// STD
+#include <memory>
+#include <atomic>
+#include <mutex>
+#include <cstdint>
+#include <vector>
+#include <string>
+#include <functional>
+#include <limits>
+
+/// CUSTOM
+#include "UDPRDebugHeaders.h"
+#include "UDPRMisc.h"
+#include "UDPRReactor.h"
+#include "UDPRStreamSender.h"
+#include "UDPRStreamReceiver.h"
+#include "UDPRCheckpoint.h"
+
+namespace UDPR
+{
+	// Serves a StripedReceiver, one StreamSender per stripe on consecutive ports starting at the given one. Every
+	// stripe has a socket of its own and runs on a thread of its own (or whichever reactor thread is free), so a
+	// single transfer is spread across cores and, since every stripe is its own flow, across the NIC's queues.
+	template<class TStream>
+	class StripedSender
+	{
+	public:
+		/// Opens the stream a new receiver gets, called once for every stripe of every transfer.
+		using StreamFactory = typename StreamSender<TStream>::StreamFactory;
+
+	public:
+		StripedSender(StreamFactory _factory, uint16_t _port, size_t _stripeCount, uint16_t _packetSz = 508,
+					  const timeval& _timeout = { 0, 500 * 1000 }, size_t _maxSessions = 1024,
+					  const SenderOptions& _options = SenderOptions()) :
+			onFinished(_options.onFinished),
+			unfinished((std::max)(_stripeCount, static_cast<size_t>(1)))
+		{
+			for (size_t i = 0; i < (std::max)(_stripeCount, static_cast<size_t>(1)); ++i)
+			{
+				stripes.emplace_back(new StreamSender<TStream>(_factory, static_cast<uint16_t>(_port + i), _packetSz, _timeout,
+															   _maxSessions, GetStripeOptions(_options)));
+			}
+		}
+
+		StripedSender(Reactor& _reactor, StreamFactory _factory, uint16_t _port, size_t _stripeCount, uint16_t _packetSz = 508,
+					  const timeval& _timeout = { 0, 500 * 1000 }, size_t _maxSessions = 1024,
+					  const SenderOptions& _options = SenderOptions()) :
+			onFinished(_options.onFinished),
+			unfinished((std::max)(_stripeCount, static_cast<size_t>(1)))
+		{
+			for (size_t i = 0; i < (std::max)(_stripeCount, static_cast<size_t>(1)); ++i)
+			{
+				stripes.emplace_back(new StreamSender<TStream>(_reactor, _factory, static_cast<uint16_t>(_port + i), _packetSz,
+															   _timeout, _maxSessions, GetStripeOptions(_options)));
+			}
+		}
+
+		// Stripes call back into this sender while they finish, so they have to be stopped before anything of it goes.
+		~StripedSender()
+		{
+			Stop();
+		}
+
+		StripedSender(const StripedSender&) = delete;
+		StripedSender& operator=(const StripedSender&) = delete;
+
+		void Stop()
+		{
+			for (auto& stripe : stripes)
+			{
+				stripe->Stop();
+			}
+		}
+
+		void RequestStop()
+		{
+			for (auto& stripe : stripes)
+			{
+				stripe->RequestStop();
+			}
+		}
+
+	private:
+		// onFinished is called once, by whichever stripe finishes last.
+		SenderOptions GetStripeOptions(const SenderOptions& options)
+		{
+			SenderOptions stripeOptions = options;
+			stripeOptions.onFinished = [this]()
+			{
+				if ((unfinished.fetch_sub(1) == 1) && onFinished)
+				{
+					onFinished();
+				}
+			};
+
+			return stripeOptions;
+		}
+
+	private:
+		const std::function<void()> onFinished;
+		std::atomic<size_t> unfinished;
+
+		// Destroyed first, their callbacks use the members above.
+		std::vector<std::unique_ptr<StreamSender<TStream>>> stripes;
+
+	public:
+		/// Misc (e.g. getters, setters, status functions etc.).
+
+		FORCEINLINE bool ErrorOccured() const
+		{
+			for (auto& stripe : stripes)
+			{
+				if (stripe->ErrorOccured()) { return true; }
+			}
+
+			return false;
+		}
+
+		// The error of the first stripe that failed.
+		FORCEINLINE const std::string& GetErrorString() const
+		{
+			for (auto& stripe : stripes)
+			{
+				if (stripe->ErrorOccured()) { return stripe->GetErrorString(); }
+			}
+
+			return stripes.front()->GetErrorString();
+		}
+
+		FORCEINLINE bool IsRunning() const
+		{
+			for (auto& stripe : stripes)
+			{
+				if (stripe->IsRunning()) { return true; }
+			}
+
+			return false;
+		}
+
+		// Summed over every stripe.
+		TransferStatsSnapshot GetStats() const
+		{
+			TransferStatsSnapshot stats;
+			for (auto& stripe : stripes)
+			{
+				stats += stripe->GetStats();
+			}
+
+			return stats;
+		}
+
+		FORCEINLINE size_t GetStripeCount() const { return stripes.size(); }
+
+		FORCEINLINE const StreamSender<TStream>& GetStripe(size_t index) const { return *stripes[index]; }
+	};
+
+	// Receives a single stream from a StripedSender, split into as many byte ranges as there are stripes. A first
+	// handshake asks the sender for the stream's size, then every range is received by a StreamReceiver of its own,
+	// from the sender's port plus the stripe's index, into a stream of its own which is written from the range's
+	// offset on. For a file that is a handle of its own per stripe, opened without truncating and sought to the offset.
+	// A checkpoint path in the options is suffixed with every stripe's index, stripes resume separately.
+	template<class TStream>
+	class StripedReceiver
+	{
+	public:
+		/// Opens the stream a stripe writes to, positioned at offset. Returning nullptr fails the transfer.
+		using StreamFactory = std::function<TStream*(uint64_t offset)>;
+
+	public:
+		StripedReceiver(StreamFactory _factory, const SOCKADDR_IN& _peerAddr, size_t _stripeCount,
+						const timeval& _timeout = { 0, 500 * 1000 }, uint16_t _windowSz = 32,
+						TransferMode _mode = TransferMode::pull, const ReceiverOptions& _options = ReceiverOptions()) :
+			StripedReceiver(nullptr, std::move(_factory), _peerAddr, _stripeCount, _timeout, _windowSz, _mode, _options)
+		{
+		}
+
+		// Every stripe is driven by the reactor's threads.
+		StripedReceiver(Reactor& _reactor, StreamFactory _factory, const SOCKADDR_IN& _peerAddr, size_t _stripeCount,
+						const timeval& _timeout = { 0, 500 * 1000 }, uint16_t _windowSz = 32,
+						TransferMode _mode = TransferMode::pull, const ReceiverOptions& _options = ReceiverOptions()) :
+			StripedReceiver(&_reactor, std::move(_factory), _peerAddr, _stripeCount, _timeout, _windowSz, _mode, _options)
+		{
+		}
+
+		~StripedReceiver()
+		{
+			Stop();
+		}
+
+		StripedReceiver(const StripedReceiver&) = delete;
+		StripedReceiver& operator=(const StripedReceiver&) = delete;
+
+		void Stop()
+		{
+			// No stripe is started past this point, the ones that are can be stopped without the lock.
+			{
+				std::lock_guard<std::mutex> lock(mutex);
+				bStopping = true;
+			}
+
+			sizer->Stop();
+
+			for (auto& stripe : stripes)
+			{
+				stripe->Stop();
+			}
+		}
+
+		void RequestStop()
+		{
+			std::lock_guard<std::mutex> lock(mutex);
+			bStopping = true;
+
+			sizer->RequestStop();
+
+			for (auto& stripe : stripes)
+			{
+				stripe->RequestStop();
+			}
+		}
+
+	private:
+		StripedReceiver(Reactor* _reactor, StreamFactory _factory, const SOCKADDR_IN& _peerAddr, size_t _stripeCount,
+						const timeval& _timeout, uint16_t _windowSz, TransferMode _mode, const ReceiverOptions& _options) :
+			factory(std::move(_factory)),
+			peerAddr(_peerAddr),
+			stripeCount((std::max)(_stripeCount, static_cast<size_t>(1))),
+			timeout(_timeout),
+			windowSz(_windowSz),
+			mode(_mode),
+			options(_options),
+			reactor(_reactor)
+		{
+			// An empty range on the first stripe's port, done as soon as the sender told the size.
+			ReceiverOptions sizerOptions;
+			sizerOptions.rangeEnd = 0;
+			sizerOptions.onStreamSize = [this](uint64_t streamSz) { Launch(streamSz); };
+			sizerOptions.onFinished = [this]() { OnPartFinished(); };
+
+			sizer.reset((reactor != nullptr) ? new StreamReceiver<TStream>(*reactor, nullptr, peerAddr, timeout, 1, TransferMode::pull, sizerOptions)
+											 : new StreamReceiver<TStream>(nullptr, peerAddr, timeout, 1, TransferMode::pull, sizerOptions));
+		}
+
+		// Starts a receiver for every range, called by the sizer once the size is known.
+		void Launch(uint64_t streamSz)
+		{
+			std::lock_guard<std::mutex> lock(mutex);
+
+			if (bStopping)
+			{
+				return;
+			}
+
+			// A stream that can't tell its size can't be split, the first stripe receives it whole.
+			const bool bSplit = (streamSz != (std::numeric_limits<uint64_t>::max)());
+			const size_t count = bSplit ? stripeCount : 1;
+
+			for (size_t i = 0; i < count; ++i)
+			{
+				uint64_t begin = bSplit ? static_cast<uint64_t>(streamSz / count * i) : 0;
+				uint64_t end = bSplit ? ((i + 1 == count) ? streamSz : static_cast<uint64_t>(streamSz / count * (i + 1))) : streamSz;
+
+				// Streams smaller than the stripe count leave some stripes nothing to do.
+				if (bSplit && (begin >= end))
+				{
+					continue;
+				}
+
+				// Every stripe checkpoints on its own, one that has one resumes where it left off.
+				ReceiverOptions stripeOptions = options;
+				stripeOptions.rangeBegin = begin;
+				stripeOptions.rangeEnd = end;
+				stripeOptions.onStreamSize = nullptr;
+				stripeOptions.onFinished = [this]() { OnPartFinished(); };
+
+				uint64_t offset = begin;
+				if (!options.checkpointPath.empty())
+				{
+					stripeOptions.checkpointPath = options.checkpointPath + "." + std::to_string(i);
+
+					Checkpoint checkpoint;
+					if (Checkpoint::Load(stripeOptions.checkpointPath, checkpoint) && (checkpoint.pos >= begin) && (checkpoint.pos <= end))
+					{
+						offset = checkpoint.pos;
+					}
+				}
+
+				TStream* stream = nullptr;
+				try
+				{
+					stream = factory(offset);
+				}
+				catch (const std::exception& ex)
+				{
+					std::string err = std::string("Failed to open a stream with message:'") + std::string(ex.what()) + std::string("'");
+					Abort(err);
+					return;
+				}
+
+				if (stream == nullptr)
+				{
+					Abort("Failed to open a stream.");
+					return;
+				}
+
+				SOCKADDR_IN stripeAddr = peerAddr;
+				stripeAddr.sin_port = htons(static_cast<uint16_t>(ntohs(peerAddr.sin_port) + i));
+
+				unfinished.fetch_add(1);
+
+				stripes.emplace_back((reactor != nullptr) ?
+					new StreamReceiver<TStream>(*reactor, stream, stripeAddr, timeout, windowSz, mode, stripeOptions) :
+					new StreamReceiver<TStream>(stream, stripeAddr, timeout, windowSz, mode, stripeOptions));
+			}
+		}
+
+		// Stops whatever stripes were started before one of them couldn't be, called with the lock held.
+		void Abort(const std::string& err)
+		{
+			bStopping = true;
+
+			for (auto& stripe : stripes)
+			{
+				stripe->Stop();
+			}
+
+			InitEx(err, -1);
+		}
+
+		// The sizer only finishes once it started every stripe, so the count can't reach zero while stripes are added.
+		void OnPartFinished()
+		{
+			if ((unfinished.fetch_sub(1) == 1) && options.onFinished)
+			{
+				options.onFinished();
+			}
+		}
+
+	private:
+		const StreamFactory factory;
+		const SOCKADDR_IN peerAddr;
+		const size_t stripeCount;
+		const timeval timeout;
+		const uint16_t windowSz;
+		const TransferMode mode;
+		const ReceiverOptions options;
+
+		// Set if the reactor drives the receivers instead of threads of their own.
+		Reactor* reactor;
+
+		// Asks for the size, the stripes are only started once it is known.
+		std::unique_ptr<StreamReceiver<TStream>> sizer;
+		std::vector<std::unique_ptr<StreamReceiver<TStream>>> stripes;
+
+		mutable std::mutex mutex;
+		bool bStopping = false;
+
+		// The sizer and every stripe started that are still running, options.onFinished is called once none is.
+		std::atomic<size_t> unfinished { 1 };
+
+	private:
+		// Exception handling.
+		std::string errStr = "";
+		int errCode = 0;
+		std::atomic_bool bExInit = false;
+
+	private:
+		void InitEx(const std::string& _errStr, int _errCode)
+		{
+			errStr = _errStr;
+			errCode = _errCode;
+			bExInit = true;
+		}
+
+	public:
+		/// Misc (e.g. getters, setters, status functions etc.).
+
+		FORCEINLINE bool ErrorOccured() const
+		{
+			std::lock_guard<std::mutex> lock(mutex);
+
+			if (bExInit || sizer->ErrorOccured())
+			{
+				return true;
+			}
+
+			for (auto& stripe : stripes)
+			{
+				if (stripe->ErrorOccured()) { return true; }
+			}
+
+			return false;
+		}
+
+		// Ours first, then the sizer's, then the one of the first stripe that failed.
+		FORCEINLINE const std::string& GetErrorString() const
+		{
+			std::lock_guard<std::mutex> lock(mutex);
+
+			if (bExInit || sizer->ErrorOccured())
+			{
+				return bExInit ? errStr : sizer->GetErrorString();
+			}
+
+			for (auto& stripe : stripes)
+			{
+				if (stripe->ErrorOccured()) { return stripe->GetErrorString(); }
+			}
+
+			return errStr;
+		}
+
+		// The stripes are started before the sizer finishes, so nothing runs once neither does.
+		FORCEINLINE bool IsRunning() const
+		{
+			if (sizer->IsRunning())
+			{
+				return true;
+			}
+
+			std::lock_guard<std::mutex> lock(mutex);
+
+			for (auto& stripe : stripes)
+			{
+				if (stripe->IsRunning()) { return true; }
+			}
+
+			return false;
+		}
+
+		// The size of the sender's stream, the maximum until it has been told.
+		FORCEINLINE uint64_t GetStreamSize() const { return sizer->GetStreamSize(); }
+
+		// Summed over the sizer and every stripe started so far.
+		TransferStatsSnapshot GetStats() const
+		{
+			TransferStatsSnapshot stats = sizer->GetStats();
+
+			std::lock_guard<std::mutex> lock(mutex);
+			for (auto& stripe : stripes)
+			{
+				stats += stripe->GetStats();
+			}
+
+			return stats;
+		}
+
+		FORCEINLINE size_t GetStripeCount() const { return stripeCount; }
+	};
+}
@@ -0,0 +1,267 @@
+#pragma once
+
+/// STD
+#include <atomic>
+#include <mutex>
+#include <chrono>
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+#include <string>
+#include <vector>
+#include <memory>
+#include <algorithm>
+
+/// CUSTOM
+#include "UDPRDebugHeaders.h"
+#include "UDPRMisc.h"
+
+namespace UDPR
+{
+	enum class TraceEventType : uint8_t
+	{
+		// A sender or receiver started, arg is the port it serves or the sender's port.
+		senderOpened,
+		receiverOpened,
+
+		handshakeSent,
+
+		// id is the packet, arg the position in the stream.
+		requestSent,
+		requestReceived,
+		payloadSent,
+
+		// id is the packet, arg the datagram's length.
+		payloadReceived,
+
+		// A retransmission timeout expired, arg is the timeout in microseconds it had.
+		timeout,
+
+		// id is the packet sent or asked for again.
+		retransmit,
+
+		// Around reading or writing the stream, id is the packet and arg its length.
+		streamBegin,
+		streamEnd,
+
+		count
+	};
+
+	// A single event, as it is kept in memory and written to the dump.
+	struct TraceEvent
+	{
+		// Nanoseconds on the steady clock.
+		uint64_t time;
+		uint64_t id;
+		uint64_t arg;
+
+		// The sender or receiver that recorded it, and the ring it went into.
+		uint32_t object;
+		uint16_t thread;
+
+		TraceEventType type;
+		uint8_t reserved;
+	};
+
+	static_assert(sizeof(TraceEvent) == 32, "Trace events are dumped as they are.");
+
+	// What a dump starts with, the events follow sorted by time.
+	struct TraceFileHeader
+	{
+		static constexpr char TRACE_magic[8] = { 'U', 'D', 'P', 'R', 'T', 'R', 'C', '\0' };
+		static constexpr uint32_t TRACE_version = 1;
+
+		char magic[8];
+		uint32_t version;
+		uint32_t eventSz;
+		uint64_t eventCount;
+	};
+
+	// Process wide, per-thread rings of the last TRACE_ringEvents events, off until enabled. Recording takes a relaxed
+	// load while off and a handful of stores into the calling thread's ring while on, nothing is ever locked or
+	// allocated but the ring itself on a thread's first event. Rings of threads that ended are taken over by the next
+	// ones started, their events stay until overwritten.
+	class Tracer
+	{
+	public:
+		static constexpr uint32_t TRACE_ringEvents = 1 << 16;
+
+	public:
+		static void Enable(bool bEnable = true)
+		{
+			GetState().bEnabled.store(bEnable, std::memory_order_relaxed);
+		}
+
+		FORCEINLINE static bool IsEnabled()
+		{
+			return GetState().bEnabled.load(std::memory_order_relaxed);
+		}
+
+		// Tells the events of every sender and receiver apart.
+		static uint32_t NewObject()
+		{
+			return GetState().nextObject.fetch_add(1, std::memory_order_relaxed);
+		}
+
+		FORCEINLINE static void Record(TraceEventType type, uint32_t object, uint64_t id = 0, uint64_t arg = 0)
+		{
+			if (IsEnabled())
+			{
+				GetRing().Push(type, object, id, arg);
+			}
+		}
+
+		// Writes what every ring holds to path, which may be done while transfers still run. Returns false if the file
+		// couldn't be written.
+		static bool Dump(const std::string& path)
+		{
+			std::vector<TraceEvent> events;
+			{
+				State& state = GetState();
+				std::lock_guard<std::mutex> lock(state.mutex);
+
+				for (auto& ring : state.rings)
+				{
+					ring->CopyTo(events);
+				}
+			}
+
+			std::sort(events.begin(), events.end(), [](const TraceEvent& a, const TraceEvent& b) { return a.time < b.time; });
+
+			TraceFileHeader header;
+			std::memcpy(header.magic, TraceFileHeader::TRACE_magic, sizeof(header.magic));
+			header.version = TraceFileHeader::TRACE_version;
+			header.eventSz = sizeof(TraceEvent);
+			header.eventCount = events.size();
+
+			FILE* file = std::fopen(path.c_str(), "wb");
+			if (file == nullptr)
+			{
+				return false;
+			}
+
+			bool bWritten = (std::fwrite(&header, sizeof(header), 1, file) == 1) &&
+							(events.empty() || (std::fwrite(events.data(), sizeof(TraceEvent), events.size(), file) == events.size()));
+
+			return (std::fclose(file) == 0) && bWritten;
+		}
+
+	private:
+		struct Ring
+		{
+			explicit Ring(uint16_t _index) : events(TRACE_ringEvents), index(_index) {  }
+
+			FORCEINLINE void Push(TraceEventType type, uint32_t object, uint64_t id, uint64_t arg)
+			{
+				const uint64_t at = head.load(std::memory_order_relaxed);
+
+				TraceEvent& event = events[at & (TRACE_ringEvents - 1)];
+				event.time = static_cast<uint64_t>(std::chrono::duration_cast<std::chrono::nanoseconds>(
+					std::chrono::steady_clock::now().time_since_epoch()).count());
+				event.id = id;
+				event.arg = arg;
+				event.object = object;
+				event.thread = index;
+				event.type = type;
+				event.reserved = 0;
+
+				head.store(at + 1, std::memory_order_release);
+			}
+
+			// The owner keeps pushing while the ring is copied, events it may have written over meanwhile are left out.
+			void CopyTo(std::vector<TraceEvent>& out) const
+			{
+				const uint64_t end = head.load(std::memory_order_acquire);
+				const uint64_t begin = (end > TRACE_ringEvents) ? (end - TRACE_ringEvents) : 0;
+
+				std::vector<TraceEvent> copied(static_cast<size_t>(end - begin));
+				for (uint64_t at = begin; at < end; ++at)
+				{
+					copied[static_cast<size_t>(at - begin)] = events[at & (TRACE_ringEvents - 1)];
+				}
+
+				std::atomic_thread_fence(std::memory_order_acquire);
+				const uint64_t after = head.load(std::memory_order_relaxed);
+				// The owner may be midway through writing the slot at after, which holds the event TRACE_ringEvents back.
+				const uint64_t intact = (after >= TRACE_ringEvents) ? (after - TRACE_ringEvents + 1) : 0;
+
+				for (uint64_t at = (std::max)(begin, intact); at < end; ++at)
+				{
+					out.push_back(copied[static_cast<size_t>(at - begin)]);
+				}
+			}
+
+			std::vector<TraceEvent> events;
+			std::atomic<uint64_t> head { 0 };
+			const uint16_t index;
+		};
+
+		struct State
+		{
+			std::atomic<bool> bEnabled { false };
+			std::atomic<uint32_t> nextObject { 1 };
+
+			std::mutex mutex;
+			std::vector<std::unique_ptr<Ring>> rings;
+			std::vector<Ring*> free;
+		};
+
+		// Hands the thread's ring back once it ends.
+		struct ThreadRing
+		{
+			Ring* ring = nullptr;
+
+			~ThreadRing()
+			{
+				if (ring != nullptr)
+				{
+					State& state = GetState();
+					std::lock_guard<std::mutex> lock(state.mutex);
+					state.free.push_back(ring);
+				}
+			}
+		};
+
+		static State& GetState()
+		{
+			static State state;
+			return state;
+		}
+
+		static Ring& GetRing()
+		{
+			// The state has to outlive every thread's ring, the main thread's included.
+			GetState();
+
+			static thread_local ThreadRing local;
+			if (local.ring == nullptr)
+			{
+				State& state = GetState();
+				std::lock_guard<std::mutex> lock(state.mutex);
+
+				if (!state.free.empty())
+				{
+					local.ring = state.free.back();
+					state.free.pop_back();
+				}
+				else
+				{
+					state.rings.push_back(std::make_unique<Ring>(static_cast<uint16_t>(state.rings.size())));
+					local.ring = state.rings.back().get();
+				}
+			}
+
+			return *local.ring;
+		}
+	};
+
+	// The name events go by in dumps.
+	FORCEINLINE static const char* GetTraceEventName(TraceEventType type)
+	{
+		static const char* const names[] = { "senderOpened", "receiverOpened", "handshakeSent", "requestSent", "requestReceived",
+											 "payloadSent", "payloadReceived", "timeout", "retransmit", "streamBegin", "streamEnd" };
+		static_assert(sizeof(names) / sizeof(names[0]) == static_cast<size_t>(TraceEventType::count), "Every event needs a name.");
+
+		return (type < TraceEventType::count) ? names[static_cast<size_t>(type)] : "unknown";
+	}
+}
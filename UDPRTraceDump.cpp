@@ -0,0 +1,176 @@
+// Decodes a dump written by Tracer::Dump, either into a timeline with one event per line or into the Chrome trace
+// event format, which chrome://tracing and Perfetto open. Every sender and receiver shows up as a process of its own
+// there, every thread that recorded its events as one of its threads, with stream reads and writes as slices.
+//
+// Built on its own next to the headers, there is nothing else to it:
+//	g++ -std=c++17 -O2 UDPRTraceDump.cpp -o UDPRTraceDump
+//	cl /std:c++17 /O2 /EHsc UDPRTraceDump.cpp ws2_32.lib
+//
+// For example:
+//	UDPRTraceDump --chrome transfer.trace > transfer.json
+//	UDPRTraceDump transfer.trace | grep timeout
+
+/// STD
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+#include <string>
+#include <vector>
+#include <set>
+
+/// CUSTOM
+#include "UDPRTrace.h"
+
+using namespace UDPR;
+
+namespace
+{
+	bool ReadDump(const char* path, std::vector<TraceEvent>& events)
+	{
+		FILE* file = std::fopen(path, "rb");
+		if (file == nullptr)
+		{
+			std::fprintf(stderr, "Failed to open %s.\n", path);
+			return false;
+		}
+
+		TraceFileHeader header;
+		bool bRead = (std::fread(&header, sizeof(header), 1, file) == 1);
+		if (!bRead || (std::memcmp(header.magic, TraceFileHeader::TRACE_magic, sizeof(header.magic)) != 0) ||
+			(header.version != TraceFileHeader::TRACE_version) || (header.eventSz != sizeof(TraceEvent)))
+		{
+			std::fprintf(stderr, "%s isn't a trace dump this decoder knows.\n", path);
+			std::fclose(file);
+			return false;
+		}
+
+		events.resize(static_cast<size_t>(header.eventCount));
+		bRead = events.empty() || (std::fread(events.data(), sizeof(TraceEvent), events.size(), file) == events.size());
+		std::fclose(file);
+
+		if (!bRead)
+		{
+			std::fprintf(stderr, "%s is cut short.\n", path);
+			return false;
+		}
+
+		return true;
+	}
+
+	// Milliseconds since the first event.
+	void PrintTimeline(const std::vector<TraceEvent>& events)
+	{
+		const uint64_t start = events.empty() ? 0 : events.front().time;
+
+		for (const TraceEvent& event : events)
+		{
+			std::printf("%14.6f ms  thread %-3u object %-4u %-16s id=%llu arg=%llu\n",
+						static_cast<double>(event.time - start) / 1e6, static_cast<unsigned>(event.thread),
+						static_cast<unsigned>(event.object), GetTraceEventName(event.type),
+						static_cast<unsigned long long>(event.id), static_cast<unsigned long long>(event.arg));
+		}
+	}
+
+	// Timestamps are microseconds since the first event.
+	void PrintChromeTrace(const std::vector<TraceEvent>& events)
+	{
+		const uint64_t start = events.empty() ? 0 : events.front().time;
+
+		std::printf("{\"displayTimeUnit\":\"ms\",\"traceEvents\":[");
+
+		bool bFirst = true;
+		auto separate = [&bFirst]()
+		{
+			std::printf(bFirst ? "\n" : ",\n");
+			bFirst = false;
+		};
+
+		// Naming the processes after what opened them, objects whose opening was overwritten keep their number.
+		std::set<uint32_t> named;
+		for (const TraceEvent& event : events)
+		{
+			if (((event.type == TraceEventType::senderOpened) || (event.type == TraceEventType::receiverOpened)) &&
+				named.insert(event.object).second)
+			{
+				separate();
+				std::printf("{\"name\":\"process_name\",\"ph\":\"M\",\"pid\":%u,\"args\":{\"name\":\"%s %u (port %llu)\"}}",
+							static_cast<unsigned>(event.object), (event.type == TraceEventType::senderOpened) ? "sender" : "receiver",
+							static_cast<unsigned>(event.object), static_cast<unsigned long long>(event.arg));
+			}
+		}
+
+		for (const TraceEvent& event : events)
+		{
+			const char* phase = "i";
+			const char* name = GetTraceEventName(event.type);
+			if (event.type == TraceEventType::streamBegin)
+			{
+				phase = "B";
+				name = "stream";
+			}
+			else if (event.type == TraceEventType::streamEnd)
+			{
+				phase = "E";
+				name = "stream";
+			}
+
+			separate();
+			std::printf("{\"name\":\"%s\",\"ph\":\"%s\",%s\"ts\":%.3f,\"pid\":%u,\"tid\":%u,\"args\":{\"id\":%llu,\"arg\":%llu}}",
+						name, phase, (phase[0] == 'i') ? "\"s\":\"t\"," : "", static_cast<double>(event.time - start) / 1e3,
+						static_cast<unsigned>(event.object), static_cast<unsigned>(event.thread),
+						static_cast<unsigned long long>(event.id), static_cast<unsigned long long>(event.arg));
+		}
+
+		std::printf("\n]}\n");
+	}
+}
+
+int main(int argc, char** argv)
+{
+	bool bChrome = false;
+	const char* path = nullptr;
+
+	for (int i = 1; i < argc; ++i)
+	{
+		if (std::strcmp(argv[i], "--chrome") == 0)
+		{
+			bChrome = true;
+		}
+		else if (std::strcmp(argv[i], "--timeline") == 0)
+		{
+			bChrome = false;
+		}
+		else if (path == nullptr)
+		{
+			path = argv[i];
+		}
+		else
+		{
+			path = nullptr;
+			break;
+		}
+	}
+
+	if (path == nullptr)
+	{
+		std::fprintf(stderr, "Usage: UDPRTraceDump [--timeline | --chrome] <dump>\n");
+		return 1;
+	}
+
+	std::vector<TraceEvent> events;
+	if (!ReadDump(path, events))
+	{
+		return 1;
+	}
+
+	if (bChrome)
+	{
+		PrintChromeTrace(events);
+	}
+	else
+	{
+		PrintTimeline(events);
+	}
+
+	return 0;
+}
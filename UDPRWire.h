@@ -0,0 +1,260 @@
+#pragma once
+
+/// STD
+#include <cstdint>
+#include <cstddef>
+#include <cstring>
+#include <tuple>
+#include <type_traits>
+#include <utility>
+
+// Whether integers are kept in wire order (little-endian) already, they are copied as they are then.
+#if defined(_WIN32) || (defined(__BYTE_ORDER__) && (__BYTE_ORDER__ == __ORDER_LITTLE_ENDIAN__))
+#define UDPR_WIRE_NATIVE
+#endif
+
+/// CUSTOM
+#include "UDPRDebugHeaders.h"
+#include "UDPRMisc.h"
+
+namespace UDPR
+{
+	/// The wire format's version, both handshakes end with it. Peers from before it was sent leave it out and count as
+	/// version 0, which has the same layout. Each end records the lower of both versions, nothing reads it yet, so a
+	/// later version that changes the layout has to branch on it.
+	static constexpr uint8_t WIRE_version = 1;
+
+	// Every integer goes over the wire little-endian, whatever order the host keeps it in. On little-endian hosts that
+	// is a single unaligned move, elsewhere a move and a byte swap.
+	template<class T>
+	FORCEINLINE static void WireStore(BYTE* at, T value)
+	{
+		static_assert(std::is_integral<T>::value && std::is_unsigned<T>::value, "Only unsigned integers go over the wire.");
+
+	#ifdef UDPR_WIRE_NATIVE
+		std::memcpy(reinterpret_cast<void*>(at), reinterpret_cast<const void*>(&value), sizeof(T));
+	#else
+		for (size_t i = 0; i < sizeof(T); ++i)
+		{
+			at[i] = static_cast<BYTE>(value >> (8 * i));
+		}
+	#endif
+	}
+
+	template<class T>
+	FORCEINLINE static T WireLoad(const BYTE* at)
+	{
+		static_assert(std::is_integral<T>::value && std::is_unsigned<T>::value, "Only unsigned integers go over the wire.");
+
+		T value;
+	#ifdef UDPR_WIRE_NATIVE
+		std::memcpy(reinterpret_cast<void*>(&value), reinterpret_cast<const void*>(at), sizeof(T));
+	#else
+		value = 0;
+		for (size_t i = 0; i < sizeof(T); ++i)
+		{
+			value |= static_cast<T>(static_cast<T>(at[i]) << (8 * i));
+		}
+	#endif
+
+		return value;
+	}
+
+	// Bytes up to the field at index.
+	template<class... TFields>
+	static constexpr size_t GetWireOffset(size_t index)
+	{
+		constexpr size_t sizes[] = { sizeof(TFields)... };
+
+		size_t offset = 0;
+		for (size_t i = 0; i < index; ++i)
+		{
+			offset += sizes[i];
+		}
+
+		return offset;
+	}
+
+	// The fixed part of a message, its fields in the order they go over the wire with nothing in between. Offsets and
+	// the size are known at compile time, so reading or writing a field is a move at a constant offset. Messages name
+	// their fields with an enum of their own:
+	//
+	//	struct WireProbe : WireLayout<uint8_t, uint16_t> { enum : size_t { type, probeSz }; };
+	//	uint16_t probeSz = WireProbe::Get<WireProbe::probeSz>(data);
+	//
+	// Field names mustn't hide the layout's own, size and the like.
+	template<class... TFields>
+	struct WireLayout
+	{
+		template<size_t I>
+		using Field = std::tuple_element_t<I, std::tuple<TFields...>>;
+
+		static constexpr size_t size = GetWireOffset<TFields...>(sizeof...(TFields));
+
+		// Where field I starts, and where it ends, which is how long a message that stops after it is.
+		template<size_t I>
+		static constexpr size_t offset = GetWireOffset<TFields...>(I);
+
+		template<size_t I>
+		static constexpr size_t end = GetWireOffset<TFields...>(I + 1);
+
+		template<size_t I>
+		FORCEINLINE static Field<I> Get(const BYTE* data)
+		{
+			return WireLoad<Field<I>>(data + offset<I>);
+		}
+
+		template<size_t I>
+		FORCEINLINE static void Set(BYTE* data, Field<I> value)
+		{
+			WireStore(data + offset<I>, value);
+		}
+
+		// Every field at once, in order.
+		FORCEINLINE static void Write(BYTE* data, TFields... values)
+		{
+			WriteFields(data, std::index_sequence_for<TFields...>(), values...);
+		}
+
+	private:
+		template<size_t... Is>
+		FORCEINLINE static void WriteFields(BYTE* data, std::index_sequence<Is...>, TFields... values)
+		{
+			(WireStore(data + offset<Is>, values), ...);
+		}
+	};
+
+	// Goes through the fields that follow a message's fixed part, the ones that are only there if a flag says so.
+	class WireReader
+	{
+	public:
+		WireReader(const BYTE* _data, int _dataLen, size_t _offset) :
+			data(_data),
+			dataLen((_dataLen > 0) ? static_cast<size_t>(_dataLen) : 0),
+			offset(_offset)
+		{
+		}
+
+		// Returns false without touching value if the message ends before it, every read after that fails too.
+		template<class T>
+		FORCEINLINE bool Read(T& value)
+		{
+			if ((offset > dataLen) || (dataLen - offset < sizeof(T)))
+			{
+				offset = dataLen + 1;
+				return false;
+			}
+
+			value = WireLoad<T>(data + offset);
+			offset += sizeof(T);
+			return true;
+		}
+
+	private:
+		const BYTE* data;
+		size_t dataLen;
+		size_t offset;
+	};
+
+	// Appends such fields, the buffer has to have room for all of them.
+	class WireWriter
+	{
+	public:
+		WireWriter(BYTE* _data, size_t _offset) :
+			data(_data),
+			offset(_offset)
+		{
+		}
+
+		template<class T>
+		FORCEINLINE void Write(T value)
+		{
+			WireStore(data + offset, value);
+			offset += sizeof(T);
+		}
+
+		// How long the message is so far.
+		FORCEINLINE int GetLength() const { return static_cast<int>(offset); }
+
+	private:
+		BYTE* data;
+		size_t offset;
+	};
+
+	/// Receiver to sender.
+
+	// Starts or restarts a transfer. Older receivers stop after the type or the window. The position to end at
+	// follows if HS_range is set, then the wire version.
+	struct WireHandshake : WireLayout<uint8_t, uint8_t, uint16_t, uint8_t, uint64_t>
+	{
+		enum : size_t { type, mode, window, flags, basePos };
+	};
+
+	// Asks for the packet with the ID, packetLen bytes long, holding the stream from pos on.
+	struct WireRequest : WireLayout<uint8_t, uint64_t, uint64_t, uint16_t>
+	{
+		enum : size_t { type, packetID, pos, packetLen };
+	};
+
+	// Everything before ack arrived, nothing at or past horizon has been seen. rangeCount WireReportRanges follow, then
+	// how many packets have been rebuilt so far if repairs come.
+	struct WireReport : WireLayout<uint8_t, uint64_t, uint64_t, uint8_t>
+	{
+		enum : size_t { type, ack, horizon, rangeCount };
+	};
+
+	struct WireReportRange : WireLayout<uint64_t, uint32_t>
+	{
+		enum : size_t { first, count };
+	};
+
+	// Asks for the digest of the stream in [from, to), the answer repeats both.
+	struct WireDigestRequest : WireLayout<uint8_t, uint64_t, uint64_t>
+	{
+		enum : size_t { type, from, to };
+	};
+
+	/// Sender to receiver.
+
+	// Answers a handshake, older senders stop after the mode. The stream's size, its fingerprint and the size of a
+	// repair group follow if the flags say so, in that order, then the wire version if the receiver sent flags.
+	struct WireHandshakeAnswer : WireLayout<uint8_t, uint16_t, uint8_t, uint8_t>
+	{
+		enum : size_t { type, packetSz, mode, flags };
+	};
+
+	// A probe is padded to its size, the answer is just as long as this.
+	struct WireProbe : WireLayout<uint8_t, uint16_t>
+	{
+		enum : size_t { type, probeSz };
+	};
+
+	// The block follows, right away or past the checksum.
+	struct WirePayload : WireLayout<uint8_t, uint64_t>
+	{
+		enum : size_t { type, packetID };
+	};
+
+	// The checksum covers the packet ID and everything after it.
+	struct WireChecksummedPayload : WireLayout<uint8_t, uint64_t, uint32_t>
+	{
+		enum : size_t { type, packetID, checksum };
+	};
+
+	// How a block is encoded when compression was agreed on, only compressed ones carry their length.
+	struct WireBlock : WireLayout<uint8_t, uint16_t>
+	{
+		enum : size_t { encoding, compressedLen };
+	};
+
+	// A repair of a group of count packets from firstID on, the repaired bytes follow.
+	struct WireRepair : WireLayout<uint8_t, uint64_t, uint8_t, uint8_t, uint16_t>
+	{
+		enum : size_t { type, firstID, count, index, lastLen };
+	};
+
+	struct WireDigest : WireLayout<uint8_t, uint64_t, uint64_t, uint32_t>
+	{
+		enum : size_t { type, from, to, digest };
+	};
+}